@@ -0,0 +1,184 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+//
+// fastcsv2json++:
+// microbenchmark of the render stage, run by make bench-render. A batch
+// of narrow fixed width records is rendered from its plan, then a line
+// at a time as --batch 1 does, with and without absent canonical columns
+//
+// Copyright © 2024 Lucas Tsatiris. All rights reserved.
+//
+
+#include "fastcsv2jsonxx.cpp"
+
+#include <cstdio>
+
+constexpr double BENCH_SECONDS = 0.5;				// time per measurement
+
+// tokens of every record of the batch, as the line tokenizer leaves them
+static std::vector<std::string> tokens;
+
+// keys of names as BindHeader builds them
+static void
+Keys (CData & data, const std::vector<std::string> & names)
+{
+  data.keys.clear ();
+  for (std::size_t column = 0; column < names.size (); column ++)
+    data.keys.push_back ((column == 0 ? "{\"" : "\",\"") + names[column] + "\":\"");
+}
+
+// a full batch of narrow fixed width records, split into their fields
+static void
+Fill (CData & data)
+{
+  auto & batch = data.batch;
+  const auto columns = data.validtokencount;
+  char line[64];
+
+  BatchClear (batch);
+  batch.fieldstart.clear ();
+  batch.fieldlength.clear ();
+  for (std::size_t record = 0; record < BATCH_RECORDS; record++)
+  {
+    const auto size = std::snprintf (line, sizeof (line), "%07zu,%.3s,%zu,%03zu", record,
+                                     "ABCDEFGH" + record % 4, record % 2, record % 1000);
+    const std::uint32_t begin = batch.text.size ();
+    batch.text.append (line, size);
+    batch.lineend.push_back (batch.text.size ());
+    batch.linenumber.push_back (record + 2);
+
+    std::uint32_t start = begin;
+    for (std::size_t counter = 0; counter < columns; counter++)
+    {
+      const auto end = batch.text.find (',', start);
+      const std::uint32_t stop = end == std::string::npos || end > batch.lineend.back () ?
+                                 batch.lineend.back () : end;
+      batch.fieldstart.push_back (start);
+      batch.fieldlength.push_back (stop - start);
+      start = stop + 1;
+    }
+  }
+  batch.row.assign (BATCH_RECORDS, ROW_VALID);
+
+  tokens.clear ();
+  for (std::size_t field = 0; field < batch.fieldstart.size (); field++)
+    tokens.push_back (batch.text.substr (batch.fieldstart[field], batch.fieldlength[field]));
+  batch.text.append (COPY_BLOCK, '\0');
+}
+
+// render the batch from its plan into json, as BatchConvert does
+static void
+RenderBatch (CData & data, std::string & json)
+{
+  auto & batch = data.batch;
+  const auto columns = data.validtokencount;
+  const auto bound = (BatchPlan (data) + 2) * BATCH_RECORDS;
+
+  json.resize (bound + COPY_BLOCK);
+  char *target = json.data ();
+  for (std::size_t record = 0; record < BATCH_RECORDS; record++)
+  {
+    if (record != 0)
+      target = std::copy_n (",\n", 2, target);
+    target = BatchRender (batch, record, columns, target);
+  }
+  json.resize (target - json.data ());
+}
+
+// render the batch a line at a time into json, as ConvertLine does
+static void
+RenderLines (CData & data, std::string & json)
+{
+  const auto columns = data.validtokencount;
+
+  json.clear ();
+  for (std::size_t record = 0; record < BATCH_RECORDS; record++)
+  {
+    const std::string *token = tokens.data () + record * columns;
+    data.outputline.clear ();
+    for (std::size_t counter = 0; counter < data.keys.size (); counter++)
+    {
+      const auto source = data.permutation.empty () ? static_cast<std::ptrdiff_t> (counter) :
+                          data.permutation[counter];
+      data.outputline += data.keys[counter];
+      data.outputline += source >= 0 ? std::string_view (token[source]) :
+                         std::string_view (data.canonicaldefaults[counter]);
+    }
+    data.outputline += "\"}";
+
+    if (record != 0)
+      json += ",\n";
+    json += data.outputline;
+  }
+}
+
+// time render over the batch for BENCH_SECONDS
+// returns: nanoseconds per record
+static double
+Measure (CData & data, std::string & json, void (*render) (CData &, std::string &))
+{
+  std::uint64_t rounds = 0;
+  const auto begin = std::chrono::steady_clock::now ();
+  std::chrono::duration<double> elapsed {};
+  do
+  {
+    render (data, json);
+    rounds ++;
+    elapsed = std::chrono::steady_clock::now () - begin;
+  }
+  while (elapsed.count () < BENCH_SECONDS);
+
+  return elapsed.count () * 1e9 / (rounds * BATCH_RECORDS);
+}
+
+int
+main ()
+{
+  int status = 0;
+  for (const bool canonical : { false, true })
+  {
+    CData data;
+    data.validtokencount = 4;
+    if (canonical)
+    {
+      Keys (data, { "id", "code", "region", "flag", "qty", "note" });
+      data.permutation = { 0, 1, -1, 2, 3, -1 };
+      data.canonicaldefaults = { "", "", "EU", "", "", "" };
+    }
+    else
+      Keys (data, { "id", "code", "flag", "qty" });
+    Fill (data);
+
+    std::string batched, lines;
+    const auto batchns = Measure (data, batched, RenderBatch);
+    const auto linens = Measure (data, lines, RenderLines);
+    const auto bytes = static_cast<double> (lines.size ()) / BATCH_RECORDS;
+    const char *name = canonical ? "absent canonical columns" : "input columns";
+
+    std::printf ("%s, %.1f json bytes a record\n", name, bytes);
+    std::printf ("  batch  %8.2f ns/record %9.1f MB/s\n", batchns, bytes * 1e3 / batchns);
+    std::printf ("  line   %8.2f ns/record %9.1f MB/s\n", linens, bytes * 1e3 / linens);
+    if (batched != lines)
+    {
+      std::printf ("FAIL: batch and line renders differ, %s\n", name);
+      status = 1;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,177 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+//
+// fastcsv2json++:
+// benchmark of the -j completion ring, run by make bench-ring. 32 and 64
+// producers complete chunks out of order for one writer taking them in
+// sequence, through the ring and through the mutex, condition variable
+// and map it replaced. The chunks in flight are bounded as in the engine
+//
+// Copyright © 2024 Lucas Tsatiris. All rights reserved.
+//
+
+#include "fastcsv2jsonxx.cpp"
+
+#include <cstdio>
+#include <semaphore>
+
+#include <sys/resource.h>
+
+constexpr std::uint64_t BENCH_CHUNKS = 200000;		// chunks completed per run
+constexpr unsigned BENCH_ROUNDS = 5;				// runs, the fastest is reported
+
+// completions through the ring of the engine
+struct RingQueue
+{
+  Parallel parallel;
+
+  explicit RingQueue (unsigned chunks)
+  {
+    parallel.completed = std::vector<CompletionSlot> (std::bit_ceil (chunks));
+    parallel.last.store (BENCH_CHUNKS);
+  }
+  void complete (Chunk *chunk) { ParallelComplete (parallel, chunk); }
+  Chunk *next (std::uint64_t sequence) { return ParallelNext (parallel, sequence); }
+};
+
+// completions through a map under a mutex, with a condition variable
+struct LockedQueue
+{
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::map<std::uint64_t, Chunk *> done;
+
+  explicit LockedQueue (unsigned) {}
+  void
+  complete (Chunk *chunk)
+  {
+    {
+      const std::lock_guard<std::mutex> lock (mutex);
+      done.emplace (chunk->sequence, chunk);
+    }
+    ready.notify_one ();
+  }
+  Chunk *
+  next (std::uint64_t sequence)
+  {
+    if (sequence == BENCH_CHUNKS)
+      return nullptr;
+    std::unique_lock<std::mutex> lock (mutex);
+    ready.wait (lock, [&] { return done.contains (sequence); });
+    const auto found = done.find (sequence);
+    Chunk *chunk = found->second;
+    done.erase (found);
+    return chunk;
+  }
+};
+
+// a chunk conversion of a varying few hundred nanoseconds, so the
+// chunks complete out of order
+static void
+Work (std::uint64_t sequence)
+{
+  volatile std::uint64_t sink = sequence;
+  const auto steps = 200 + (sequence * 7919) % 1000;
+  for (std::uint64_t step = 0; step < steps; step++)
+    sink = sink * 31 + step;
+}
+
+// complete BENCH_CHUNKS chunks on producers threads, with chunks in flight
+// returns: the seconds taken and the voluntary context switches
+template <typename Queue>
+static std::pair<double, long>
+Run (unsigned producers)
+{
+  const unsigned chunks = producers * CHUNKS_PER_WORKER + 2;
+  std::vector<Chunk> pool (chunks);
+  std::counting_semaphore<> free (chunks);
+  std::atomic<std::uint64_t> sequence {0};
+  Queue queue (chunks);
+
+  rusage before, after;
+  getrusage (RUSAGE_SELF, &before);
+  const auto begin = std::chrono::steady_clock::now ();
+
+  std::vector<std::thread> threads;
+  for (unsigned counter = 0; counter < producers; counter++)
+    threads.emplace_back ([&]
+    {
+      for (;;)
+      {
+        free.acquire ();
+        const auto taken = sequence.fetch_add (1);
+        if (taken >= BENCH_CHUNKS)
+        {
+          free.release ();
+          return;
+        }
+        Work (taken);
+        Chunk *chunk = &pool[taken % chunks];
+        chunk->sequence = taken;
+        queue.complete (chunk);
+      }
+    });
+
+  std::uint64_t next = 0;
+  for (Chunk *chunk; (chunk = queue.next (next)) != nullptr; next++)
+  {
+    if (chunk->sequence != next)
+    {
+      std::printf ("FAIL: chunk %llu taken for %llu\n",
+                   static_cast<unsigned long long> (chunk->sequence),
+                   static_cast<unsigned long long> (next));
+      std::exit (1);
+    }
+    free.release ();
+  }
+  for (auto & thread : threads)
+    thread.join ();
+
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now () - begin;
+  getrusage (RUSAGE_SELF, &after);
+  return { elapsed.count (), after.ru_nvcsw - before.ru_nvcsw };
+}
+
+// the fastest of BENCH_ROUNDS runs
+template <typename Queue>
+static void
+Report (const char *name, unsigned producers)
+{
+  std::pair<double, long> best { 1e300, 0 };
+  for (unsigned round = 0; round < BENCH_ROUNDS; round++)
+    best = std::min (best, Run<Queue> (producers));
+
+  std::printf ("  %-12s %8.3f s %10.0f chunks/s %10ld voluntary switches\n", name,
+               best.first, BENCH_CHUNKS / best.first, best.second);
+}
+
+int
+main ()
+{
+  std::printf ("%u cpus, %llu chunks per run, fastest of %u runs\n",
+               std::thread::hardware_concurrency (),
+               static_cast<unsigned long long> (BENCH_CHUNKS), BENCH_ROUNDS);
+  for (const unsigned producers : { 32u, 64u })
+  {
+    std::printf ("%u producers\n", producers);
+    Report<RingQueue> ("ring", producers);
+    Report<LockedQueue> ("mutex+cv", producers);
+  }
+  return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * fastcsv2json++:
+ * C interface of the converter engine, built into libfastcsv2json.so
+ * by make libfastcsv2json.so
+ *
+ *   fc2j_options options;
+ *   fc2j_converter *converter;
+ *
+ *   fc2j_options_init (&options);
+ *   options.write = MyWrite;
+ *   options.context = &mystate;
+ *   if (fc2j_open (&options, &converter) == FC2J_OK)
+ *   {
+ *     while (there is input)
+ *       fc2j_feed (converter, bytes, size);
+ *     fc2j_finish (converter);
+ *     fc2j_close (converter);
+ *   }
+ *
+ * Json reaches the write callback in blocks of at least block_size bytes,
+ * except the last one, never per record.
+ *
+ * Copyright © 2024 Lucas Tsatiris. All rights reserved.
+ */
+
+#ifndef FASTCSV2JSON_H
+#define FASTCSV2JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FC2J_API __attribute__ ((visibility ("default")))
+
+/* results of the fc2j_ functions */
+typedef enum fc2j_status
+{
+  FC2J_OK = 0,			/* success */
+  FC2J_EINVAL = 1,		/* invalid argument or option */
+  FC2J_ECONVERT = 2,	/* conversion stopped, see fc2j_error */
+  FC2J_EWRITE = 3,		/* the write callback failed */
+  FC2J_ENOMEM = 4,		/* out of memory */
+  FC2J_ESTATE = 5		/* converter finished or failed before */
+} fc2j_status;
+
+/* receives a block of json, returns 0 on success, anything else stops
+   the conversion with FC2J_EWRITE */
+typedef int (*fc2j_write_fn) (void *context, const char *data, size_t size);
+
+/* conversion options, set up by fc2j_options_init. New fields are only
+   ever appended, size tells the library which ones the caller knows */
+typedef struct fc2j_options
+{
+  size_t size;				/* sizeof (fc2j_options) */
+  char delimiter;			/* one of | , ; : space tab, default , */
+  size_t block_size;		/* smallest block passed to write, default 64K */
+  fc2j_write_fn write;		/* json output, required */
+  void *context;			/* passed to write */
+  const char *const *argv;	/* more command line options, may be NULL */
+  size_t argc;				/* entries in argv */
+} fc2j_options;
+
+typedef struct fc2j_converter fc2j_converter;
+
+/* defaults for every field */
+FC2J_API void fc2j_options_init (fc2j_options *options);
+
+/* new converter in *converter, to be released by fc2j_close */
+FC2J_API fc2j_status fc2j_open (const fc2j_options *options, fc2j_converter **converter);
+
+/* convert csv bytes, pieces may split lines anywhere */
+FC2J_API fc2j_status fc2j_feed (fc2j_converter *converter, const char *data, size_t size);
+
+/* convert the last line and write the rest of the json */
+FC2J_API fc2j_status fc2j_finish (fc2j_converter *converter);
+
+/* why the conversion stopped, an empty string when it did not */
+FC2J_API const char *fc2j_error (const fc2j_converter *converter);
+
+/* release a converter, NULL is ignored */
+FC2J_API void fc2j_close (fc2j_converter *converter);
+
+/* library version as major.minor.patch */
+FC2J_API const char *fc2j_version (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FASTCSV2JSON_H */
@@ -0,0 +1,218 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+//
+// fastcsv2json++:
+// C interface over fastcsv2jsonxx::Converter. No c++ exception crosses
+// it, every failure becomes an fc2j_status
+//
+// Copyright © 2024 Lucas Tsatiris. All rights reserved.
+//
+
+#include "fastcsv2json.h"
+#include "fastcsv2jsonxx.h"
+
+#include <new>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+constexpr std::size_t DEFAULT_BLOCK_SIZE = 1 << 16;	// default write block size
+
+struct fc2j_converter
+{
+  fastcsv2jsonxx::Converter converter;
+  fc2j_write_fn write;
+  void *context;
+  std::size_t blocksize;
+  bool closed = false;								// finished or failed
+
+  fc2j_converter (const std::vector<std::string> & options, const fc2j_options & settings)
+    : converter (options), write (settings.write), context (settings.context),
+      blocksize (settings.block_size != 0 ? settings.block_size : DEFAULT_BLOCK_SIZE)
+  {
+  }
+};
+
+// command line name of a delimiter character
+// returns: nullptr for unsupported delimiters
+static const char *
+DelimiterName (char delimiter)
+{
+  switch (delimiter)
+  {
+  case '|': return "pipe";
+  case 0:
+  case ',': return "comma";
+  case ';': return "semicolumn";
+  case ':': return "column";
+  case ' ': return "space";
+  case '\t': return "tab";
+  default: return nullptr;
+  }
+}
+
+// pass the pending json to the write callback, a block at a time unless
+// everything is asked for
+// returns: FC2J_OK or FC2J_EWRITE
+static fc2j_status
+Drain (fc2j_converter & handle, bool everything)
+{
+  auto & converter = handle.converter;
+  if (converter.Pending () == 0 || (!everything && converter.Pending () < handle.blocksize))
+    return FC2J_OK;
+
+  const auto block = converter.Take ();
+  if (handle.write (handle.context, block.data (), block.size ()) != 0)
+  {
+    converter.Fail ("Write callback failed");
+    handle.closed = true;
+    return FC2J_EWRITE;
+  }
+
+  return FC2J_OK;
+}
+
+extern "C" void
+fc2j_options_init (fc2j_options *options)
+{
+  if (options == nullptr)
+    return;
+
+  *options = fc2j_options {};
+  options->size = sizeof (fc2j_options);
+  options->delimiter = ',';
+  options->block_size = DEFAULT_BLOCK_SIZE;
+}
+
+extern "C" fc2j_status
+fc2j_open (const fc2j_options *options, fc2j_converter **converter)
+{
+  if (converter == nullptr)
+    return FC2J_EINVAL;
+  *converter = nullptr;
+
+  if (options == nullptr || options->size < sizeof (fc2j_options) ||
+      options->write == nullptr || (options->argc != 0 && options->argv == nullptr))
+    return FC2J_EINVAL;
+
+  const char *delimiter = DelimiterName (options->delimiter);
+  if (delimiter == nullptr)
+    return FC2J_EINVAL;
+
+  try
+  {
+    std::vector<std::string> arguments = { "-d", delimiter };
+    for (std::size_t counter = 0; counter < options->argc; counter ++)
+    {
+      if (options->argv[counter] == nullptr)
+        return FC2J_EINVAL;
+      arguments.emplace_back (options->argv[counter]);
+    }
+
+    auto *handle = new fc2j_converter (arguments, *options);
+    if (handle->converter.Error () != "")
+    {
+      delete handle;
+      return FC2J_EINVAL;
+    }
+
+    *converter = handle;
+    return FC2J_OK;
+  }
+  catch (const std::bad_alloc &)
+  {
+    return FC2J_ENOMEM;
+  }
+  catch (...)
+  {
+    return FC2J_EINVAL;
+  }
+}
+
+extern "C" fc2j_status
+fc2j_feed (fc2j_converter *converter, const char *data, std::size_t size)
+{
+  if (converter == nullptr || (data == nullptr && size != 0))
+    return FC2J_EINVAL;
+  if (converter->closed)
+    return FC2J_ESTATE;
+
+  try
+  {
+    if (!converter->converter.Feed (std::string_view (data, size)))
+    {
+      converter->closed = true;
+      return FC2J_ECONVERT;
+    }
+    return Drain (*converter, false);
+  }
+  catch (const std::bad_alloc &)
+  {
+    converter->closed = true;
+    return FC2J_ENOMEM;
+  }
+  catch (...)
+  {
+    converter->closed = true;
+    return FC2J_ECONVERT;
+  }
+}
+
+extern "C" fc2j_status
+fc2j_finish (fc2j_converter *converter)
+{
+  if (converter == nullptr)
+    return FC2J_EINVAL;
+  if (converter->closed)
+    return FC2J_ESTATE;
+
+  try
+  {
+    converter->closed = true;
+    if (!converter->converter.Finish ())
+      return FC2J_ECONVERT;
+    return Drain (*converter, true);
+  }
+  catch (const std::bad_alloc &)
+  {
+    return FC2J_ENOMEM;
+  }
+  catch (...)
+  {
+    return FC2J_ECONVERT;
+  }
+}
+
+extern "C" const char *
+fc2j_error (const fc2j_converter *converter)
+{
+  return converter != nullptr ? converter->converter.Error ().c_str () : "";
+}
+
+extern "C" void
+fc2j_close (fc2j_converter *converter)
+{
+  delete converter;
+}
+
+extern "C" const char *
+fc2j_version (void)
+{
+  return fastcsv2jsonxx::Version ().data ();
+}
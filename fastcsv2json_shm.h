@@ -0,0 +1,100 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * fastcsv2json++:
+ * shared memory output ring of -o shm:/name, single producer (the
+ * converter) and single consumer. fastcsv2json_shmcat.c is a reference
+ * consumer.
+ *
+ * Layout of the shm_open object /name:
+ *
+ *   0                     fc2j_shm_header
+ *   FC2J_SHM_HEADER_SIZE  ring of capacity bytes
+ *
+ * The json output is a byte stream. head and tail count the bytes ever
+ * written and consumed, byte n lives at ring offset n % capacity. The
+ * bytes from tail to head are ready to consume. capacity is a multiple
+ * of the page size, so the ring can be mapped twice in a row and every
+ * range of up to capacity bytes is contiguous.
+ *
+ * Protocol, all fields accessed atomically:
+ *
+ *   producer: unlinks any object of the same name, so a consumer still
+ *     reading an old ring keeps it, creates the object exclusively, fills
+ *     the header with its pid and stores magic last (release). To write, waits until capacity - (head - tail) > 0,
+ *     copies bytes at head, stores head (release), increments headseq
+ *     and, when consumer_waiting is set, futex wakes headseq. At the end
+ *     it stores state (release) and wakes headseq the same way.
+ *
+ *   consumer: opens the object, waits for magic (acquire). An object
+ *     still FC2J_SHM_OPEN whose producer process is gone is stale, the
+ *     consumer waits for the next producer instead, and gives up on a
+ *     ring whose producer exits without ending the stream. Loads state
+ *     (acquire) and then head (acquire). Bytes from tail to head are
+ *     consumed, then tail is stored (release), tailseq incremented and
+ *     tailseq futex woken when producer_waiting is set. When no bytes
+ *     are ready, a state other than FC2J_SHM_OPEN ends the stream.
+ *     Otherwise it sets consumer_waiting, loads headseq, checks head
+ *     again and futex waits on headseq with that value, then clears
+ *     consumer_waiting. The consumer unlinks the object when done.
+ *
+ *   The producer waits for space the same way, with producer_waiting
+ *   and tailseq. A producer without a consumer blocks once the ring is
+ *   full.
+ *
+ * Copyright © 2024 Lucas Tsatiris. All rights reserved.
+ */
+
+#ifndef FASTCSV2JSON_SHM_H
+#define FASTCSV2JSON_SHM_H
+
+#include <stdint.h>
+
+#define FC2J_SHM_MAGIC 0x524a3246u		/* "F2JR" */
+#define FC2J_SHM_VERSION 2u
+#define FC2J_SHM_HEADER_SIZE 4096u		/* ring offset in the object */
+
+/* producer state */
+#define FC2J_SHM_OPEN 0u				/* writing */
+#define FC2J_SHM_DONE 1u				/* all the json is in the ring */
+#define FC2J_SHM_FAILED 2u				/* the conversion failed */
+
+typedef struct fc2j_shm_header
+{
+  uint32_t magic;						/* FC2J_SHM_MAGIC once initialized */
+  uint32_t version;						/* FC2J_SHM_VERSION */
+  uint64_t capacity;					/* ring bytes */
+  uint32_t state;						/* FC2J_SHM_OPEN, _DONE or _FAILED */
+  uint32_t producer;					/* pid of the producer */
+  uint8_t pad0[40];
+
+  /* written by the producer, own cache line */
+  uint64_t head;						/* bytes written */
+  uint32_t headseq;						/* futex word, bumped after head or state */
+  uint32_t consumer_waiting;			/* consumer sleeps on headseq */
+  uint8_t pad1[48];
+
+  /* written by the consumer, own cache line */
+  uint64_t tail;						/* bytes consumed */
+  uint32_t tailseq;						/* futex word, bumped after tail */
+  uint32_t producer_waiting;			/* producer sleeps on tailseq */
+  uint8_t pad2[48];
+} fc2j_shm_header;
+
+#endif /* FASTCSV2JSON_SHM_H */
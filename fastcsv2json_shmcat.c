@@ -0,0 +1,220 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * fastcsv2json++:
+ * reference consumer of -o shm:/name, built by make shmcat. Copies the
+ * ring to STDOUT following the protocol of fastcsv2json_shm.h
+ *
+ *   fastcsv2jsonxx -i myfile.csv -o shm:/myring &
+ *   fastcsv2json_shmcat /myring > myfile.json
+ *
+ * Copyright © 2024 Lucas Tsatiris. All rights reserved.
+ */
+
+#include "fastcsv2json_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* futex operation on a word of the shared header, waits give up after
+   timeout when it is not NULL */
+static void
+Futex (uint32_t *word, int operation, uint32_t value, const struct timespec *timeout)
+{
+  syscall (SYS_futex, word, operation, value, timeout, NULL, 0);
+}
+
+/* returns: nonzero while the producer process of the ring exists */
+static int
+ProducerAlive (const fc2j_shm_header *header)
+{
+  return header->producer == 0 || kill ((pid_t) header->producer, 0) == 0 || errno == EPERM;
+}
+
+/* open the ring, waiting for the producer to create and initialize it.
+   A ring left open by a producer that is gone is stale, the wait goes
+   on for the next producer
+   returns: the descriptor, -1 on error */
+static int
+Open (const char *name)
+{
+  const struct timespec pause = { 0, 10000000 };
+
+  for (;;)
+  {
+    const int fd = shm_open (name, O_RDWR, 0);
+    if (fd == -1 && errno != ENOENT)
+      return -1;
+
+    if (fd != -1)
+    {
+      const off_t size = lseek (fd, 0, SEEK_END);
+      if (size >= (off_t) FC2J_SHM_HEADER_SIZE)
+      {
+        fc2j_shm_header *header =
+          mmap (NULL, FC2J_SHM_HEADER_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+        if (header != MAP_FAILED)
+        {
+          const uint32_t magic = __atomic_load_n (&header->magic, __ATOMIC_ACQUIRE);
+          const int stale = magic == FC2J_SHM_MAGIC && header->version == FC2J_SHM_VERSION &&
+            __atomic_load_n (&header->state, __ATOMIC_ACQUIRE) == FC2J_SHM_OPEN &&
+            !ProducerAlive (header);
+          munmap (header, FC2J_SHM_HEADER_SIZE);
+          if (magic == FC2J_SHM_MAGIC && !stale)
+            return fd;
+        }
+      }
+      close (fd);
+    }
+
+    nanosleep (&pause, NULL);
+  }
+}
+
+/* write all of size bytes
+   returns: 0 on success, -1 on error */
+static int
+WriteAll (const char *data, size_t size)
+{
+  while (size != 0)
+  {
+    const ssize_t count = write (STDOUT_FILENO, data, size);
+    if (count == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += count;
+    size -= (size_t) count;
+  }
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  if (argc != 2)
+  {
+    fprintf (stderr, "Usage: %s /name\n", argv[0]);
+    return 1;
+  }
+
+  const int fd = Open (argv[1]);
+  if (fd == -1)
+  {
+    fprintf (stderr, "%s: %s\n", argv[1], strerror (errno));
+    return 1;
+  }
+
+  fc2j_shm_header *header =
+    mmap (NULL, FC2J_SHM_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED || header->version != FC2J_SHM_VERSION)
+  {
+    fprintf (stderr, "%s: %s\n", argv[1],
+             header == MAP_FAILED ? strerror (errno) : "unsupported version");
+    return 1;
+  }
+
+  /* map the ring twice in a row, every range is contiguous */
+  const size_t capacity = header->capacity;
+  char *ring = mmap (NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  for (size_t half = 0; half < 2 && ring != MAP_FAILED; half ++)
+    if (mmap (ring + half * capacity, capacity, PROT_READ, MAP_SHARED | MAP_FIXED,
+              fd, FC2J_SHM_HEADER_SIZE) == MAP_FAILED)
+    {
+      munmap (ring, 2 * capacity);
+      ring = MAP_FAILED;
+    }
+  close (fd);
+  if (ring == MAP_FAILED)
+  {
+    fprintf (stderr, "%s: %s\n", argv[1], strerror (errno));
+    return 1;
+  }
+
+  /* waits time out to notice a producer that exits without ending the
+     stream */
+  const struct timespec timeout = { 1, 0 };
+  uint64_t tail = header->tail;
+  uint32_t state = FC2J_SHM_OPEN;
+  int result = 0;
+
+  for (;;)
+  {
+    /* state before head: once the stream ended, head is final */
+    state = __atomic_load_n (&header->state, __ATOMIC_ACQUIRE);
+    const uint64_t head = __atomic_load_n (&header->head, __ATOMIC_ACQUIRE);
+
+    if (head != tail)
+    {
+      if (WriteAll (ring + tail % capacity, head - tail) == -1)
+      {
+        perror ("write");
+        result = 1;
+        break;
+      }
+      tail = head;
+      __atomic_store_n (&header->tail, tail, __ATOMIC_RELEASE);
+      __atomic_fetch_add (&header->tailseq, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n (&header->producer_waiting, __ATOMIC_SEQ_CST) != 0)
+        Futex (&header->tailseq, FUTEX_WAKE, 1, NULL);
+      continue;
+    }
+
+    if (state != FC2J_SHM_OPEN)
+      break;
+
+    if (!ProducerAlive (header))
+    {
+      /* the stream may have ended just before the producer exited */
+      if (__atomic_load_n (&header->state, __ATOMIC_ACQUIRE) != FC2J_SHM_OPEN)
+        continue;
+      fprintf (stderr, "%s: producer exited\n", argv[1]);
+      result = 1;
+      break;
+    }
+
+    __atomic_store_n (&header->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    const uint32_t sequence = __atomic_load_n (&header->headseq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&header->head, __ATOMIC_SEQ_CST) == tail &&
+        __atomic_load_n (&header->state, __ATOMIC_SEQ_CST) == FC2J_SHM_OPEN)
+      Futex (&header->headseq, FUTEX_WAIT, sequence, &timeout);
+    __atomic_store_n (&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+  }
+
+  if (state == FC2J_SHM_FAILED)
+  {
+    fprintf (stderr, "%s: conversion failed\n", argv[1]);
+    result = 1;
+  }
+
+  munmap (ring, 2 * capacity);
+  munmap (header, FC2J_SHM_HEADER_SIZE);
+  shm_unlink (argv[1]);
+  return result;
+}
@@ -28,6 +28,9 @@
 #error C++20 compiler required.
 #endif
 
+#include "fastcsv2jsonxx.h"
+#include "fastcsv2json_shm.h"
+
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -35,6 +38,44 @@
 #include <array>
 #include <string_view>
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iomanip>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <bit>
+#include <sstream>
+#include <bitset>
+#include <charconv>
+#include <cctype>
+#include <functional>
+#include <map>
+#include <deque>
+#include <condition_variable>
+#include <tuple>
+#include <numeric>
+
+#include <zlib.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+#include <sched.h>
+#endif
 
 
 // version information
@@ -45,267 +86,6604 @@ constexpr unsigned VERSION_PATCH = 0;	// patch
 
 constexpr int MAX_TOKEN_COUNT = 4096;		// max token count per csv line
 constexpr int STRING_RESERVE_SIZE = 256;	// std::string reserve chars
+constexpr std::size_t OUTPUT_BLOCK_SIZE = 1 << 16;	// output block write size
+constexpr std::size_t READ_BLOCK_SIZE = 1 << 20;	// default input block size
+constexpr unsigned READ_DEPTH = 4;			// default blocks to read ahead
+constexpr std::size_t BATCH_RECORDS = 1024;	// default records per batch
+constexpr std::size_t BATCH_BYTES = 1 << 20;	// batch text converted once this full
+#ifdef FASTCSV2JSONXX_LATENCY
+constexpr unsigned LATENCY_SAMPLE = 64;	// measure one record in LATENCY_SAMPLE
+#endif
+
+// conversion pipeline stages measured by --stats
+enum Stage : unsigned
+{
+  STAGE_READ = 0,							// read a line from input
+  STAGE_FILTER,								// -r and -e character filters
+  STAGE_TOKENIZE,							// split a line into tokens
+  STAGE_VALIDATE,							// --validate schema checks
+  STAGE_TRANSFORM,							// --mask and --replace
+  STAGE_RENDER,								// build the json record
+  STAGE_WRITE,								// send the json record to output
+  STAGE_WAIT,								// blocked on a queue of another thread
+  STAGE_COUNT
+};
+
+constexpr const char *stagename[STAGE_COUNT] =
+  { "read", "filter", "tokenize", "validate", "transform", "render",
+    "write", "wait" };
+
+// hardware counters opened by --stats=hw
+enum HwCounter : unsigned
+{
+  HW_CYCLES = 0,
+  HW_INSTRUCTIONS,
+  HW_BRANCH_MISSES,
+  HW_L1D_MISSES,
+  HW_LLC_MISSES,
+  HW_DTLB_MISSES,
+  HW_COUNT
+};
+
+using HwValues = std::array<std::uint64_t, HW_COUNT>;
+
+constexpr unsigned HISTOGRAM_SUB_BITS = 3;			// 8 buckets per power of two
+constexpr unsigned HISTOGRAM_SIZE = (65 - HISTOGRAM_SUB_BITS) << HISTOGRAM_SUB_BITS;
+
+// log-linear (hdr style) histogram of nanosecond durations, accurate to
+// 1 / (1 << HISTOGRAM_SUB_BITS). Written by its owner thread only, read
+// by any thread
+struct Histogram
+{
+  std::array<std::atomic<std::uint64_t>, HISTOGRAM_SIZE> counts {};
+  std::atomic<std::uint64_t> sum {0};				// sum of values
+};
+
+using StageHistograms = std::array<Histogram, STAGE_COUNT>;
+
+// add to a counter written only by its owner thread
+static inline void
+Add (std::atomic<std::uint64_t> & counter, std::uint64_t value) noexcept
+{
+  counter.store (counter.load (std::memory_order_relaxed) + value,
+                 std::memory_order_relaxed);
+}
+
+// conversion statistics. --stats command line argument
+struct Statistics
+{
+  bool enabled = false;								// --stats
+  bool hardware = false;							// --stats=hw
+  int hwleader = -1;								// perf event group leader
+  std::array<int, HW_COUNT> hwfd;					// perf event descriptors
+  std::array<unsigned, HW_COUNT> hwslot;			// position in group read
+  unsigned hwopened = 0;							// opened counter count
+  HwValues hwlast {};								// counter values at last read
+  std::array<std::uint64_t, STAGE_COUNT> hwpending {};	// stage ns since the last read
+  std::uint64_t hwpendingns = 0;					// their sum
+  std::array<HwValues, STAGE_COUNT> hw {};			// counter deltas per stage
+  std::array<std::uint64_t, STAGE_COUNT> ns {};		// nanoseconds per stage
+  std::chrono::steady_clock::time_point start;		// conversion start
+  std::chrono::steady_clock::time_point last;		// last lap
+  std::atomic<std::uint64_t> bytes_in {0};			// input bytes
+  std::atomic<std::uint64_t> bytes_out {0};			// output bytes
+  std::atomic<std::uint64_t> records {0};			// json records written
+  std::atomic<std::uint64_t> badrows {0};			// rows with invalid token count
+  std::unique_ptr<StageHistograms> latency;			// stage durations, --metrics
+  std::uint64_t readcalls = 0;						// read system calls
+  std::uint64_t readbytes = 0;						// bytes read by them
+  std::uint64_t readns = 0;							// nanoseconds spent in them
+  std::string tuning = "";							// --auto-tune outcome
+  std::string pinning = "";							// --pin layout
+  std::string limits = "";							// cgroup cpu and memory limits
+  std::uint64_t buffercapacity = 0;					// -j output buffers before stalling
+  std::uint64_t bufferallocs = 0;					// -j output buffers allocated
+  std::uint64_t bufferstalls = 0;					// waits for a returned output buffer
+#ifdef FASTCSV2JSONXX_LATENCY
+  std::unique_ptr<Histogram> recordlatency;			// sampled read to write latency
+  std::unique_ptr<Histogram> blocklatency;			// output block latency
+#endif
+};
+
+// span recorded by --trace
+struct TraceEvent
+{
+  std::int64_t start;								// steady clock nanoseconds
+  std::int64_t duration;							// nanoseconds
+  unsigned name;									// Stage
+};
+
+constexpr std::size_t TRACE_RING_SIZE = 1 << 18;	// spans kept per thread
+constexpr std::int64_t TRACE_MIN_DURATION = 1000;	// shortest span recorded, ns
+
+// per thread ring of spans. Only the owning thread writes the ring, so
+// recording is a plain store and a release increment of head. The rings
+// are read when the trace is written, after the threads are finished
+struct TraceRing
+{
+  std::array<TraceEvent, TRACE_RING_SIZE> events;	// most recent spans
+  std::atomic<std::uint64_t> head {0};				// spans recorded so far
+  std::string threadname;							// thread name in the trace
+  unsigned tid = 0;									// thread id in the trace
+};
+
+// input block reader. Reads --read-block sized blocks and hands out
+// complete lines, carrying a partial last line over to the next block
+struct BlockReader
+{
+  int fd = 0;										// input descriptor, STDIN
+  std::vector<char> buffer;							// carried line and block
+  std::size_t begin = 0;							// first unconsumed byte
+  std::size_t end = 0;								// end of read bytes
+  std::size_t blocksize = READ_BLOCK_SIZE;			// --read-block
+  unsigned depth = READ_DEPTH;						// --read-depth
+  std::uint64_t offset = 0;							// file offset of the next read
+  std::uint64_t ahead = 0;							// readahead issued up to here
+  bool regular = false;								// input is a regular file
+  bool eof = false;									// end of input or error
+  struct Archive *archive = nullptr;				// archive member, else fd
+  bool memory = false;								// bytes are the input, else fd
+  std::string_view bytes {};						// input bytes not read yet
+#ifdef FASTCSV2JSONXX_LATENCY
+  std::chrono::steady_clock::time_point arrival;	// last block read completion
+#endif
+};
+
+// compiled check of one column. --validate command line argument
+struct Validator
+{
+  std::string column;								// column name
+  std::size_t index;								// column position in the header
+  const char *keyword;								// schema keyword
+  std::function<bool (std::string_view)> check;		// true when the token is valid
+};
+
+// --mask or --replace rule of one column
+struct Rewrite
+{
+  std::string column;								// column name
+  std::size_t index = 0;							// column position in the header
+  std::shared_ptr<struct Dfa> dfa;					// anchored pattern dfa
+  std::shared_ptr<struct Dfa> reverse;				// reversed pattern dfa, unanchored but with $
+  std::string literal = "";							// text every match contains
+  bool atstart = false;								// ^, matches start the token
+  bool atend = false;								// $, matches end the token
+  bool mask = false;								// --mask, else --replace
+  std::string replacement = "";						// --replace text
+};
+
+// --hash-col rule of one column
+struct HashRule
+{
+  std::string column;								// column name
+  std::size_t index = 0;							// column position in the header
+  unsigned crounds = 2;								// siphash compression rounds
+  unsigned drounds = 4;								// siphash finalization rounds
+};
+
+// rows with an invalid token count or failing --validate
+enum BadRowPolicy : unsigned
+{
+  BADROWS_SKIP = 0,									// drop the row
+  BADROWS_REPORT,									// drop the row, print why
+  BADROWS_ABORT										// stop the conversion
+};
+
+// state of a batched record
+enum BatchRow : unsigned char
+{
+  ROW_VALID = 0,									// rendered
+  ROW_FIELDS,										// invalid field count
+  ROW_INVALID										// failed a --validate check
+};
+
+constexpr std::uint32_t WIDTH_VARIABLE = UINT32_MAX;	// column width varies in a batch
+constexpr std::uint32_t PIECE_END = UINT32_MAX;		// last piece of a record
+constexpr std::size_t COPY_BLOCK = 16;				// bytes per block store
+
+// constant bytes of a rendered record, the keys and absent canonical
+// columns, followed by the value of an input column
+struct RenderPiece
+{
+  std::uint32_t offset;								// constant bytes in fragments
+  std::uint32_t size;								// their size
+  std::uint32_t column;								// input column, PIECE_END for none
+  std::uint32_t width;								// value width, WIDTH_VARIABLE if it varies
+};
+
+// records converted a stage at a time: every record of the batch is
+// tokenized, then validated, then rendered. Fields are kept as a
+// structure of arrays, validtokencount offsets and lengths per record
+// into text. --batch command line argument
+struct Batch
+{
+  std::string text = "";							// filtered lines, back to back
+  std::vector<std::uint32_t> lineend;				// end of each line in text
+  std::vector<unsigned> linenumber;					// input line of each record
+  std::vector<std::uint32_t> fieldstart;			// field offsets in text
+  std::vector<std::uint32_t> fieldlength;			// field lengths
+  std::vector<BatchRow> row;						// state of each record
+  std::vector<const Validator *> failed;			// check failed by a ROW_INVALID
+  std::vector<std::uint32_t> width;					// width of each input column
+  std::string fragments = "";						// constant bytes of the pieces, padded
+  std::vector<RenderPiece> pieces;					// a record as rendered
+#ifdef FASTCSV2JSONXX_LATENCY
+  std::vector<std::chrono::steady_clock::time_point> arrival;	// arrival of each record
+#endif
+};
+
+// how the inputs are written, --members
+enum MembersOutput : unsigned
+{
+  MEMBERS_ARRAY = 0,								// one json array
+  MEMBERS_NDJSON,									// json lines with a _file key
+  MEMBERS_SPLIT										// a json array file per input
+};
 
 // conversion data
 struct CSV2JSONData
 {
-  std::istream *in = &std::cin;						// input stream
+  BlockReader reader;								// input
   std::ostream *out = &std::cout;					// output stream
   std::array<std::string, MAX_TOKEN_COUNT> tokens;	// csv line tokens
   std::vector<std::string> s_header;				// csv header std::string
   std::vector<std::string_view> header;				// csv header std::string_view
+  std::vector<std::string> keys;					// rendered "key":" per column
+  std::vector<std::vector<std::string>> headerparts;	// header rows read so far
+  unsigned headerrow = 1;							// --header-row
+  unsigned headerrows = 1;							// --header-rows
+  std::string headerjoin = ".";						// --header-join
+  unsigned leadinglines = 0;						// lines converted before the keys
+  bool canonicalschema = false;						// --canonical-schema
+  std::vector<std::string> canonical;				// canonical columns
+  std::vector<std::string> canonicaldefaults;		// value of absent canonical columns
+  std::vector<std::pair<std::string, std::string>> columndefaults;	// --column-default
+  std::vector<std::ptrdiff_t> permutation;			// input column of a canonical one, -1 if absent
   std::vector<char> replacewithspace;				// character to replace with space from input
   std::vector<char> erasechars;		    			// character to erase from input
   std::string inputline;							// input line buffer
   std::string outputline;							// output buffer
+  Batch batch;										// records waiting for conversion
+  std::size_t batchrecords = BATCH_RECORDS;			// --batch
+  std::string outblock;								// output block
   std::string_view delimiter = ",";					// delimiter, default comma
-  std::string infilepath = "";						// input file path
+  std::size_t (*tokenizer) (struct CSV2JSONData &) = nullptr;	// --dialect tokenizer
+  bool escape = false;								// json escape keys and values
+  std::string carry = "";							// record continued on the next line
+  std::vector<std::string> infilepaths;				// input file paths, STDIN if none
+  std::string inputname = "";						// input file or archive member path
+  MembersOutput members = MEMBERS_ARRAY;			// --members
+  bool membersset = false;							// --members given
   std::string outfilepath = "";						// output file path
+  struct ShmRing *shm = nullptr;					// -o shm:/name ring
+  std::size_t shmsize = 0;							// --shm-size
+  unsigned threads = 1;								// -j worker threads
+  bool autotune = false;							// --auto-tune
+  unsigned decoders = 0;							// zip members decoded ahead, 0 per cpu
+  unsigned cpus = 1;								// cpus usable, affinity and cpu.max
+  std::uint64_t memorylimit = 0;					// cgroup memory.max, 0 for none
+  std::string cgrouppath = "";						// --cgroup, the process's if empty
+  std::string pin = "";								// --pin compact, scatter or cpu list
+  std::vector<int> pincpus;							// cpus of the --pin slots, empty unpinned
+  struct Parallel *parallel = nullptr;				// -j engine, nullptr on one thread
+  struct Chunk *chunk = nullptr;					// chunk converted by this worker
+  struct BufferPool *pool = nullptr;				// -j output buffers
+  unsigned poolslot = 0;							// this thread's free buffers
   std::size_t validtokencount = 0;	    			// valid token count
   unsigned line_counter = 0;						// line counter
+  unsigned skiplines = 0;							// --skip-lines
+  char commentchar = 0;								// --comment-char, 0 for none
+  bool skipping = false;							// --skip-lines or --comment-char
+  std::uint64_t written = 0;						// json records written
+  std::string schemapath = "";						// --validate schema path
+  std::vector<Validator> schema;					// --validate compiled checks
+  std::vector<Validator> validators;				// --validate checks bound to the header
+  BadRowPolicy badrows = BADROWS_SKIP;				// --bad-rows
+  std::string error = "";							// why the conversion stopped
+  std::vector<Rewrite> rewrites;					// --mask and --replace
+  std::string scratch;								// rewritten token buffer
+  std::vector<char> matchstarts;					// match starts in a rewritten token
+  std::vector<HashRule> hashes;						// --hash-col
+  std::string hashkeypath = "";						// --hash-key
+  std::array<std::uint64_t, 2> hashkey {};			// siphash key
+  Statistics stats;									// --stats
+  std::string tracepath = "";						// --trace output file path
+  TraceRing *trace = nullptr;						// this thread's trace ring
+  std::string metricsaddress = "";					// --metrics listen address
+  bool instrumented = false;						// --stats, --trace or --metrics
+  std::chrono::steady_clock::time_point lastlap;	// last stage boundary
+#ifdef FASTCSV2JSONXX_LATENCY
+  using TimePoint = std::chrono::steady_clock::time_point;
+  TimePoint arrival;								// arrival of the current line
+  TimePoint blockarrival;							// arrival of the output block
+  bool blockpending = false;						// output block has records
+  unsigned latencycounter = 0;						// records since the last sample
+  std::vector<TimePoint> latencysamples;			// sampled records in the block
+#endif
 };
 
 using CData = struct CSV2JSONData;
 
-// tokenize inputline into tokens
-// returns: the token count
-static const std::size_t
-Tokenize(CData & data)
+#ifdef __linux__
+// open a perf event counting user space of this thread
+// returns: the event descriptor, -1 on error
+static int
+PerfEventOpen (std::uint32_t type, std::uint64_t config, int group) noexcept
 {
-  const std::string_view
-  inputline (data.inputline);
+  perf_event_attr attr;
 
-  std::string::size_type
-  start = 0,
-  end = inputline.find (data.delimiter);
+  std::memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group == -1 ? 1 : 0;	// the leader starts the group
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP |
+                     PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
 
-  std::size_t column = 0;
+  return static_cast<int> (syscall (SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+#endif
 
-  while (end != std::string::npos)
+// open hardware counters for --stats=hw. Counters the cpu, the kernel
+// or the container do not allow are left out
+// returns: the count of opened counters
+static unsigned
+StatsOpenHardware (Statistics & stats) noexcept
+{
+  stats.hwfd.fill (-1);
+  stats.hwopened = 0;
+
+#ifdef __linux__
+  constexpr auto
+  cache = [] (std::uint64_t id) constexpr
   {
-    data.tokens[column++] = inputline.substr (start, end - start);
-    start = end + 1; // Move past the delimiter
-    end = inputline.find (data.delimiter, start);
+    return id |
+           (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  };
+
+  const std::array<std::pair<std::uint32_t, std::uint64_t>, HW_COUNT> events =
+  {{
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, cache (PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, cache (PERF_COUNT_HW_CACHE_DTLB) }
+  }};
+
+  int error = 0;
+  for (unsigned counter = 0; counter < HW_COUNT; counter++)
+  {
+    const int fd =
+      PerfEventOpen (events[counter].first, events[counter].second, stats.hwleader);
+
+    if (fd == -1)
+    {
+      error = errno;
+      continue;
+    }
+
+    if (stats.hwleader == -1)
+      stats.hwleader = fd;
+    stats.hwfd[counter] = fd;
+    stats.hwslot[counter] = stats.hwopened++;
   }
 
-  // add the last token
-  data.tokens[column++] = inputline.substr (start);
-  data.tokens[column - 1].pop_back ();
+  if (stats.hwopened == 0)
+  {
+    std::cerr << "Hardware counters unavailable: " << std::strerror (error) << '\n';
+    return 0;
+  }
 
-  return column;
+  ioctl (stats.hwleader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl (stats.hwleader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+  std::cerr << "Hardware counters unavailable on this platform" << '\n';
+#endif
+
+  return stats.hwopened;
 }
 
-// tokenize inputline into tokens using delimeter
-// returns: the token count
-static const std::size_t
-TokenizeLine (CData & data)
+// read the hardware counter group into values
+// returns: true when the group ran the whole time it was enabled
+static bool
+StatsReadHardware (Statistics & stats, HwValues & values) noexcept
 {
-  data.inputline.append (" "); // iostream discards last character
-  auto ntokens = Tokenize (data);
+#ifdef __linux__
+  // nr, time enabled, time running, values
+  std::uint64_t buffer[3 + HW_COUNT];
 
-  // when no tokens or too many tokens found, do nothing
-  if (ntokens == 0 || ntokens > MAX_TOKEN_COUNT) [[unlikely]]
-    return 0;
+  if (read (stats.hwleader, buffer, sizeof (buffer)) <= 0) [[unlikely]]
+    return false;
+
+  for (unsigned counter = 0; counter < HW_COUNT; counter++)
+    if (stats.hwfd[counter] != -1)
+      values[counter] = buffer[3 + stats.hwslot[counter]];
+
+  return buffer[1] == buffer[2];
+#else
+  return false;
+#endif
+}
+
+// close hardware counters
+static void
+StatsCloseHardware (Statistics & stats) noexcept
+{
+#ifdef __linux__
+  for (auto & fd : stats.hwfd)
+    if (fd != -1)
+      close (fd);
+#endif
+  stats.hwfd.fill (-1);
+  stats.hwleader = -1;
+}
+
+// start measuring
+static void
+StatsStart (Statistics & stats) noexcept
+{
+  if (!stats.enabled)
+    return;
+
+  if (stats.hardware)
+    stats.hardware = StatsOpenHardware (stats) != 0;
+
+  stats.start = stats.last = std::chrono::steady_clock::now ();
+  if (stats.hardware)
+    StatsReadHardware (stats, stats.hwlast);
+}
+
+// read the hardware counter group and split the events since the last
+// read across the stages in proportion to their time
+static void
+StatsSplitHardware (Statistics & stats) noexcept
+{
+  if (!stats.hardware || stats.hwpendingns == 0)
+    return;
 
-  // the first line is the header
-  if (data.line_counter == 1) [[unlikely]]
+  HwValues values = stats.hwlast;
+  StatsReadHardware (stats, values);
+  for (unsigned counter = 0; counter < HW_COUNT; counter++)
   {
-    // copy tokens to std::string header
-    std::copy(data.tokens.begin(), data.tokens.begin() + ntokens,
-              std::back_inserter(data.s_header));
+    const auto events = values[counter] - stats.hwlast[counter];
+    for (unsigned stage = 0; stage < STAGE_COUNT; stage++)
+      stats.hw[stage][counter] += static_cast<std::uint64_t>
+        (static_cast<double> (events) * stats.hwpending[stage] / stats.hwpendingns);
+  }
 
-    // copy std::string header to std::string_view for performance
-    for (const auto & header : data.s_header)
-      data.header.push_back (std::string_view (header));
+  stats.hwlast = values;
+  stats.hwpending.fill (0);
+  stats.hwpendingns = 0;
+}
 
-    // valid token count equals the token count of the header
-    data.validtokencount = ntokens;
+constexpr std::uint64_t HW_SPLIT_NS = 1000000;		// stage time between counter reads
 
-    // reserve chars for tokens to avoid string resize costs
-    for (unsigned counter = 0; counter < ntokens; counter++)
-      data.tokens[counter].reserve (STRING_RESERVE_SIZE);
+// charge the time since the last lap to stage. Hardware events are read
+// once HW_SPLIT_NS of stage time gathered, rather than with a system
+// call per lap, and split across the stages by their time
+static inline void
+StatsLap (Statistics & stats, Stage stage,
+          std::chrono::steady_clock::time_point now) noexcept
+{
+  const std::uint64_t ns =
+    std::chrono::duration_cast<std::chrono::nanoseconds> (now - stats.last).count ();
+  stats.ns[stage] += ns;
+  stats.last = now;
+
+  if (stats.hardware)
+  {
+    stats.hwpending[stage] += ns;
+    stats.hwpendingns += ns;
+    if (stats.hwpendingns >= HW_SPLIT_NS) [[unlikely]]
+      StatsSplitHardware (stats);
   }
+}
 
-  return ntokens;
+// histogram bucket of a value
+static inline unsigned
+HistogramIndex (std::uint64_t value) noexcept
+{
+  constexpr std::uint64_t linear = 1 << HISTOGRAM_SUB_BITS;
+
+  if (value < linear)
+    return static_cast<unsigned> (value);
+
+  const unsigned exponent = std::bit_width (value) - 1;
+  const unsigned shift = exponent - HISTOGRAM_SUB_BITS;
+
+  return ((shift + 1) << HISTOGRAM_SUB_BITS) +
+         static_cast<unsigned> ((value >> shift) - linear);
 }
 
-// get a line from istream into inputline
-// returns: size of inputline, 0 on eof or error
-static const std::string::size_type
-GetLine (CData & data)
+// smallest value of a histogram bucket
+static inline std::uint64_t
+HistogramLowest (unsigned index) noexcept
 {
-  data.line_counter ++;
+  constexpr std::uint64_t linear = 1 << HISTOGRAM_SUB_BITS;
+  const unsigned group = index >> HISTOGRAM_SUB_BITS;
 
-  return
-    std::getline(*data.in, data.inputline) ?
-    data.inputline.size () : 0;
+  if (group == 0)
+    return index;
+
+  return (linear + (index & (linear - 1))) << (group - 1);
 }
 
-// generate json
-// returns 0 on success, 1 otherwise
-static int
-GenerateJson (CData & data)
+// record a value, from the owner thread
+static inline void
+HistogramRecord (Histogram & histogram, std::uint64_t value) noexcept
 {
-  constexpr char
-    dquote = '"',
-    comma = ',',
-    space = ' ',
-    dquote_semi[] = "\":\"";
+  Add (histogram.counts[HistogramIndex (value)], 1);
+  Add (histogram.sum, value);
+}
 
-  // reserve std::string buffer to avoid often resize
-  data.inputline.reserve (STRING_RESERVE_SIZE * 4);
-  data.outputline.reserve (STRING_RESERVE_SIZE * 4);
+// merge a histogram into plain counts
+static void
+HistogramMerge (const Histogram & histogram,
+                std::array<std::uint64_t, HISTOGRAM_SIZE> & counts,
+                std::uint64_t & sum) noexcept
+{
+  for (unsigned index = 0; index < HISTOGRAM_SIZE; index++)
+    counts[index] += histogram.counts[index].load (std::memory_order_relaxed);
+  sum += histogram.sum.load (std::memory_order_relaxed);
+}
+
+#ifdef FASTCSV2JSONXX_LATENCY
+// value at quantile, as the highest value of its bucket
+// returns: 0 for an empty histogram
+static std::uint64_t
+HistogramQuantile (const Histogram & histogram, double quantile) noexcept
+{
+  std::uint64_t total = 0;
+  for (const auto & count : histogram.counts)
+    total += count.load (std::memory_order_relaxed);
+  if (total == 0)
+    return 0;
 
-  // set input path. -i command line argument
-  std::ifstream is;
-  if (data.infilepath != "")
+  const auto rank = static_cast<std::uint64_t> (quantile * total);
+  std::uint64_t cumulative = 0;
+  for (unsigned index = 0; index + 1 < HISTOGRAM_SIZE; index++)
   {
-    is.open (data.infilepath);
-    data.in = &is;
+    cumulative += histogram.counts[index].load (std::memory_order_relaxed);
+    if (cumulative > rank)
+      return HistogramLowest (index + 1) - 1;
   }
 
-  // set output path. -o command line argument
-  std::ofstream os;
-  if (data.outfilepath != "")
+  return UINT64_MAX;
+}
+#endif
+
+// trace rings of all threads
+static std::mutex tracemutex;
+static std::vector<std::unique_ptr<TraceRing>> tracerings;
+
+// get the trace ring of the calling thread, creating it on first use.
+// Takes a lock only the first time a thread asks for its ring
+static TraceRing *
+TraceThread (const char *threadname)
+{
+  thread_local TraceRing *ring = nullptr;
+
+  if (ring == nullptr)
   {
-    os.open (data.outfilepath);
-    data.out = &os;
+    const std::lock_guard<std::mutex> lock (tracemutex);
+    tracerings.push_back (std::make_unique<TraceRing> ());
+    ring = tracerings.back ().get ();
+    ring->threadname = threadname;
+    ring->tid = static_cast<unsigned> (tracerings.size ());
   }
 
-  // decouple iostream from stdio
-  std::ios::sync_with_stdio(false);
-  data.in->tie(nullptr);
-  data.out->tie(nullptr);
+  return ring;
+}
 
-  // begin a json array
-  *data.out << '[';
+// record a span into the trace ring, overwriting the oldest span.
+// Spans shorter than TRACE_MIN_DURATION are dropped, so the ring keeps
+// buffer refills, flushes and stalls rather than every record
+static inline void
+TraceRecord (TraceRing & ring, Stage stage,
+             std::chrono::steady_clock::time_point start,
+             std::chrono::steady_clock::time_point end) noexcept
+{
+  const std::int64_t duration =
+    std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count ();
+  if (duration < TRACE_MIN_DURATION) [[likely]]
+    return;
 
-  // until eof or error
-  while (GetLine (data))
-  {
-    // replace char with space. -r command line argument
-    if (data.replacewithspace.size () != 0)
-    {
-      for (const auto & schar : data.replacewithspace)
-        std::ranges::replace (data.inputline, schar, space);
-    }
+  const auto head = ring.head.load (std::memory_order_relaxed);
 
-    // erase characters. -e command line argument
-    if (data.erasechars.size () != 0)
-    {
-      for (const auto & echar : data.erasechars)
-        std::erase (data.inputline, echar);
-    }
+  ring.events[head & (TRACE_RING_SIZE - 1)] =
+  {
+    std::chrono::duration_cast<std::chrono::nanoseconds> (start.time_since_epoch ()).count (),
+    duration,
+    stage
+  };
+  ring.head.store (head + 1, std::memory_order_release);
+}
 
-    // comma after json record
-    if (data.line_counter > 2) [[likely]]
-      *data.out << comma << '\n';
+// write the trace rings as chrome trace event json, viewable in perfetto
+// returns 0 on success, 1 otherwise
+static int
+TraceWrite (const std::string & path)
+{
+  std::ofstream os (path);
+  if (!os)
+  {
+    std::cerr << "Cannot write trace file: " << path << '\n';
+    return 1;
+  }
 
-    const auto ntokens = TokenizeLine (data);
-    if (data.validtokencount == ntokens) [[likely]] // csv must be valid
-    {
-      // begin json record
-      data.outputline = '{';
-      for (unsigned counter = 0; counter < ntokens; counter++)
-      {
-        data.outputline += dquote;
-        data.outputline += data.header[counter];
-        data.outputline += dquote_semi;
-        data.outputline += data.tokens[counter];
-        data.outputline += dquote;
-        if (ntokens - counter > 1)
-          data.outputline += comma;
-      }
-      // end json record
-      data.outputline += '}';
+  const std::lock_guard<std::mutex> lock (tracemutex);
+  const auto pid = getpid ();
 
-      // if inputline is not the header, send outline to output
-      if (data.line_counter > 1) [[likely]]
-        *data.out << data.outputline;
-    }
+  // the earliest span is the time origin
+  std::int64_t origin = INT64_MAX;
+  for (const auto & ring : tracerings)
+  {
+    const auto head = ring->head.load (std::memory_order_acquire);
+    const auto first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    if (head != first)
+      origin = std::min (origin, ring->events[first & (TRACE_RING_SIZE - 1)].start);
   }
 
-  // end json array and flush output buffer
-  *data.out << ']';
-  data.out->flush ();
+  os << std::fixed << std::setprecision (3)
+     << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << '\n'
+     << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+     << ",\"args\":{\"name\":\"" << programname << "\"}}";
 
-  if (data.infilepath != "")
-    is.close ();
+  for (const auto & ring : tracerings)
+  {
+    os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+       << ",\"tid\":" << ring->tid
+       << ",\"args\":{\"name\":\"" << ring->threadname << "\"}}";
 
-  if (data.outfilepath != "")
-    os.close ();
+    const auto head = ring->head.load (std::memory_order_acquire);
+    for (auto index = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+         index < head; index++)
+    {
+      const auto & event = ring->events[index & (TRACE_RING_SIZE - 1)];
+      os << ",\n{\"name\":\"" << stagename[event.name]
+         << "\",\"cat\":\"" << programname
+         << "\",\"ph\":\"X\",\"pid\":" << pid
+         << ",\"tid\":" << ring->tid
+         << ",\"ts\":" << (event.start - origin) / 1e3
+         << ",\"dur\":" << event.duration / 1e3 << '}';
+    }
+  }
 
-  return 0;
+  os << '\n' << "]}" << '\n';
+  os.close ();
+
+  return os ? 0 : 1;
 }
 
-// help screen
-int
-Help (CData & data) noexcept
+// start --stats and --trace measurements
+static void
+LapStart (CData & data, const char *threadname = "main")
 {
-  std::cerr << "Usage: " << programname << " [OPTION]" << '\n';
-  std::cerr << "Convert csv to json array" << '\n' << '\n';
-  std::cerr << "Options:" << '\n' << '\n';
-  std::cerr <<
-            "-d, --delimiter            Delimiter as pipe, comma, semicolumn, column, space" << '\n' <<
-            "                           or tab. Default is comma" << '\n' <<
-            "-h, --help                 This help screen" << '\n' <<
-            "-i, --infile               Input file path, default STDIN" << '\n' <<
-            "-o, --outfile              Output file path, default STDOUT" << '\n' <<
-            "-r, --replace-with-space   Replace comma, semicolumn, column, tab, backslash," << '\n' <<
-            "                           lf, cr, dquote, squote and slash characters of input" << '\n' <<
-            "                           with a space. Can be used multiple times" << '\n' <<
-            "-e, --erase-char           Remove comma, semicolumn, column, tab, backslash," << '\n' <<
-            "                           lf, cr, dquote, squote, slash and space characters" << '\n' <<
-            "                           from input. Can be used multiple times" << '\n' <<
-            "-v, --version              Version information, license and copyright" << '\n' << '\n' <<
-            "example: " << programname << " -d pipe < myfile.csv > myfile.json" << '\n';
+  data.instrumented =
+    data.stats.enabled || data.tracepath != "" || data.metricsaddress != "";
+  if (!data.instrumented)
+    return;
 
-  std::cerr << '\n';
-  return 1;
+  if (data.tracepath != "")
+    data.trace = TraceThread (threadname);
+
+  if (data.metricsaddress != "")
+    data.stats.latency = std::make_unique<StageHistograms> ();
+
+#ifdef FASTCSV2JSONXX_LATENCY
+  data.stats.recordlatency = std::make_unique<Histogram> ();
+  data.stats.blocklatency = std::make_unique<Histogram> ();
+#endif
+
+  StatsStart (data.stats);
+
+  data.lastlap = std::chrono::steady_clock::now ();
 }
 
-// hash function for std::string switch
-constexpr unsigned int
-hash(const char *s, int off = 0) noexcept
+// a stage boundary: charge the time since the last boundary to stage
+static inline void
+Lap (CData & data, Stage stage) noexcept
 {
-  return !s[off] ? 5381 : (hash(s, off+1)*33) ^ s[off];
+  if (!data.instrumented) [[likely]]
+    return;
+
+  const auto now = std::chrono::steady_clock::now ();
+
+  if (data.stats.enabled)
+    StatsLap (data.stats, stage, now);
+
+  if (data.stats.latency != nullptr)
+    HistogramRecord ((*data.stats.latency)[stage],
+                     std::chrono::duration_cast<std::chrono::nanoseconds>
+                     (now - data.lastlap).count ());
+
+  if (data.trace != nullptr)
+    TraceRecord (*data.trace, stage, data.lastlap, now);
+
+  data.lastlap = now;
 }
 
-// parse command line arguments
-static int
-ParseArguments (int argc, char *argv[], CData & data)
-{
-  std::vector<std::string> argument;
+// statistics of the converting threads, for --metrics scrapes
+static std::mutex metricsmutex;
+static std::vector<const Statistics *> metricsthreads;
 
-  for (int c = 0; c < argc; c++)
-    argument.push_back (std::string (argv[c]));
+// render the metrics of all converting threads in prometheus text format.
+// Per thread counters and histograms are merged here, on the scrape
+static std::string
+MetricsRender ()
+{
+  using Counts = std::array<std::uint64_t, HISTOGRAM_SIZE>;
 
-  int result = 0, counter = 1;
+  std::uint64_t records = 0, bytes_in = 0, bytes_out = 0, badrows = 0;
+  std::array<Counts, STAGE_COUNT> counts {};
+  std::array<std::uint64_t, STAGE_COUNT> sums {};
+#ifdef FASTCSV2JSONXX_LATENCY
+  Counts recordcounts {}, blockcounts {};
+  std::uint64_t recordsum = 0, blocksum = 0;
+#endif
 
-  while (counter < argc)
   {
-    if (argument.at (counter) == "-d" ||
-             argument.at (counter) == "--delimiter") // delimiter
+    const std::lock_guard<std::mutex> lock (metricsmutex);
+    for (const auto stats : metricsthreads)
     {
-      counter ++;
-      if (counter < argc)
+      records += stats->records.load (std::memory_order_relaxed);
+      bytes_in += stats->bytes_in.load (std::memory_order_relaxed);
+      bytes_out += stats->bytes_out.load (std::memory_order_relaxed);
+      badrows += stats->badrows.load (std::memory_order_relaxed);
+
+      if (stats->latency != nullptr)
+        for (unsigned stage = 0; stage < STAGE_COUNT; stage++)
+          HistogramMerge ((*stats->latency)[stage], counts[stage], sums[stage]);
+
+#ifdef FASTCSV2JSONXX_LATENCY
+      if (stats->recordlatency != nullptr)
       {
-        switch (hash (argv[counter]))
-        {
-        case hash ("pipe") :
-          data.delimiter = "|";
-          break;
-        case hash ("comma") :
-          data.delimiter = ",";
-          break;
-        case hash ("semicolumn") :
-          data.delimiter = ";";
-          break;
-        case hash ("column") :
-          data.delimiter = ":";
-          break;
-        case hash ("space") :
-          data.delimiter = " ";
+        HistogramMerge (*stats->recordlatency, recordcounts, recordsum);
+        HistogramMerge (*stats->blocklatency, blockcounts, blocksum);
+      }
+#endif
+    }
+  }
+
+  std::ostringstream os;
+  const std::string prefix = programname;
+
+  const auto
+  counter = [&] (const char *name, const char *help, std::uint64_t value)
+  {
+    os << "# HELP " << prefix << '_' << name << ' ' << help << '\n'
+       << "# TYPE " << prefix << '_' << name << " counter" << '\n'
+       << prefix << '_' << name << ' ' << value << '\n';
+  };
+
+  // power of two bucket bounds from 128 ns to 17 s, exact on the
+  // log-linear buckets
+  const auto
+  histogram = [&] (const char *name, const std::string & labels,
+                   const Counts & buckets, std::uint64_t sum)
+  {
+    const auto
+    series = [&] (const char *suffix, const std::string & le) -> std::ostream &
+    {
+      os << prefix << '_' << name << suffix << '{' << labels;
+      if (le != "")
+        os << (labels != "" ? "," : "") << "le=\"" << le << '"';
+      return os << "} ";
+    };
+
+    std::uint64_t cumulative = 0;
+    unsigned index = 0;
+    for (unsigned bound = 7; bound <= 34; bound++)
+    {
+      for (; index < HISTOGRAM_SIZE &&
+           HistogramLowest (index) < (std::uint64_t (1) << bound); index++)
+        cumulative += buckets[index];
+
+      std::ostringstream le;
+      le << static_cast<double> (std::uint64_t (1) << bound) / 1e9;
+      series ("_bucket", le.str ()) << cumulative << '\n';
+    }
+    for (; index < HISTOGRAM_SIZE; index++)
+      cumulative += buckets[index];
+
+    series ("_bucket", "+Inf") << cumulative << '\n';
+    series ("_sum", "") << sum / 1e9 << '\n';
+    series ("_count", "") << cumulative << '\n';
+  };
+
+  counter ("records_total", "JSON records written.", records);
+  counter ("bytes_in_total", "CSV bytes read.", bytes_in);
+  counter ("bytes_out_total", "JSON bytes written.", bytes_out);
+  counter ("bad_rows_total", "CSV rows rejected.", badrows);
+
+  os << "# HELP " << prefix << "_stage_duration_seconds Time spent per conversion stage." << '\n'
+     << "# TYPE " << prefix << "_stage_duration_seconds histogram" << '\n';
+  for (unsigned stage = 0; stage < STAGE_COUNT; stage++)
+    histogram ("stage_duration_seconds",
+               std::string ("stage=\"") + stagename[stage] + '"',
+               counts[stage], sums[stage]);
+
+#ifdef FASTCSV2JSONXX_LATENCY
+  os << "# HELP " << prefix << "_record_latency_seconds Sampled record latency from read to write." << '\n'
+     << "# TYPE " << prefix << "_record_latency_seconds histogram" << '\n';
+  histogram ("record_latency_seconds", "", recordcounts, recordsum);
+  os << "# HELP " << prefix << "_block_latency_seconds Output block latency from first read to write." << '\n'
+     << "# TYPE " << prefix << "_block_latency_seconds histogram" << '\n';
+  histogram ("block_latency_seconds", "", blockcounts, blocksum);
+#endif
+
+  return os.str ();
+}
+
+// --metrics server, a dedicated thread answering scrapes over http
+struct MetricsServer
+{
+  int fd = -1;										// listening socket
+  std::string unixpath = "";						// unix socket path to unlink
+  std::atomic<bool> stop {false};					// conversion is over
+  std::thread thread;								// serving thread
+};
+
+// listen on unix:/path or host:port
+// returns: the listening socket, -1 on error
+static int
+MetricsListen (const std::string & address, std::string & unixpath)
+{
+  int fd = -1;
+
+  if (address.starts_with ("unix:"))
+  {
+    sockaddr_un sun;
+    std::memset (&sun, 0, sizeof (sun));
+    sun.sun_family = AF_UNIX;
+    unixpath = address.substr (5);
+    if (unixpath.size () >= sizeof (sun.sun_path))
+      return -1;
+    std::memcpy (sun.sun_path, unixpath.c_str (), unixpath.size ());
+
+    // a socket left by an earlier run is replaced, any other file kept
+    struct stat st;
+    if (lstat (unixpath.c_str (), &st) == 0 && S_ISSOCK (st.st_mode))
+      unlink (unixpath.c_str ());
+
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd != -1 &&
+        bind (fd, reinterpret_cast<sockaddr *> (&sun), sizeof (sun)) != 0)
+    {
+      close (fd);
+      return -1;
+    }
+  }
+  else
+  {
+    const auto colon = address.rfind (':');
+    if (colon == std::string::npos)
+      return -1;
+
+    addrinfo hints, *result = nullptr;
+    std::memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo (address.substr (0, colon).c_str (),
+                     address.substr (colon + 1).c_str (), &hints, &result) != 0)
+      return -1;
+
+    fd = socket (result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const int yes = 1;
+    if (fd != -1)
+      setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof (yes));
+    if (fd != -1 && bind (fd, result->ai_addr, result->ai_addrlen) != 0)
+    {
+      close (fd);
+      fd = -1;
+    }
+    freeaddrinfo (result);
+  }
+
+  if (fd != -1 && listen (fd, 16) != 0)
+  {
+    close (fd);
+    fd = -1;
+  }
+
+  return fd;
+}
+
+// serve scrapes until stop. Any request gets the metrics page
+static void
+MetricsServe (MetricsServer & server)
+{
+  while (!server.stop.load (std::memory_order_relaxed))
+  {
+    pollfd pfd = { server.fd, POLLIN, 0 };
+    if (poll (&pfd, 1, 100) <= 0)
+      continue;
+
+    const int client = accept4 (server.fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1)
+      continue;
+
+    // consume the request, do not wait for slow clients
+    char request[4096];
+    pollfd cfd = { client, POLLIN, 0 };
+    if (poll (&cfd, 1, 1000) > 0)
+      [[maybe_unused]] auto ignored = read (client, request, sizeof (request));
+
+    const auto body = MetricsRender ();
+    const auto response =
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: " + std::to_string (body.size ()) + "\r\n"
+      "Connection: close\r\n\r\n" + body;
+
+    for (std::size_t sent = 0; sent < response.size (); )
+    {
+      const auto n = send (client, response.data () + sent,
+                           response.size () - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      sent += n;
+    }
+    close (client);
+  }
+}
+
+// start the --metrics server and register the statistics of this thread
+// returns 0 on success, 1 otherwise
+static int
+MetricsStart (CData & data, MetricsServer & server)
+{
+  if (data.metricsaddress == "")
+    return 0;
+
+  server.fd = MetricsListen (data.metricsaddress, server.unixpath);
+  if (server.fd == -1)
+  {
+    std::cerr << "Cannot listen for metrics on: " << data.metricsaddress << '\n';
+    return 1;
+  }
+
+  {
+    const std::lock_guard<std::mutex> lock (metricsmutex);
+    metricsthreads.push_back (&data.stats);
+  }
+
+  server.thread = std::thread (MetricsServe, std::ref (server));
+  return 0;
+}
+
+// stop the --metrics server
+static void
+MetricsStop (MetricsServer & server)
+{
+  if (server.fd == -1)
+    return;
+
+  server.stop.store (true);
+  server.thread.join ();
+  close (server.fd);
+  if (server.unixpath != "")
+    unlink (server.unixpath.c_str ());
+
+  const std::lock_guard<std::mutex> lock (metricsmutex);
+  metricsthreads.clear ();
+}
+
+// print statistics to stderr
+static void
+StatsReport (Statistics & stats) noexcept
+{
+  if (!stats.enabled)
+    return;
+
+  const double
+  seconds = std::chrono::duration<double> (stats.last - stats.start).count (),
+  bytes = stats.bytes_in != 0 ? static_cast<double> (stats.bytes_in) : 1.0;
+
+  bool multiplexed = false;
+  if (stats.hardware)
+  {
+    StatsSplitHardware (stats);
+    HwValues values = stats.hwlast;
+    multiplexed = !StatsReadHardware (stats, values);
+  }
+
+  std::cerr << std::fixed << std::setprecision (3)
+            << "records: " << stats.records
+            << ", bad rows: " << stats.badrows
+            << ", bytes in: " << stats.bytes_in
+            << ", bytes out: " << stats.bytes_out
+            << ", elapsed: " << seconds << " s"
+            << ", throughput: "
+            << (seconds > 0 ? stats.bytes_in / seconds / 1e6 : 0.0) << " MB/s" << '\n'
+            << "read calls: " << stats.readcalls
+            << ", read bytes: " << stats.readbytes
+            << ", read bandwidth: "
+            << (stats.readns != 0 ? stats.readbytes * 1e3 / stats.readns : 0.0) << " MB/s" << '\n';
+  if (stats.tuning != "")
+    std::cerr << "auto-tune: " << stats.tuning << '\n';
+  if (stats.pinning != "")
+    std::cerr << "pinning: " << stats.pinning << '\n';
+  if (stats.limits != "")
+    std::cerr << "cgroup limits: " << stats.limits << '\n';
+  if (stats.buffercapacity != 0)
+    std::cerr << "output buffers: " << stats.bufferallocs
+              << " allocated of " << stats.buffercapacity
+              << ", stalls: " << stats.bufferstalls << '\n';
+
+  std::cerr << std::left << std::setw (10) << "stage" << std::right
+            << std::setw (12) << "ms" << std::setw (12) << "ns/B";
+  if (stats.hardware)
+    std::cerr << std::setw (16) << "cycles" << std::setw (8) << "IPC"
+              << std::setw (10) << "cyc/B" << std::setw (10) << "ins/B"
+              << std::setw (12) << "br-miss/KB" << std::setw (12) << "L1D-miss/KB"
+              << std::setw (12) << "LLC-miss/KB" << std::setw (12) << "dTLB-miss/KB";
+  std::cerr << '\n';
+
+  for (unsigned stage = 0; stage < STAGE_COUNT; stage++)
+  {
+    std::cerr << std::left << std::setw (10) << stagename[stage] << std::right
+              << std::setw (12) << stats.ns[stage] / 1e6
+              << std::setw (12) << stats.ns[stage] / bytes;
+
+    if (stats.hardware)
+    {
+      const auto & hw = stats.hw[stage];
+      const auto
+      perbyte = [&] (HwCounter counter, double scale) -> double
+      {
+        return stats.hwfd[counter] != -1 ? hw[counter] * scale / bytes : 0.0;
+      };
+
+      std::cerr << std::setw (16) << hw[HW_CYCLES]
+                << std::setw (8)
+                << (hw[HW_CYCLES] != 0 ?
+                    static_cast<double> (hw[HW_INSTRUCTIONS]) / hw[HW_CYCLES] : 0.0)
+                << std::setw (10) << perbyte (HW_CYCLES, 1)
+                << std::setw (10) << perbyte (HW_INSTRUCTIONS, 1)
+                << std::setw (12) << perbyte (HW_BRANCH_MISSES, 1024)
+                << std::setw (12) << perbyte (HW_L1D_MISSES, 1024)
+                << std::setw (12) << perbyte (HW_LLC_MISSES, 1024)
+                << std::setw (12) << perbyte (HW_DTLB_MISSES, 1024);
+    }
+    std::cerr << '\n';
+  }
+
+  if (multiplexed)
+    std::cerr << "Hardware counters were multiplexed, values are partial" << '\n';
+
+#ifdef FASTCSV2JSONXX_LATENCY
+  const auto
+  latency = [&] (const char *name, const Histogram & histogram)
+  {
+    // no samples, as for a header only input
+    const bool empty = std::ranges::all_of (histogram.counts, [] (const auto & count)
+    {
+      return count.load (std::memory_order_relaxed) == 0;
+    });
+
+    std::cerr << std::left << std::setw (10) << name << std::right;
+    for (const double quantile : { 0.5, 0.9, 0.99, 0.999 })
+      if (empty)
+        std::cerr << std::setw (12) << "-";
+      else
+        std::cerr << std::setw (12) << HistogramQuantile (histogram, quantile) / 1e3;
+    std::cerr << '\n';
+  };
+
+  std::cerr << std::left << std::setw (10) << "latency" << std::right
+            << std::setw (12) << "p50 us" << std::setw (12) << "p90 us"
+            << std::setw (12) << "p99 us" << std::setw (12) << "p999 us" << '\n';
+  latency ("record", *stats.recordlatency);
+  latency ("block", *stats.blocklatency);
+#endif
+
+  if (stats.hardware)
+    StatsCloseHardware (stats);
+}
+
+// regular expression syntax tree node
+struct RegexNode
+{
+  enum Kind { SET, EMPTY, CONCAT, ALTERNATE, REPEAT } kind = EMPTY;
+  std::bitset<256> set;								// SET bytes
+  std::vector<int> children;						// CONCAT, ALTERNATE, REPEAT
+  int min = 0;										// REPEAT minimum
+  int max = -1;										// REPEAT maximum, -1 unbounded
+};
+
+// regular expression parser over bytes. Supports literals, ., classes,
+// \d \w \s and their negations, groups, |, *, +, ? and {m,n}. A { that
+// does not open bounds is a literal. ^ and $ anchor only a whole pattern,
+// see RegexAnchors, \^ and \$ are literals
+struct RegexParser
+{
+  std::string_view pattern;
+  std::size_t position = 0;
+  std::vector<RegexNode> nodes;
+  std::string error = "";
+};
+
+static int RegexAlternation (RegexParser & parser);
+
+// add a node
+// returns: the node index
+static int
+RegexAdd (RegexParser & parser, RegexNode node)
+{
+  parser.nodes.push_back (std::move (node));
+  return static_cast<int> (parser.nodes.size () - 1);
+}
+
+// bytes of a class escape such as \d, empty when not a class escape
+static std::bitset<256>
+RegexClassEscape (char escape) noexcept
+{
+  std::bitset<256> set;
+  const auto
+  range = [&] (unsigned char from, unsigned char to)
+  {
+    for (unsigned c = from; c <= to; c++)
+      set.set (c);
+  };
+
+  switch (escape)
+  {
+  case 'd': case 'D':
+    range ('0', '9');
+    break;
+  case 'w': case 'W':
+    range ('0', '9');
+    range ('A', 'Z');
+    range ('a', 'z');
+    set.set ('_');
+    break;
+  case 's': case 'S':
+    for (const char c : { ' ', '\t', '\n', '\r', '\f', '\v' })
+      set.set (static_cast<unsigned char> (c));
+    break;
+  default:
+    return set;
+  }
+
+  if (escape >= 'A' && escape <= 'Z')
+    set.flip ();
+  return set;
+}
+
+// byte of a single character escape such as \t or \x41
+static unsigned char
+RegexByteEscape (RegexParser & parser, char escape)
+{
+  switch (escape)
+  {
+  case 't': return '\t';
+  case 'n': return '\n';
+  case 'r': return '\r';
+  case 'f': return '\f';
+  case 'v': return '\v';
+  case '0': return 0;
+  case 'x':
+    if (parser.position + 2 <= parser.pattern.size ())
+    {
+      unsigned value = 0;
+      const auto digits = parser.pattern.substr (parser.position, 2);
+      const auto [ptr, ec] =
+        std::from_chars (digits.data (), digits.data () + 2, value, 16);
+      if (ec == std::errc () && ptr == digits.data () + 2)
+      {
+        parser.position += 2;
+        return static_cast<unsigned char> (value);
+      }
+    }
+    parser.error = "invalid \\x escape";
+    return 0;
+  default:
+    return static_cast<unsigned char> (escape);
+  }
+}
+
+// [class]
+// returns: the node index, -1 on error
+static int
+RegexClass (RegexParser & parser)
+{
+  RegexNode node;
+  node.kind = RegexNode::SET;
+
+  const auto & pattern = parser.pattern;
+  bool negate = false, first = true;
+  if (parser.position < pattern.size () && pattern[parser.position] == '^')
+  {
+    negate = true;
+    parser.position ++;
+  }
+
+  while (parser.position < pattern.size () &&
+         (pattern[parser.position] != ']' || first))
+  {
+    first = false;
+    unsigned char from = pattern[parser.position++];
+
+    if (from == '\\' && parser.position < pattern.size ())
+    {
+      const char escape = pattern[parser.position++];
+      const auto set = RegexClassEscape (escape);
+      if (set.any ())
+      {
+        node.set |= set;
+        continue;
+      }
+      from = RegexByteEscape (parser, escape);
+    }
+
+    unsigned char to = from;
+    if (parser.position + 1 < pattern.size () &&
+        pattern[parser.position] == '-' && pattern[parser.position + 1] != ']')
+    {
+      parser.position ++;
+      to = pattern[parser.position++];
+      if (to == '\\' && parser.position < pattern.size ())
+        to = RegexByteEscape (parser, pattern[parser.position++]);
+      if (to < from)
+      {
+        parser.error = "invalid class range";
+        return -1;
+      }
+    }
+
+    for (unsigned c = from; c <= to; c++)
+      node.set.set (c);
+  }
+
+  if (parser.position >= pattern.size ())
+  {
+    parser.error = "missing ]";
+    return -1;
+  }
+  parser.position ++;
+
+  if (negate)
+    node.set.flip ();
+  return RegexAdd (parser, std::move (node));
+}
+
+// bounds of a {n}, {n,} or {n,m} quantifier at position
+// returns: position of its }, npos when the { is a literal
+static std::size_t
+RegexBounds (std::string_view pattern, std::size_t position, int & min, int & max) noexcept
+{
+  const auto close = pattern.find ('}', position);
+  if (close == std::string_view::npos)
+    return close;
+
+  const auto bounds = pattern.substr (position + 1, close - position - 1);
+  const auto comma = bounds.find (',');
+  const auto
+  number = [] (std::string_view text, int & value) -> bool
+  {
+    const auto [ptr, ec] = std::from_chars (text.data (), text.data () + text.size (), value);
+    return ec == std::errc () && ptr == text.data () + text.size ();
+  };
+
+  max = -1;
+  if (!number (bounds.substr (0, comma), min))
+    return std::string_view::npos;
+  if (comma == std::string_view::npos)
+    max = min;
+  else if (comma + 1 < bounds.size () && !number (bounds.substr (comma + 1), max))
+    return std::string_view::npos;
+
+  return close;
+}
+
+// atom: literal, ., class, escape or group
+// returns: the node index, -1 on error
+static int
+RegexAtom (RegexParser & parser)
+{
+  const auto & pattern = parser.pattern;
+  const char c = pattern[parser.position++];
+
+  RegexNode node;
+  node.kind = RegexNode::SET;
+
+  switch (c)
+  {
+  case '(':
+  {
+    if (pattern.substr (parser.position).starts_with ("?:"))
+      parser.position += 2;
+    const int group = RegexAlternation (parser);
+    if (group == -1)
+      return -1;
+    if (parser.position >= pattern.size () || pattern[parser.position] != ')')
+    {
+      parser.error = "missing )";
+      return -1;
+    }
+    parser.position ++;
+    return group;
+  }
+  case '[':
+    return RegexClass (parser);
+  case '.':
+    node.set.set ();
+    node.set.reset ('\n');
+    break;
+  case '\\':
+    if (parser.position >= pattern.size ())
+    {
+      parser.error = "trailing \\";
+      return -1;
+    }
+    node.set = RegexClassEscape (pattern[parser.position]);
+    if (node.set.none ())
+      node.set.set (RegexByteEscape (parser, pattern[parser.position]));
+    parser.position ++;
+    break;
+  case '{':
+  {
+    // a quantifier with nothing to repeat, otherwise a literal {
+    int min, max;
+    if (RegexBounds (pattern, parser.position - 1, min, max) != std::string_view::npos)
+    {
+      parser.error = "unexpected {";
+      return -1;
+    }
+    node.set.set ('{');
+    break;
+  }
+  case '*': case '+': case '?': case ')': case '^': case '$':
+    parser.error = std::string ("unexpected ") + c;
+    return -1;
+  default:
+    node.set.set (static_cast<unsigned char> (c));
+  }
+
+  return RegexAdd (parser, std::move (node));
+}
+
+// atom followed by quantifiers
+// returns: the node index, -1 on error
+static int
+RegexRepeat (RegexParser & parser)
+{
+  const auto & pattern = parser.pattern;
+  int atom = RegexAtom (parser);
+
+  while (atom != -1 && parser.position < pattern.size ())
+  {
+    RegexNode node;
+    node.kind = RegexNode::REPEAT;
+    node.children.push_back (atom);
+
+    const char c = pattern[parser.position];
+    if (c == '*')
+      node.min = 0;
+    else if (c == '+')
+      node.min = 1;
+    else if (c == '?')
+      node.max = 1;
+    else if (c == '{')
+    {
+      const auto close = RegexBounds (pattern, parser.position, node.min, node.max);
+      if (close == std::string_view::npos)
+        break; // a literal {, the next atom
+
+      if (node.min > 255 || node.max > 255 || (node.max != -1 && node.max < node.min))
+      {
+        parser.error = "invalid repeat bounds";
+        return -1;
+      }
+      parser.position = close;
+    }
+    else
+      break;
+
+    parser.position ++;
+    // lazy quantifiers match the same language
+    if (parser.position < pattern.size () && pattern[parser.position] == '?')
+      parser.position ++;
+    atom = RegexAdd (parser, std::move (node));
+  }
+
+  return atom;
+}
+
+// alternatives of concatenations
+// returns: the node index, -1 on error
+static int
+RegexAlternation (RegexParser & parser)
+{
+  const auto & pattern = parser.pattern;
+  RegexNode alternation;
+  alternation.kind = RegexNode::ALTERNATE;
+
+  for (;;)
+  {
+    RegexNode concat;
+    concat.kind = RegexNode::CONCAT;
+    while (parser.position < pattern.size () &&
+           pattern[parser.position] != '|' && pattern[parser.position] != ')')
+    {
+      const int repeat = RegexRepeat (parser);
+      if (repeat == -1)
+        return -1;
+      concat.children.push_back (repeat);
+    }
+    alternation.children.push_back (RegexAdd (parser, std::move (concat)));
+
+    if (parser.position >= pattern.size () || pattern[parser.position] != '|')
+      break;
+    parser.position ++;
+  }
+
+  if (alternation.children.size () == 1)
+    return alternation.children[0];
+  return RegexAdd (parser, std::move (alternation));
+}
+
+// thompson nfa state: a byte set transition and epsilon transitions
+struct NfaState
+{
+  std::bitset<256> set;
+  int next = -1;
+  std::vector<int> epsilon;
+};
+
+constexpr std::size_t REGEX_MAX_NFA_STATES = 1 << 14;
+constexpr std::size_t REGEX_MAX_DFA_STATES = 1 << 12;
+
+// build the nfa of a syntax tree node
+// returns: the start and end states
+static std::pair<int, int>
+NfaBuild (const std::vector<RegexNode> & nodes, int index, std::vector<NfaState> & nfa)
+{
+  const auto
+  state = [&] () -> int
+  {
+    nfa.emplace_back ();
+    return static_cast<int> (nfa.size () - 1);
+  };
+
+  const auto & node = nodes[index];
+  const int start = state ();
+  int end = start;
+
+  if (nfa.size () > REGEX_MAX_NFA_STATES)
+    return { start, end };
+
+  switch (node.kind)
+  {
+  case RegexNode::SET:
+    end = state ();
+    nfa[start].set = node.set;
+    nfa[start].next = end;
+    break;
+  case RegexNode::EMPTY:
+    break;
+  case RegexNode::CONCAT:
+    for (const auto child : node.children)
+    {
+      const auto [first, last] = NfaBuild (nodes, child, nfa);
+      nfa[end].epsilon.push_back (first);
+      end = last;
+    }
+    break;
+  case RegexNode::ALTERNATE:
+    end = state ();
+    for (const auto child : node.children)
+    {
+      const auto [first, last] = NfaBuild (nodes, child, nfa);
+      nfa[start].epsilon.push_back (first);
+      nfa[last].epsilon.push_back (end);
+    }
+    break;
+  case RegexNode::REPEAT:
+    for (int count = 0; count < node.min; count++)
+    {
+      const auto [first, last] = NfaBuild (nodes, node.children[0], nfa);
+      nfa[end].epsilon.push_back (first);
+      end = last;
+    }
+    if (node.max == -1)
+    {
+      const auto [first, last] = NfaBuild (nodes, node.children[0], nfa);
+      const int exit = state ();
+      nfa[end].epsilon.push_back (first);
+      nfa[end].epsilon.push_back (exit);
+      nfa[last].epsilon.push_back (first);
+      nfa[last].epsilon.push_back (exit);
+      end = exit;
+    }
+    else
+      for (int count = node.min; count < node.max; count++)
+      {
+        const auto [first, last] = NfaBuild (nodes, node.children[0], nfa);
+        const int exit = state ();
+        nfa[end].epsilon.push_back (first);
+        nfa[end].epsilon.push_back (exit);
+        nfa[last].epsilon.push_back (exit);
+        end = exit;
+      }
+    break;
+  }
+
+  return { start, end };
+}
+
+// deterministic automaton: state 0 is dead, state 1 is the start
+struct Dfa
+{
+  std::vector<std::uint32_t> next;					// state * 256 + byte
+  std::vector<char> accept;							// accepting states
+};
+
+// longest text every match of a syntax tree node contains
+static std::string
+RegexLiteral (const std::vector<RegexNode> & nodes, int index)
+{
+  const auto
+  single = [&] (int child) -> int
+  {
+    const auto & node = nodes[child];
+    if (node.kind != RegexNode::SET || node.set.count () != 1)
+      return -1;
+    return static_cast<int> (node.set._Find_first ());
+  };
+
+  const auto & node = nodes[index];
+  switch (node.kind)
+  {
+  case RegexNode::SET:
+    return single (index) != -1 ? std::string (1, static_cast<char> (single (index))) : "";
+  case RegexNode::REPEAT:
+    return node.min != 0 ? RegexLiteral (nodes, node.children[0]) : "";
+  case RegexNode::CONCAT:
+  {
+    std::string best = "", run = "";
+    for (const auto child : node.children)
+    {
+      const int c = single (child);
+      if (c != -1)
+      {
+        run += static_cast<char> (c);
+        continue;
+      }
+      auto inner = RegexLiteral (nodes, child);
+      if (run.size () > best.size ())
+        best = run;
+      if (inner.size () > best.size ())
+        best = std::move (inner);
+      run = "";
+    }
+    return run.size () > best.size () ? run : best;
+  }
+  default:
+    return "";
+  }
+}
+
+// remove a leading ^ and a trailing unescaped $ from a pattern, the
+// anchors of its matches at the start and the end of a field
+static void
+RegexAnchors (std::string_view & expression, bool & atstart, bool & atend) noexcept
+{
+  atstart = expression.starts_with ('^');
+  if (atstart)
+    expression.remove_prefix (1);
+
+  // $ is escaped by an odd run of backslashes before it
+  std::size_t backslashes = 0;
+  while (backslashes + 1 < expression.size () &&
+         expression[expression.size () - 2 - backslashes] == '\\')
+    backslashes ++;
+  atend = expression.ends_with ('$') && backslashes % 2 == 0;
+  if (atend)
+    expression.remove_suffix (1);
+}
+
+// compile a pattern into a dfa, with a leading .* when unanchored.
+// When literal is given, it receives text every match contains. A
+// reversed dfa matches the reversed text of the pattern matches
+// returns: an empty string on success, the error otherwise
+static std::string
+DfaCompile (std::string_view pattern, bool unanchored, Dfa & dfa,
+            std::string *literal = nullptr, bool reversed = false)
+{
+  RegexParser parser;
+  parser.pattern = pattern;
+
+  int root = RegexAlternation (parser);
+  if (root == -1)
+    return parser.error;
+  if (parser.position != pattern.size ())
+    return "unexpected )";
+
+  if (literal != nullptr)
+    *literal = RegexLiteral (parser.nodes, root);
+
+  if (reversed)
+    for (auto & node : parser.nodes)
+      if (node.kind == RegexNode::CONCAT)
+        std::reverse (node.children.begin (), node.children.end ());
+
+  if (unanchored)
+  {
+    RegexNode any, star, concat;
+    any.kind = RegexNode::SET;
+    any.set.set ();
+    star.kind = RegexNode::REPEAT;
+    star.children.push_back (RegexAdd (parser, std::move (any)));
+    concat.kind = RegexNode::CONCAT;
+    concat.children = { RegexAdd (parser, std::move (star)), root };
+    root = RegexAdd (parser, std::move (concat));
+  }
+
+  std::vector<NfaState> nfa;
+  const auto [start, accept] = NfaBuild (parser.nodes, root, nfa);
+  if (nfa.size () > REGEX_MAX_NFA_STATES)
+    return "pattern too large";
+
+  // subset construction over epsilon closures
+  const auto
+  closure = [&] (std::vector<int> states) -> std::vector<int>
+  {
+    std::vector<char> seen (nfa.size ());
+    std::vector<int> stack = states;
+    states.clear ();
+    while (!stack.empty ())
+    {
+      const int s = stack.back ();
+      stack.pop_back ();
+      if (seen[s])
+        continue;
+      seen[s] = 1;
+      states.push_back (s);
+      for (const auto e : nfa[s].epsilon)
+        stack.push_back (e);
+    }
+    std::sort (states.begin (), states.end ());
+    return states;
+  };
+
+  std::map<std::vector<int>, std::uint32_t> ids;
+  std::vector<std::vector<int>> sets = { {}, closure ({ start }) };
+  ids[sets[0]] = 0;
+  ids[sets[1]] = 1;
+
+  dfa.next.assign (2 * 256, 0);
+  dfa.accept.assign (2, 0);
+
+  for (std::size_t current = 1; current < sets.size (); current++)
+  {
+    dfa.accept[current] =
+      std::binary_search (sets[current].begin (), sets[current].end (), accept);
+
+    for (unsigned byte = 0; byte < 256; byte++)
+    {
+      std::vector<int> moves;
+      for (const auto s : sets[current])
+        if (nfa[s].next != -1 && nfa[s].set.test (byte))
+          moves.push_back (nfa[s].next);
+      if (moves.empty ())
+        continue;
+
+      auto target = closure (std::move (moves));
+      auto found = ids.find (target);
+      if (found == ids.end ())
+      {
+        if (sets.size () >= REGEX_MAX_DFA_STATES)
+          return "pattern too complex";
+        found = ids.emplace (target, static_cast<std::uint32_t> (sets.size ())).first;
+        sets.push_back (std::move (target));
+        dfa.next.resize (sets.size () * 256, 0);
+        dfa.accept.resize (sets.size (), 0);
+      }
+      dfa.next[current * 256 + byte] = found->second;
+    }
+  }
+
+  return "";
+}
+
+// search text for a match of a dfa compiled unanchored. With atend the
+// match must end at the end of text
+// returns: true when found
+static bool
+DfaSearch (const Dfa & dfa, std::string_view text, bool atend) noexcept
+{
+  std::uint32_t state = 1;
+
+  for (const char c : text)
+  {
+    if (dfa.accept[state] && !atend)
+      return true;
+    state = dfa.next[state * 256 + static_cast<unsigned char> (c)];
+    if (state == 0)
+      return false;
+  }
+
+  return dfa.accept[state];
+}
+
+// longest match of an anchored dfa at the start of text
+// returns: the match length, -1 when there is no match
+static std::ptrdiff_t
+DfaLongest (const Dfa & dfa, std::string_view text) noexcept
+{
+  std::uint32_t state = 1;
+  std::ptrdiff_t longest = dfa.accept[state] ? 0 : -1;
+
+  for (std::size_t position = 0; position < text.size (); position++)
+  {
+    state = dfa.next[state * 256 + static_cast<unsigned char> (text[position])];
+    if (state == 0)
+      break;
+    if (dfa.accept[state])
+      longest = position + 1;
+  }
+
+  return longest;
+}
+
+// longest match of an anchored reversed dfa at the end of text
+// returns: the match length, -1 when there is no match
+static std::ptrdiff_t
+DfaLongestReverse (const Dfa & dfa, std::string_view text) noexcept
+{
+  std::uint32_t state = 1;
+  std::ptrdiff_t longest = dfa.accept[state] ? 0 : -1;
+
+  for (std::size_t length = 1; length <= text.size (); length++)
+  {
+    state = dfa.next[state * 256 + static_cast<unsigned char> (text[text.size () - length])];
+    if (state == 0)
+      break;
+    if (dfa.accept[state])
+      longest = length;
+  }
+
+  return longest;
+}
+
+// compile --mask col:regex or --replace col:regex:replacement
+// returns: an empty string on success, the error otherwise
+static std::string
+RewriteCompile (const std::string & argument, bool mask, Rewrite & rule)
+{
+  const auto first = argument.find (':');
+  const auto last = mask ? argument.size () : argument.rfind (':');
+  if (first == std::string::npos || last == first || first == 0)
+    return mask ? "expected column:regex" : "expected column:regex:replacement";
+
+  rule.column = argument.substr (0, first);
+  rule.mask = mask;
+  if (!mask)
+    rule.replacement = argument.substr (last + 1);
+
+  auto expression = std::string_view (argument).substr (first + 1, last - first - 1);
+  RegexAnchors (expression, rule.atstart, rule.atend);
+
+  rule.dfa = std::make_shared<Dfa> ();
+  rule.reverse = std::make_shared<Dfa> ();
+  auto error = DfaCompile (expression, false, *rule.dfa, &rule.literal);
+  if (error == "")
+    error = DfaCompile (expression, !rule.atend, *rule.reverse, nullptr, true);
+  return error;
+}
+
+// apply a --mask or --replace rule to every leftmost longest match in
+// text, only to one at its start with ^ and one at its end with $. One
+// backward pass of the reverse dfa marks where matches start, the
+// anchored dfa runs forward only from those. Text without the literal
+// every match contains is skipped with memchr or memmem, which are
+// vectorized in the c library
+// returns: true when the text changed, rewritten to rewritten
+static bool
+RewriteToken (const Rewrite & rule, std::string_view text, std::string & rewritten,
+              std::vector<char> & starts)
+{
+  if (rule.literal.size () == 1)
+  {
+    if (std::memchr (text.data (), rule.literal[0], text.size ()) == nullptr)
+      return false;
+  }
+  else if (rule.literal.size () > 1)
+  {
+    if (memmem (text.data (), text.size (),
+                rule.literal.data (), rule.literal.size ()) == nullptr)
+      return false;
+  }
+
+  std::size_t copied = 0;
+  bool changed = false;
+
+  const auto
+  rewrite = [&] (std::size_t position, std::size_t length)
+  {
+    if (!changed)
+      rewritten.clear ();
+    changed = true;
+    rewritten.append (text.substr (copied, position - copied));
+
+    // a mask keeps the length in utf-8 code points
+    if (rule.mask)
+      rewritten.append (std::count_if (text.begin () + position,
+                                       text.begin () + position + length,
+                                       [] (char c) { return (c & 0xc0) != 0x80; }), '*');
+    else
+      rewritten.append (rule.replacement);
+    copied = position + length;
+  };
+
+  if (rule.atend)
+  {
+    // the leftmost match ending the text is the longest of the reverse dfa
+    const auto length = DfaLongestReverse (*rule.reverse, text);
+    if (length > 0 && (!rule.atstart || static_cast<std::size_t> (length) == text.size ()))
+      rewrite (text.size () - length, length);
+  }
+  else if (rule.atstart)
+  {
+    const auto length = DfaLongest (*rule.dfa, text);
+    if (length > 0)
+      rewrite (0, length);
+  }
+  else
+  {
+    const auto & reverse = *rule.reverse;
+    starts.resize (text.size ());
+    std::uint32_t state = 1;
+    for (auto position = text.size (); position-- != 0; )
+    {
+      state = reverse.next[state * 256 + static_cast<unsigned char> (text[position])];
+      starts[position] = reverse.accept[state];
+    }
+
+    const auto first = starts.begin (), last = starts.begin () + text.size ();
+    for (auto next = std::find (first, last, 1); next != last; next = std::find (next, last, 1))
+    {
+      const std::size_t position = next - first;
+      const auto length = DfaLongest (*rule.dfa, text.substr (position));
+      if (length <= 0) // only the empty match starts here
+      {
+        next ++;
+        continue;
+      }
+      rewrite (position, length);
+      next += length;
+    }
+  }
+
+  if (!changed)
+    return false;
+
+  rewritten.append (text.substr (copied));
+  return true;
+}
+
+// keyed siphash-c-d of data
+template <unsigned CROUNDS, unsigned DROUNDS>
+static std::uint64_t
+SipHash (const std::array<std::uint64_t, 2> & key, std::string_view data) noexcept
+{
+  std::uint64_t
+  v0 = 0x736f6d6570736575ULL ^ key[0],
+  v1 = 0x646f72616e646f6dULL ^ key[1],
+  v2 = 0x6c7967656e657261ULL ^ key[0],
+  v3 = 0x7465646279746573ULL ^ key[1];
+
+  const auto
+  rounds = [&] (unsigned count)
+  {
+    for (unsigned round = 0; round < count; round++)
+    {
+      v0 += v1; v1 = std::rotl (v1, 13); v1 ^= v0; v0 = std::rotl (v0, 32);
+      v2 += v3; v3 = std::rotl (v3, 16); v3 ^= v2;
+      v0 += v3; v3 = std::rotl (v3, 21); v3 ^= v0;
+      v2 += v1; v1 = std::rotl (v1, 17); v1 ^= v2; v2 = std::rotl (v2, 32);
+    }
+  };
+
+  const auto
+  load = [] (const char *bytes) -> std::uint64_t
+  {
+    std::uint64_t word;
+    std::memcpy (&word, bytes, sizeof (word));
+    if constexpr (std::endian::native == std::endian::big)
+      word = __builtin_bswap64 (word);
+    return word;
+  };
+
+  const char *position = data.data ();
+  const char *end = position + (data.size () & ~std::size_t (7));
+  for (; position != end; position += 8)
+  {
+    const auto word = load (position);
+    v3 ^= word;
+    rounds (CROUNDS);
+    v0 ^= word;
+  }
+
+  std::uint64_t last = static_cast<std::uint64_t> (data.size ()) << 56;
+  for (unsigned byte = 0; byte < (data.size () & 7); byte++)
+    last |= static_cast<std::uint64_t> (static_cast<unsigned char> (position[byte])) << (8 * byte);
+
+  v3 ^= last;
+  rounds (CROUNDS);
+  v0 ^= last;
+  v2 ^= 0xff;
+  rounds (DROUNDS);
+
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// read a 16 byte siphash key: a file of 32 hex digits, optionally
+// followed by a newline, or of exactly 16 raw bytes
+// returns: an empty string on success, the error otherwise
+static std::string
+HashKeyRead (const std::string & path, std::array<std::uint64_t, 2> & key)
+{
+  std::ifstream is (path, std::ios::binary);
+  if (!is)
+    return "cannot open " + path;
+
+  std::string content ((std::istreambuf_iterator<char> (is)),
+                       std::istreambuf_iterator<char> ());
+
+  std::string_view digits (content);
+  if (digits.size () == 33 && digits.back () == '\n')
+    digits.remove_suffix (1);
+
+  std::array<unsigned char, 16> bytes;
+  if (digits.size () == 32 &&
+      std::all_of (digits.begin (), digits.end (),
+                   [] (char c) { return std::isxdigit (static_cast<unsigned char> (c)); }))
+    for (unsigned byte = 0; byte < 16; byte++)
+      std::from_chars (digits.data () + byte * 2, digits.data () + byte * 2 + 2,
+                       bytes[byte], 16);
+  else if (content.size () == 16)
+    std::memcpy (bytes.data (), content.data (), 16);
+  else
+    return "need 32 hex digits or exactly 16 bytes in " + path;
+
+  // little endian words, as in the siphash reference
+  for (unsigned word = 0; word < 2; word++)
+  {
+    key[word] = 0;
+    for (unsigned byte = 0; byte < 8; byte++)
+      key[word] |= static_cast<std::uint64_t> (bytes[word * 8 + byte]) << (8 * byte);
+  }
+
+  return "";
+}
+
+constexpr std::size_t HASH_HEX_SIZE = 16;				// hex digits of a hashed token
+
+// write the hex of the keyed hash of a token to digits, in the byte
+// order of the siphash reference output
+static void
+HashToken (const HashRule & rule, const std::array<std::uint64_t, 2> & key,
+           std::string_view token, char *digits) noexcept
+{
+  constexpr char hex[] = "0123456789abcdef";
+
+  const auto hash = rule.crounds == 1 ?
+                    SipHash<1, 3> (key, token) : SipHash<2, 4> (key, token);
+
+  for (unsigned byte = 0; byte < 8; byte++)
+  {
+    const auto value = static_cast<unsigned> (hash >> (8 * byte)) & 0xff;
+    digits[byte * 2] = hex[value >> 4];
+    digits[byte * 2 + 1] = hex[value & 0xf];
+  }
+}
+
+// json value of a --validate schema
+struct JsonValue
+{
+  enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+  bool boolean = false;
+  double number = 0;
+  std::string string;								// string, number as written
+  std::vector<JsonValue> array;
+  std::vector<std::pair<std::string, JsonValue>> object;
+
+  // member of an object, nullptr when missing
+  const JsonValue *
+  Find (std::string_view key) const noexcept
+  {
+    for (const auto & member : object)
+      if (member.first == key)
+        return &member.second;
+    return nullptr;
+  }
+};
+
+// parse a json value from the start of text, advancing text
+// returns: true on success
+static bool
+JsonParse (std::string_view & text, JsonValue & value, unsigned depth = 0)
+{
+  const auto
+  skip = [&] ()
+  {
+    while (!text.empty () && (text[0] == ' ' || text[0] == '\t' ||
+                              text[0] == '\n' || text[0] == '\r'))
+      text.remove_prefix (1);
+  };
+
+  const auto
+  literal = [&] (std::string_view word) -> bool
+  {
+    if (!text.starts_with (word))
+      return false;
+    text.remove_prefix (word.size ());
+    return true;
+  };
+
+  // string without the opening quote
+  const auto
+  string = [&] (std::string & out) -> bool
+  {
+    while (!text.empty () && text[0] != '"')
+    {
+      char c = text[0];
+      text.remove_prefix (1);
+      if (c != '\\')
+      {
+        out += c;
+        continue;
+      }
+      if (text.empty ())
+        return false;
+      c = text[0];
+      text.remove_prefix (1);
+      switch (c)
+      {
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'u':
+      {
+        unsigned code = 0;
+        if (text.size () < 4 ||
+            std::from_chars (text.data (), text.data () + 4, code, 16).ptr != text.data () + 4)
+          return false;
+        text.remove_prefix (4);
+        if (code >= 0xd800 && code < 0xdc00 && text.starts_with ("\\u") && text.size () >= 6)
+        {
+          unsigned low = 0;
+          std::from_chars (text.data () + 2, text.data () + 6, low, 16);
+          if (low >= 0xdc00 && low < 0xe000)
+          {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            text.remove_prefix (6);
+          }
+        }
+        // utf-8 encode
+        if (code < 0x80)
+          out += static_cast<char> (code);
+        else if (code < 0x800)
+        {
+          out += static_cast<char> (0xc0 | (code >> 6));
+          out += static_cast<char> (0x80 | (code & 0x3f));
+        }
+        else if (code < 0x10000)
+        {
+          out += static_cast<char> (0xe0 | (code >> 12));
+          out += static_cast<char> (0x80 | ((code >> 6) & 0x3f));
+          out += static_cast<char> (0x80 | (code & 0x3f));
+        }
+        else
+        {
+          out += static_cast<char> (0xf0 | (code >> 18));
+          out += static_cast<char> (0x80 | ((code >> 12) & 0x3f));
+          out += static_cast<char> (0x80 | ((code >> 6) & 0x3f));
+          out += static_cast<char> (0x80 | (code & 0x3f));
+        }
+        break;
+      }
+      default:
+        out += c;
+      }
+    }
+    if (text.empty ())
+      return false;
+    text.remove_prefix (1);
+    return true;
+  };
+
+  skip ();
+  if (text.empty () || depth > 64)
+    return false;
+
+  switch (text[0])
+  {
+  case '{':
+    value.type = JsonValue::OBJECT;
+    text.remove_prefix (1);
+    skip ();
+    if (literal ("}"))
+      return true;
+    for (;;)
+    {
+      std::pair<std::string, JsonValue> member;
+      skip ();
+      if (!literal ("\"") || !string (member.first))
+        return false;
+      skip ();
+      if (!literal (":") || !JsonParse (text, member.second, depth + 1))
+        return false;
+      value.object.push_back (std::move (member));
+      skip ();
+      if (literal ("}"))
+        return true;
+      if (!literal (","))
+        return false;
+    }
+  case '[':
+    value.type = JsonValue::ARRAY;
+    text.remove_prefix (1);
+    skip ();
+    if (literal ("]"))
+      return true;
+    for (;;)
+    {
+      value.array.emplace_back ();
+      if (!JsonParse (text, value.array.back (), depth + 1))
+        return false;
+      skip ();
+      if (literal ("]"))
+        return true;
+      if (!literal (","))
+        return false;
+    }
+  case '"':
+    value.type = JsonValue::STRING;
+    text.remove_prefix (1);
+    return string (value.string);
+  case 't':
+    value.type = JsonValue::BOOLEAN;
+    value.boolean = true;
+    return literal ("true");
+  case 'f':
+    value.type = JsonValue::BOOLEAN;
+    return literal ("false");
+  case 'n':
+    return literal ("null");
+  default:
+  {
+    value.type = JsonValue::NUMBER;
+    const auto [ptr, ec] =
+      std::from_chars (text.data (), text.data () + text.size (), value.number);
+    if (ec != std::errc ())
+      return false;
+    value.string = text.substr (0, ptr - text.data ());
+    text.remove_prefix (ptr - text.data ());
+    return true;
+  }
+  }
+}
+
+// token is an integer
+static bool
+IsInteger (std::string_view token) noexcept
+{
+  if (!token.empty () && (token[0] == '-' || token[0] == '+'))
+    token.remove_prefix (1);
+  return !token.empty () &&
+         std::all_of (token.begin (), token.end (),
+                      [] (char c) { return c >= '0' && c <= '9'; });
+}
+
+// token is a number, stored in value
+static bool
+IsNumber (std::string_view token, double & value) noexcept
+{
+  if (!token.empty () && token[0] == '+')
+    token.remove_prefix (1);
+  const auto [ptr, ec] =
+    std::from_chars (token.data (), token.data () + token.size (), value);
+  return !token.empty () && ec == std::errc () && ptr == token.data () + token.size ();
+}
+
+// compile the column checks of a json schema subset into data.validators:
+// type, enum, pattern, minimum, maximum, exclusiveMinimum,
+// exclusiveMaximum, minLength, maxLength and required (non-empty)
+// returns: an empty string on success, the error otherwise
+static std::string
+SchemaCompile (const std::string & path, std::vector<Validator> & validators)
+{
+  std::ifstream is (path);
+  if (!is)
+    return "cannot open " + path;
+
+  const std::string source ((std::istreambuf_iterator<char> (is)),
+                            std::istreambuf_iterator<char> ());
+  std::string_view text (source);
+  JsonValue schema;
+  if (!JsonParse (text, schema) || schema.type != JsonValue::OBJECT)
+    return "invalid json in " + path;
+
+  const auto
+  add = [&] (const std::string & column, const char *keyword,
+             std::function<bool (std::string_view)> check)
+  {
+    validators.push_back ({ column, 0, keyword, std::move (check) });
+  };
+
+  if (const auto properties = schema.Find ("properties"))
+    for (const auto & [column, property] : properties->object)
+    {
+      if (const auto type = property.Find ("type"))
+      {
+        // a list of types passes when any of them passes
+        std::vector<std::string> types;
+        if (type->type == JsonValue::ARRAY)
+          for (const auto & item : type->array)
+            types.push_back (item.string);
+        else
+          types.push_back (type->string);
+
+        bool any = false, integer = false, number = false, boolean = false, null = false;
+        for (const auto & name : types)
+        {
+          if (name == "string")
+            any = true;
+          else if (name == "integer")
+            integer = true;
+          else if (name == "number")
+            number = true;
+          else if (name == "boolean")
+            boolean = true;
+          else if (name == "null")
+            null = true;
+          else
+            return "unsupported type " + name + " for " + column;
+        }
+
+        if (!any)
+          add (column, "type",
+               [=] (std::string_view token)
+          {
+            double value;
+            return (integer && IsInteger (token)) ||
+                   (number && IsNumber (token, value)) ||
+                   (boolean && (token == "true" || token == "false")) ||
+                   (null && token.empty ());
+          });
+      }
+
+      if (const auto values = property.Find ("enum"))
+      {
+        std::vector<std::string> allowed;
+        for (const auto & item : values->array)
+          allowed.push_back (item.type == JsonValue::BOOLEAN ?
+                             (item.boolean ? "true" : "false") : item.string);
+        std::sort (allowed.begin (), allowed.end ());
+
+        add (column, "enum",
+             [allowed = std::move (allowed)] (std::string_view token)
+        {
+          return std::binary_search (allowed.begin (), allowed.end (), token);
+        });
+      }
+
+      if (const auto pattern = property.Find ("pattern"))
+      {
+        // ^ and $ anchor the search at the field start and end
+        std::string_view expression (pattern->string);
+        bool atstart, atend;
+        RegexAnchors (expression, atstart, atend);
+
+        auto dfa = std::make_shared<Dfa> ();
+        const auto error = DfaCompile (expression, !atstart, *dfa);
+        if (error != "")
+          return "pattern of " + column + ": " + error;
+
+        add (column, "pattern",
+             [dfa, atend] (std::string_view token)
+        {
+          return DfaSearch (*dfa, token, atend);
+        });
+      }
+
+      const auto
+      bound = [&] (const char *keyword, auto compare) -> void
+      {
+        if (const auto limit = property.Find (keyword))
+          add (column, keyword,
+               [limit = limit->number, compare] (std::string_view token)
+          {
+            double value;
+            return IsNumber (token, value) && compare (value, limit);
+          });
+      };
+      bound ("minimum", std::greater_equal<double> ());
+      bound ("maximum", std::less_equal<double> ());
+      bound ("exclusiveMinimum", std::greater<double> ());
+      bound ("exclusiveMaximum", std::less<double> ());
+
+      // lengths count utf-8 code points
+      const auto
+      length = [&] (const char *keyword, auto compare) -> void
+      {
+        if (const auto limit = property.Find (keyword))
+          add (column, keyword,
+               [limit = static_cast<std::size_t> (limit->number), compare] (std::string_view token)
+          {
+            const auto points = std::count_if (token.begin (), token.end (),
+                                               [] (char c) { return (c & 0xc0) != 0x80; });
+            return compare (static_cast<std::size_t> (points), limit);
+          });
+      };
+      length ("minLength", std::greater_equal<std::size_t> ());
+      length ("maxLength", std::less_equal<std::size_t> ());
+    }
+
+  if (const auto required = schema.Find ("required"))
+    for (const auto & column : required->array)
+      add (column.string, "required",
+           [] (std::string_view token) { return !token.empty (); });
+
+  return "";
+}
+
+// bind validators to the header columns
+// returns: an empty string on success, the error otherwise
+static std::string
+SchemaBind (std::vector<Validator> & validators,
+            const std::vector<std::string_view> & header)
+{
+  std::string error = "";
+
+  // properties of absent columns do not apply, required columns must exist
+  std::erase_if (validators, [&] (Validator & validator)
+  {
+    const auto found = std::find (header.begin (), header.end (), validator.column);
+    if (found == header.end ())
+    {
+      if (std::string_view (validator.keyword) == "required")
+        error = "required column " + validator.column + " not in header";
+      return true;
+    }
+    validator.index = found - header.begin ();
+    return false;
+  });
+
+  return error;
+}
+
+// tokenize inputline into tokens
+// returns: the token count
+static const std::size_t
+Tokenize(CData & data)
+{
+  const std::string_view
+  inputline (data.inputline);
+
+  std::string::size_type
+  start = 0,
+  end = inputline.find (data.delimiter);
+
+  std::size_t column = 0;
+
+  while (end != std::string::npos)
+  {
+    data.tokens[column++] = inputline.substr (start, end - start);
+    start = end + 1; // Move past the delimiter
+    end = inputline.find (data.delimiter, start);
+  }
+
+  // add the last token
+  data.tokens[column++] = inputline.substr (start);
+  data.tokens[column - 1].pop_back ();
+
+  return column;
+}
+
+// rule column position in an input lacking the column
+constexpr std::size_t COLUMN_ABSENT = SIZE_MAX;
+
+// token count of a line ending inside a quoted field
+constexpr std::size_t TOKENS_INCOMPLETE = SIZE_MAX;
+
+// escaping rules of a --dialect
+struct DialectTsv									// backslash escapes, no quotes
+{
+  static constexpr bool quotes = false;				// fields may be double quoted
+  static constexpr bool backslash = true;			// \t \n \r \\ escapes
+  static constexpr bool formula = false;			// excel ="text" fields
+  static constexpr bool crlf = true;				// drop a trailing cr
+};
+
+struct DialectExcel									// rfc 4180 with ="text" and a bom
+{
+  static constexpr bool quotes = true;
+  static constexpr bool backslash = false;
+  static constexpr bool formula = true;
+  static constexpr bool crlf = true;
+};
+
+struct DialectRfc4180								// "" inside quotes
+{
+  static constexpr bool quotes = true;
+  static constexpr bool backslash = false;
+  static constexpr bool formula = false;
+  static constexpr bool crlf = true;
+};
+
+struct DialectUnix									// quotes with backslash escapes, lf
+{
+  static constexpr bool quotes = true;
+  static constexpr bool backslash = true;
+  static constexpr bool formula = false;
+  static constexpr bool crlf = false;
+};
+
+// append the character escaped by the backslash at position to token
+// returns: the position after the escape
+static inline std::size_t
+Unescape (std::string_view line, std::size_t position, std::string & token)
+{
+  if (position + 1 == line.size ()) // a trailing backslash is kept
+  {
+    token += '\\';
+    return position + 1;
+  }
+
+  switch (const char escaped = line[position + 1])
+  {
+  case 't': token += '\t'; break;
+  case 'n': token += '\n'; break;
+  case 'r': token += '\r'; break;
+  default: token += escaped; // \\, \" and unknown escapes
+  }
+
+  return position + 2;
+}
+
+// tokenize inputline into unescaped tokens following a --dialect, in
+// one pass over the line
+// returns: the token count, 0 when too many tokens are found,
+// TOKENS_INCOMPLETE when the line ends inside a quoted field
+template <typename Dialect>
+static std::size_t
+TokenizeDialect (CData & data)
+{
+  std::string_view line (data.inputline);
+  const char delimiter = data.delimiter[0];
+
+  if constexpr (Dialect::crlf)
+  {
+    if (!line.empty () && line.back () == '\r')
+      line.remove_suffix (1);
+  }
+
+  if constexpr (Dialect::formula)
+  {
+    if (data.keys.empty () && line.starts_with ("\xEF\xBB\xBF")) // utf-8 bom
+      line.remove_prefix (3);
+  }
+
+  // a field ends at the delimiter, an escape or, when quoted, a quote
+  const auto special = [delimiter] (char c, bool quoted)
+  {
+    if constexpr (Dialect::backslash)
+    {
+      if (c == '\\')
+        return true;
+    }
+    return quoted ? c == '"' : c == delimiter;
+  };
+
+  std::size_t column = 0, position = 0;
+  const auto size = line.size ();
+
+  for (;;)
+  {
+    if (column == MAX_TOKEN_COUNT) [[unlikely]]
+      return 0;
+
+    auto & token = data.tokens[column ++];
+    token.clear ();
+
+    bool quoted = false;
+    if constexpr (Dialect::formula)
+    {
+      if (line.substr (position, 2) == "=\"")
+        position ++;
+    }
+    if constexpr (Dialect::quotes)
+    {
+      if (position < size && line[position] == '"')
+      {
+        quoted = true;
+        position ++;
+      }
+    }
+
+    for (;;)
+    {
+      auto stop = position;
+      while (stop < size && !special (line[stop], quoted))
+        stop ++;
+      token.append (line.data () + position, stop - position);
+      position = stop;
+
+      if (position == size)
+      {
+        if (quoted) [[unlikely]]
+          return TOKENS_INCOMPLETE;
+        break;
+      }
+
+      if (Dialect::backslash && line[position] == '\\')
+      {
+        position = Unescape (line, position, token);
+        continue;
+      }
+
+      if (!quoted)
+        break;
+
+      // a doubled quote is a quote, a single one ends the quoted part
+      position ++;
+      if (position < size && line[position] == '"')
+      {
+        token += '"';
+        position ++;
+        continue;
+      }
+
+      // text between the closing quote and the delimiter is kept
+      quoted = false;
+    }
+
+    if (position == size)
+      return column;
+    position ++; // move past the delimiter
+  }
+}
+
+// tokenize inputline into tokens using delimeter
+// returns: the token count
+static const std::size_t
+TokenizeLine (CData & data)
+{
+  std::size_t ntokens;
+  if (data.tokenizer == nullptr) [[likely]]
+  {
+    data.inputline.append (" "); // iostream discards last character
+    ntokens = Tokenize (data);
+  }
+  else
+  {
+    ntokens = data.tokenizer (data);
+    if (ntokens == TOKENS_INCOMPLETE) [[unlikely]]
+      return ntokens;
+  }
+
+  // when no tokens or too many tokens found, do nothing
+  if (ntokens == 0 || ntokens > MAX_TOKEN_COUNT) [[unlikely]]
+    return 0;
+
+  return ntokens;
+}
+
+// archive input: the csv members of zip, tar and tar.gz files are
+// converted in turn, without unpacking them to disk
+
+// archive formats
+enum ArchiveKind : unsigned
+{
+  ARCHIVE_NONE = 0,									// not an archive
+  ARCHIVE_ZIP,										// zip, members decoded in parallel
+  ARCHIVE_TAR,										// tar, streamed
+  ARCHIVE_TARGZ,									// gzip compressed tar, streamed
+  ARCHIVE_GZIP										// gzip of anything else, rejected
+};
+
+// csv member of a zip archive, from the central directory
+struct ZipMember
+{
+  std::string name;									// member path
+  std::uint64_t offset = 0;							// local header offset
+  std::uint64_t packed = 0;							// compressed size
+  std::uint64_t size = 0;							// uncompressed size
+  std::uint32_t crc = 0;							// crc32 of the member
+  unsigned method = 0;								// 0 stored, 8 deflated
+};
+
+constexpr std::uint64_t ARCHIVE_AHEAD_SIZE = 1 << 26;	// zip bytes decoded ahead
+
+// decoded bytes of a zip member, from its decoder thread to the
+// converter
+struct ZipStream
+{
+  std::deque<std::string> blocks;					// decoded blocks
+  std::uint64_t decoded = 0;						// bytes decoded so far
+  bool done = false;								// decoder finished
+  bool stop = false;								// converter left the member
+  std::string error = "";							// why decoding failed
+  std::thread decoder;								// decoder thread
+};
+
+// zip members decoded ahead of the converter. The blocks of the members
+// ahead fit in budget bytes, the converted member may always keep
+// ARCHIVE_BLOCKS blocks
+struct ZipAhead
+{
+  std::mutex mutex;
+  std::condition_variable changed;					// blocks added or taken
+  std::uint64_t buffered = 0;						// bytes in the blocks of all members
+  std::uint64_t budget = 0;							// bytes decoded ahead at most
+  std::uint64_t prefix = 0;							// bytes decoded ahead per member, 0 all
+  const ZipStream *current = nullptr;				// member being converted
+};
+
+// decompressed tar bytes, from the inflater thread to the converter
+struct TarStream
+{
+  std::mutex mutex;
+  std::condition_variable changed;					// blocks added or taken
+  std::deque<std::string> blocks;					// decompressed blocks
+  bool done = false;								// inflater finished
+  bool stop = false;								// converter gave up
+  std::string error = "";							// why the inflater stopped
+};
+
+// an open archive and its current member
+struct Archive
+{
+  ArchiveKind kind = ARCHIVE_NONE;					// format
+  int fd = -1;										// archive descriptor
+  std::string error = "";							// why reading stopped
+  std::string name = "";							// current member path
+  std::vector<ZipMember> members;					// zip csv members
+  std::size_t next = 0;								// next zip member to decode
+  std::deque<std::unique_ptr<ZipStream>> decoding;	// zip members being decoded, current first
+  std::shared_ptr<ZipAhead> ahead;					// zip read-ahead
+  std::size_t window = 2;							// zip members decoded at once
+  std::uint64_t budget = ARCHIVE_AHEAD_SIZE;		// zip bytes decoded ahead
+  std::uint64_t prefix = 0;							// zip member bytes decoded ahead, 0 all
+  std::shared_ptr<TarStream> stream;				// tar bytes
+  std::thread inflater;								// tar reader and inflater
+  std::string block = "";							// block being consumed
+  std::size_t blockposition = 0;					// bytes of block consumed
+  std::uint64_t remaining = 0;						// bytes of the tar member left
+  std::uint64_t padding = 0;						// tar member padding left
+};
+
+constexpr std::size_t ARCHIVE_BLOCK_SIZE = 1 << 20;	// stream block size
+constexpr std::size_t ARCHIVE_BLOCKS = 4;			// stream blocks buffered
+constexpr std::size_t ARCHIVE_PROBE_SIZE = 1 << 16;	// gzip bytes inflated for a tar header
+constexpr std::size_t ARCHIVE_HEADER_PREFIX = 1 << 16;	// zip member bytes read for a header
+
+// little endian field of a zip record
+static std::uint64_t
+ZipField (const unsigned char *record, std::size_t offset, std::size_t bytes) noexcept
+{
+  std::uint64_t value = 0;
+  for (std::size_t counter = bytes; counter != 0; counter --)
+    value = (value << 8) | record[offset + counter - 1];
+  return value;
+}
+
+// the members converted: csv and tsv files, outside macos metadata
+static bool
+ArchiveWanted (std::string_view name) noexcept
+{
+  if (name.starts_with ("__MACOSX/") || name.ends_with ('/'))
+    return false;
+
+  const auto dot = name.rfind ('.');
+  if (dot == std::string_view::npos)
+    return false;
+
+  std::string extension (name.substr (dot));
+  std::ranges::transform (extension, extension.begin (),
+                          [] (unsigned char c) { return std::tolower (c); });
+  return extension == ".csv" || extension == ".tsv";
+}
+
+// the archive format of a file, by its first bytes
+static ArchiveKind
+ArchiveProbe (const std::string & path)
+{
+  const int fd = open (path.c_str (), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return ARCHIVE_NONE;
+
+  // pread leaves pipes and fifos unread, they are not archives
+  unsigned char header[512] = {};
+  auto nread = pread (fd, header, sizeof (header), 0);
+
+  if (nread >= 4 && header[0] == 'P' && header[1] == 'K' &&
+      ((header[2] == 3 && header[3] == 4) || (header[2] == 5 && header[3] == 6)))
+  {
+    close (fd);
+    return ARCHIVE_ZIP;
+  }
+
+  // a gzip file is a tar.gz when it inflates to a tar header
+  auto kind = ARCHIVE_TAR;
+  if (nread >= 2 && header[0] == 0x1f && header[1] == 0x8b)
+  {
+    std::vector<unsigned char> packed (ARCHIVE_PROBE_SIZE);
+    const auto npacked = pread (fd, packed.data (), packed.size (), 0);
+
+    z_stream inflater {};
+    nread = 0;
+    if (npacked > 0 && inflateInit2 (&inflater, 16 + MAX_WBITS) == Z_OK)
+    {
+      inflater.next_in = packed.data ();
+      inflater.avail_in = npacked;
+      inflater.next_out = header;
+      inflater.avail_out = sizeof (header);
+      inflate (&inflater, Z_SYNC_FLUSH);
+      nread = sizeof (header) - inflater.avail_out;
+      inflateEnd (&inflater);
+    }
+    kind = ARCHIVE_TARGZ;
+  }
+  close (fd);
+
+  if (nread == 512 && std::memcmp (header + 257, "ustar", 5) == 0)
+    return kind;
+
+  return kind == ARCHIVE_TARGZ ? ARCHIVE_GZIP : ARCHIVE_NONE;
+}
+
+// read the zip central directory into the csv member list
+// returns: an empty string on success, the error otherwise
+static std::string
+ZipDirectory (Archive & archive)
+{
+  struct stat st;
+  if (fstat (archive.fd, &st) == -1)
+    return std::strerror (errno);
+
+  // the end of central directory record is within the last 64K + 22 bytes
+  const auto size = static_cast<std::uint64_t> (st.st_size);
+  const auto tailsize = std::min<std::uint64_t> (size, 0xFFFF + 22);
+  std::vector<unsigned char> tail (tailsize);
+  if (pread (archive.fd, tail.data (), tailsize, size - tailsize) != ssize_t (tailsize))
+    return "truncated zip";
+
+  std::ptrdiff_t end = -1;
+  for (std::ptrdiff_t position = tailsize - 22; position >= 0; position --)
+    if (ZipField (tail.data (), position, 4) == 0x06054b50)
+    {
+      end = position;
+      break;
+    }
+  if (end == -1)
+    return "no zip central directory";
+
+  const auto entries = ZipField (tail.data (), end + 10, 2);
+  const auto cdsize = ZipField (tail.data (), end + 12, 4);
+  const auto cdoffset = ZipField (tail.data (), end + 16, 4);
+  if (entries == 0xFFFF || cdsize == 0xFFFFFFFF || cdoffset == 0xFFFFFFFF)
+    return "zip64 archives are not supported";
+
+  std::vector<unsigned char> directory (cdsize);
+  if (cdoffset + cdsize > size ||
+      pread (archive.fd, directory.data (), cdsize, cdoffset) != ssize_t (cdsize))
+    return "truncated zip central directory";
+
+  std::size_t position = 0;
+  for (std::uint64_t counter = 0; counter < entries; counter ++)
+  {
+    if (position + 46 > cdsize || ZipField (directory.data (), position, 4) != 0x02014b50)
+      return "invalid zip central directory";
+
+    const auto *record = directory.data () + position;
+    const auto namelength = ZipField (record, 28, 2);
+    const auto skip = 46 + namelength + ZipField (record, 30, 2) + ZipField (record, 32, 2);
+    if (position + skip > cdsize)
+      return "invalid zip central directory";
+
+    ZipMember member;
+    member.name.assign (reinterpret_cast<const char *> (record + 46), namelength);
+    member.method = ZipField (record, 10, 2);
+    member.crc = ZipField (record, 16, 4);
+    member.packed = ZipField (record, 20, 4);
+    member.size = ZipField (record, 24, 4);
+    member.offset = ZipField (record, 42, 4);
+    position += skip;
+
+    if (!ArchiveWanted (member.name))
+      continue;
+    if (ZipField (record, 8, 2) & 1)
+      return member.name + " is encrypted";
+    if (member.method != 0 && member.method != 8)
+      return member.name + " uses an unsupported compression method";
+
+    // zip64 sizes and offsets are in an extra field, marked by all ones
+    if (member.packed == 0xFFFFFFFF || member.size == 0xFFFFFFFF || member.offset == 0xFFFFFFFF)
+      return "zip64 archives are not supported";
+
+    // sizes are checked before buffers are allocated for them: the member
+    // lies in the file, and deflate expands at most 1032 times
+    if (member.offset + 30 + member.packed > size ||
+        (member.method == 0 ? member.size != member.packed :
+         member.size > member.packed * 1032 + 1024))
+      return "invalid sizes of " + member.name;
+    archive.members.push_back (std::move (member));
+  }
+
+  return "";
+}
+
+// decode a zip member on its decoder thread into blocks of the stream,
+// with prefix set blocks of prefix bytes. The crc is updated a block at
+// a time and checked at the end of the member
+static void
+ZipInflate (int fd, ZipMember member, std::shared_ptr<ZipAhead> ahead, ZipStream *stream)
+{
+  std::string error = "";
+  const std::size_t blocksize = ahead->prefix != 0 ?
+                                std::min<std::uint64_t> (ahead->prefix, ARCHIVE_BLOCK_SIZE) :
+                                ARCHIVE_BLOCK_SIZE;
+  std::uint64_t produced = 0;
+  auto crc = crc32 (0, nullptr, 0);
+  bool stopped = false;
+
+  // hand a block to the converter, waiting while the read-ahead is full
+  const auto
+  push = [&] (std::string && block)
+  {
+    crc = crc32 (crc, reinterpret_cast<const Bytef *> (block.data ()), block.size ());
+    produced += block.size ();
+    if (produced > member.size)
+    {
+      error = "checksum mismatch in " + member.name;
+      return false;
+    }
+
+    std::unique_lock lock (ahead->mutex);
+    ahead->changed.wait (lock, [&] {
+      return stream->stop || (stream->blocks.size () < ARCHIVE_BLOCKS &&
+                              (ahead->current == stream ||
+                               (ahead->buffered + block.size () <= ahead->budget &&
+                                (ahead->prefix == 0 || stream->decoded < ahead->prefix))));
+    });
+    if (stream->stop)
+    {
+      stopped = true;
+      return false;
+    }
+    ahead->buffered += block.size ();
+    stream->decoded += block.size ();
+    stream->blocks.push_back (std::move (block));
+    ahead->changed.notify_all ();
+    return true;
+  };
+
+  unsigned char header[30] {};
+  const bool valid = pread (fd, header, sizeof (header), member.offset) == sizeof (header) &&
+                     ZipField (header, 0, 4) == 0x04034b50;
+  if (!valid)
+    error = "invalid local header of " + member.name;
+
+  const auto start = member.offset + 30 + ZipField (header, 26, 2) + ZipField (header, 28, 2);
+  if (valid && member.method == 0)
+  {
+    while (produced < member.size)
+    {
+      std::string block (std::min<std::uint64_t> (member.size - produced, blocksize), '\0');
+      if (pread (fd, block.data (), block.size (), start + produced) != ssize_t (block.size ()))
+      {
+        error = "truncated member " + member.name;
+        break;
+      }
+      if (!push (std::move (block)))
+        break;
+    }
+  }
+  else if (valid)
+  {
+    // the compressed bytes are read a block at a time, as inflate needs them
+    std::string packed = "";
+    std::uint64_t consumed = 0;
+    z_stream inflater {};
+    int status = inflateInit2 (&inflater, -MAX_WBITS);
+    if (status != Z_OK)
+      error = "cannot initialize inflate";
+
+    while (status == Z_OK && error == "")
+    {
+      std::string block (blocksize, '\0');
+      inflater.next_out = reinterpret_cast<Bytef *> (block.data ());
+      inflater.avail_out = block.size ();
+      while (status == Z_OK && inflater.avail_out != 0)
+      {
+        if (inflater.avail_in == 0)
+        {
+          const auto count = std::min<std::uint64_t> (member.packed - consumed, ARCHIVE_BLOCK_SIZE);
+          packed.resize (count);
+          if (count == 0 || pread (fd, packed.data (), count, start + consumed) != ssize_t (count))
+          {
+            error = "truncated member " + member.name;
+            break;
+          }
+          consumed += count;
+          inflater.next_in = reinterpret_cast<Bytef *> (packed.data ());
+          inflater.avail_in = count;
+        }
+        status = inflate (&inflater, Z_NO_FLUSH);
+      }
+      if (error == "" && status != Z_OK && status != Z_STREAM_END)
+        error = "cannot inflate " + member.name;
+
+      block.resize (block.size () - inflater.avail_out);
+      if (error == "" && !block.empty () && !push (std::move (block)))
+        break;
+    }
+    inflateEnd (&inflater);
+  }
+
+  if (error == "" && !stopped && (produced != member.size || crc != member.crc))
+    error = "checksum mismatch in " + member.name;
+
+  std::lock_guard lock (ahead->mutex);
+  stream->error = stopped ? "" : error;
+  stream->done = true;
+  ahead->changed.notify_all ();
+}
+
+// read the tar file, inflating it when compressed, into the stream
+static void
+TarInflate (int fd, bool compressed, std::shared_ptr<TarStream> stream)
+{
+  std::string error = "";
+  std::vector<unsigned char> input (ARCHIVE_BLOCK_SIZE);
+
+  z_stream inflater {};
+  if (compressed && inflateInit2 (&inflater, 16 + MAX_WBITS) != Z_OK)
+    error = "cannot initialize inflate";
+  bool ended = false; // at the end of a gzip member
+
+  // hand a block to the converter, waiting while the stream is full
+  const auto push = [&] (std::string && block)
+  {
+    std::unique_lock lock (stream->mutex);
+    stream->changed.wait (lock, [&] {
+      return stream->stop || stream->blocks.size () < ARCHIVE_BLOCKS;
+    });
+    if (stream->stop)
+      return false;
+    stream->blocks.push_back (std::move (block));
+    stream->changed.notify_all ();
+    return true;
+  };
+
+  while (error == "")
+  {
+    const auto nread = read (fd, input.data (), input.size ());
+    if (nread == -1 && errno == EINTR)
+      continue;
+    if (nread == -1)
+    {
+      error = std::strerror (errno);
+      break;
+    }
+    if (nread == 0)
+    {
+      if (compressed && !ended)
+        error = "truncated gzip stream";
+      break;
+    }
+
+    if (!compressed)
+    {
+      if (!push (std::string (reinterpret_cast<char *> (input.data ()), nread)))
+        break;
+      continue;
+    }
+
+    inflater.next_in = input.data ();
+    inflater.avail_in = nread;
+    while (inflater.avail_in != 0 && error == "")
+    {
+      // concatenated gzip members continue the stream
+      if (ended)
+      {
+        inflateReset (&inflater);
+        ended = false;
+      }
+
+      std::string block (ARCHIVE_BLOCK_SIZE, '\0');
+      inflater.next_out = reinterpret_cast<Bytef *> (block.data ());
+      inflater.avail_out = block.size ();
+      const auto status = inflate (&inflater, Z_NO_FLUSH);
+      if (status == Z_STREAM_END)
+        ended = true;
+      else if (status != Z_OK && status != Z_BUF_ERROR)
+        error = "invalid gzip stream";
+
+      block.resize (block.size () - inflater.avail_out);
+      if (!block.empty () && !push (std::move (block)))
+        error = "stopped";
+    }
+  }
+
+  if (compressed)
+    inflateEnd (&inflater);
+
+  std::lock_guard lock (stream->mutex);
+  if (error != "stopped")
+    stream->error = error;
+  stream->done = true;
+  stream->changed.notify_all ();
+}
+
+// read up to size bytes of the tar stream
+// returns: the bytes read, 0 at the end of the stream
+static std::size_t
+TarRead (Archive & archive, char *buffer, std::size_t size)
+{
+  if (archive.blockposition == archive.block.size ())
+  {
+    auto & stream = *archive.stream;
+    std::unique_lock lock (stream.mutex);
+    stream.changed.wait (lock, [&] { return stream.done || !stream.blocks.empty (); });
+    if (stream.blocks.empty ())
+      return 0;
+
+    archive.block = std::move (stream.blocks.front ());
+    stream.blocks.pop_front ();
+    archive.blockposition = 0;
+    stream.changed.notify_all ();
+  }
+
+  const auto count = std::min (size, archive.block.size () - archive.blockposition);
+  std::memcpy (buffer, archive.block.data () + archive.blockposition, count);
+  archive.blockposition += count;
+  return count;
+}
+
+// read exactly size bytes of the tar stream, or skip them when buffer
+// is nullptr
+// returns: false at the end of the stream
+static bool
+TarReadAll (Archive & archive, char *buffer, std::uint64_t size)
+{
+  char scratch[4096];
+  while (size != 0)
+  {
+    const auto want = std::min<std::uint64_t> (size, buffer != nullptr ? size : sizeof (scratch));
+    const auto count = TarRead (archive, buffer != nullptr ? buffer : scratch, want);
+    if (count == 0)
+      return false;
+    size -= count;
+    if (buffer != nullptr)
+      buffer += count;
+  }
+  return true;
+}
+
+// numeric field of a tar header: octal, or base 256 when the high bit
+// of the first byte is set
+static std::uint64_t
+TarNumber (const char *field, std::size_t size) noexcept
+{
+  std::uint64_t value = 0;
+  if (static_cast<unsigned char> (field[0]) & 0x80)
+  {
+    for (std::size_t counter = 1; counter < size; counter ++)
+      value = (value << 8) | static_cast<unsigned char> (field[counter]);
+    return value;
+  }
+
+  for (std::size_t counter = 0; counter < size; counter ++)
+    if (field[counter] >= '0' && field[counter] <= '7')
+      value = (value << 3) | (field[counter] - '0');
+    else if (field[counter] != ' ' || value != 0)
+      break;
+  return value;
+}
+
+// move to the next csv member of a tar stream
+// returns: false at the end of the archive or on error, with
+// archive.error set
+static bool
+TarNext (Archive & archive)
+{
+  // the rest of the previous member
+  if (!TarReadAll (archive, nullptr, archive.remaining + archive.padding))
+  {
+    archive.error = "truncated tar";
+    return false;
+  }
+  archive.remaining = archive.padding = 0;
+
+  std::string longname = "";
+  for (;;)
+  {
+    char header[512];
+    if (!TarReadAll (archive, header, sizeof (header)))
+    {
+      archive.error = "truncated tar";
+      return false;
+    }
+    if (std::all_of (header, header + sizeof (header), [] (char c) { return c == 0; }))
+      return false; // end of archive
+
+    const auto size = TarNumber (header + 124, 12);
+    const auto padding = (512 - size % 512) % 512;
+    const char type = header[156];
+
+    // gnu long names and pax path records name the next member
+    if (type == 'L' || type == 'x')
+    {
+      std::string text (size, '\0');
+      if (!TarReadAll (archive, text.data (), size) || !TarReadAll (archive, nullptr, padding))
+      {
+        archive.error = "truncated tar";
+        return false;
+      }
+
+      if (type == 'L')
+        longname = text.substr (0, text.find ('\0'));
+      else
+      {
+        // records are "length key=value\n"
+        for (std::size_t position = 0; position < text.size ();)
+        {
+          const auto length = std::strtoull (text.c_str () + position, nullptr, 10);
+          if (length == 0 || position + length > text.size ())
+            break;
+          const auto record = std::string_view (text).substr (position, length);
+          const auto key = record.find (" path=");
+          if (key != std::string_view::npos)
+            longname = record.substr (key + 6, record.size () - key - 7);
+          position += length;
+        }
+      }
+      continue;
+    }
+
+    std::string name = longname;
+    longname.clear ();
+    if (name.empty ())
+    {
+      name.assign (header, strnlen (header, 100));
+      if (std::memcmp (header + 257, "ustar", 5) == 0 && header[345] != 0)
+        name = std::string (header + 345, strnlen (header + 345, 155)) + '/' + name;
+    }
+
+    if ((type == '0' || type == '\0' || type == '7') && ArchiveWanted (name))
+    {
+      archive.name = name;
+      archive.remaining = size;
+      archive.padding = padding;
+      return true;
+    }
+
+    if (!TarReadAll (archive, nullptr, size + padding))
+    {
+      archive.error = "truncated tar";
+      return false;
+    }
+  }
+}
+
+// open an archive file and start reading it
+// returns: an empty string on success, the error otherwise
+static std::string
+ArchiveOpen (Archive & archive, const std::string & path, ArchiveKind kind)
+{
+  if (kind == ARCHIVE_GZIP)
+    return "gzip files are read only when they hold a tar archive";
+
+  archive = {};
+  archive.kind = kind;
+  archive.fd = open (path.c_str (), O_RDONLY | O_CLOEXEC);
+  if (archive.fd == -1)
+    return std::strerror (errno);
+
+  if (kind == ARCHIVE_ZIP)
+  {
+    archive.ahead = std::make_shared<ZipAhead> ();
+    return ZipDirectory (archive);
+  }
+
+  posix_fadvise (archive.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  archive.stream = std::make_shared<TarStream> ();
+  archive.inflater = std::thread (TarInflate, archive.fd, kind == ARCHIVE_TARGZ, archive.stream);
+  return "";
+}
+
+// stop decoding the current zip member and drop its blocks
+static void
+ZipLeave (Archive & archive)
+{
+  if (archive.decoding.empty ())
+    return;
+
+  auto & ahead = *archive.ahead;
+  auto & stream = *archive.decoding.front ();
+  {
+    std::lock_guard lock (ahead.mutex);
+    stream.stop = true;
+    for (const auto & block : stream.blocks)
+      ahead.buffered -= block.size ();
+    stream.blocks.clear ();
+    if (ahead.current == &stream)
+      ahead.current = nullptr;
+    ahead.changed.notify_all ();
+  }
+  stream.decoder.join ();
+  archive.decoding.pop_front ();
+}
+
+// move to the next csv member. Zip members are decoded ahead by window
+// threads, one per cpu by default, in blocks that fit the budget bytes,
+// only their first prefix bytes when prefix is set. Tar members come in
+// order from the inflater thread
+// returns: false at the end of the archive or on error, with
+// archive.error set
+static bool
+ArchiveNext (Archive & archive)
+{
+  if (archive.error != "")
+    return false;
+  if (archive.kind != ARCHIVE_ZIP)
+    return TarNext (archive);
+
+  ZipLeave (archive);
+  auto & ahead = *archive.ahead;
+  {
+    std::lock_guard lock (ahead.mutex);
+    ahead.budget = archive.budget;
+    ahead.prefix = archive.prefix;
+  }
+
+  while (archive.next < archive.members.size () && archive.decoding.size () < archive.window)
+  {
+    archive.decoding.push_back (std::make_unique<ZipStream> ());
+    archive.decoding.back ()->decoder =
+      std::thread (ZipInflate, archive.fd, archive.members[archive.next ++], archive.ahead,
+                   archive.decoding.back ().get ());
+  }
+
+  if (archive.decoding.empty ())
+    return false;
+
+  {
+    std::lock_guard lock (ahead.mutex);
+    ahead.current = archive.decoding.front ().get ();
+    ahead.changed.notify_all ();
+  }
+  archive.name = archive.members[archive.next - archive.decoding.size ()].name;
+  archive.block.clear ();
+  archive.blockposition = 0;
+  return true;
+}
+
+// read up to size bytes of the current member
+// returns: the bytes read, 0 at the end of the member, -1 on error
+static ssize_t
+ArchiveRead (Archive & archive, char *buffer, std::size_t size)
+{
+  if (archive.kind == ARCHIVE_ZIP)
+  {
+    if (archive.blockposition == archive.block.size ())
+    {
+      auto & ahead = *archive.ahead;
+      auto & stream = *archive.decoding.front ();
+      std::unique_lock lock (ahead.mutex);
+      ahead.changed.wait (lock, [&] { return stream.done || !stream.blocks.empty (); });
+      if (stream.blocks.empty ())
+      {
+        if (stream.error == "")
+          return 0;
+        archive.error = stream.error;
+        return -1;
+      }
+
+      archive.block = std::move (stream.blocks.front ());
+      stream.blocks.pop_front ();
+      ahead.buffered -= archive.block.size ();
+      archive.blockposition = 0;
+      ahead.changed.notify_all ();
+    }
+
+    const auto count = std::min (size, archive.block.size () - archive.blockposition);
+    std::memcpy (buffer, archive.block.data () + archive.blockposition, count);
+    archive.blockposition += count;
+    return count;
+  }
+
+  const auto count = TarRead (archive, buffer, std::min<std::uint64_t> (size, archive.remaining));
+  if (count == 0 && archive.remaining != 0)
+  {
+    archive.error = "truncated tar";
+    return -1;
+  }
+  archive.remaining -= count;
+  return count;
+}
+
+// stop reading an archive, reporting an error of the inflater thread
+static void
+ArchiveClose (Archive & archive)
+{
+  if (archive.stream)
+  {
+    {
+      std::lock_guard lock (archive.stream->mutex);
+      archive.stream->stop = true;
+      archive.stream->changed.notify_all ();
+    }
+    archive.inflater.join ();
+    if (archive.error == "" && archive.stream->error != "")
+      archive.error = archive.stream->error;
+    archive.stream.reset ();
+  }
+
+  // the decoders ahead end once the current member is left
+  if (archive.ahead)
+    while (!archive.decoding.empty ())
+      ZipLeave (archive);
+  archive.ahead.reset ();
+  if (archive.fd != -1)
+    close (archive.fd);
+  archive.fd = -1;
+  archive.kind = ARCHIVE_NONE;
+}
+
+// prepare the block reader: hint the kernel that the input is read
+// sequentially and allocate room for a carried line and a block
+static void
+ReaderOpen (BlockReader & reader)
+{
+  struct stat st;
+  reader.regular = !reader.memory && fstat (reader.fd, &st) == 0 && S_ISREG (st.st_mode);
+
+#ifdef __linux__
+  if (reader.regular)
+    posix_fadvise (reader.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  reader.buffer.resize (reader.blocksize * 2);
+  reader.begin = reader.end = 0;
+  reader.offset = reader.ahead = 0;
+  reader.eof = false;
+}
+
+// read the next block after the unconsumed bytes, issuing readahead for
+// the --read-depth blocks that follow it
+// returns: false on end of input or error
+static bool
+ReaderFill (BlockReader & reader, Statistics & stats, bool instrumented)
+{
+  // keep the partial line at the buffer start, grow for very long lines
+  const auto remaining = reader.end - reader.begin;
+  if (reader.begin != 0)
+  {
+    std::memmove (reader.buffer.data (), reader.buffer.data () + reader.begin, remaining);
+    reader.begin = 0;
+    reader.end = remaining;
+  }
+  if (reader.buffer.size () < reader.end + reader.blocksize)
+    reader.buffer.resize (reader.end + reader.blocksize);
+
+#ifdef __linux__
+  const auto target = reader.offset + (reader.depth + 1) * std::uint64_t (reader.blocksize);
+  if (reader.regular && reader.depth != 0 && target > reader.ahead)
+  {
+    const auto start = std::max (reader.ahead, reader.offset + reader.blocksize);
+    readahead (reader.fd, start, target - start);
+    reader.ahead = target;
+  }
+#endif
+
+  std::chrono::steady_clock::time_point start;
+  if (instrumented) [[unlikely]]
+    start = std::chrono::steady_clock::now ();
+
+  ssize_t nread;
+  if (reader.archive != nullptr)
+    nread = ArchiveRead (*reader.archive, reader.buffer.data () + reader.end, reader.blocksize);
+  else if (reader.memory)
+  {
+    nread = std::min (reader.bytes.size (), reader.blocksize);
+    std::memcpy (reader.buffer.data () + reader.end, reader.bytes.data (), nread);
+    reader.bytes.remove_prefix (nread);
+  }
+  else
+    do
+      nread = read (reader.fd, reader.buffer.data () + reader.end, reader.blocksize);
+    while (nread == -1 && errno == EINTR);
+
+  if (instrumented) [[unlikely]]
+  {
+    const auto now = std::chrono::steady_clock::now ();
+    stats.readcalls ++;
+    stats.readns +=
+      std::chrono::duration_cast<std::chrono::nanoseconds> (now - start).count ();
+#ifdef FASTCSV2JSONXX_LATENCY
+    reader.arrival = now;
+#endif
+  }
+
+  if (nread <= 0)
+  {
+    if (nread == -1 && reader.archive == nullptr)
+      std::cerr << "Read error: " << std::strerror (errno) << '\n';
+    reader.eof = true;
+    return false;
+  }
+
+  reader.end += nread;
+  reader.offset += nread;
+  if (instrumented) [[unlikely]]
+    stats.readbytes += nread;
+
+  return true;
+}
+
+// blank lines, comment lines and the first --skip-lines lines are not
+// converted, unless they continue a quoted field
+// returns: true when the line from begin to end is skipped
+static inline bool
+SkipLine (const CData & data, const char *begin, const char *end) noexcept
+{
+  if (!data.carry.empty ()) [[unlikely]]
+    return false;
+
+  if (begin == end || (end - begin == 1 && *begin == '\r')) [[unlikely]]
+    return true;
+
+  if (data.skipping) [[unlikely]]
+    return data.line_counter <= data.skiplines ||
+           (data.commentchar != 0 && *begin == data.commentchar);
+
+  return false;
+}
+
+// get the next line to convert from the block reader into inputline
+// returns: false on eof or error
+static bool
+GetLine (CData & data)
+{
+  auto & reader = data.reader;
+
+  for (;;)
+  {
+    const char *begin = reader.buffer.data () + reader.begin;
+    const auto *newline =
+      static_cast<const char *> (std::memchr (begin, '\n', reader.end - reader.begin));
+    const char *end;
+
+    if (newline != nullptr) [[likely]]
+    {
+      end = newline;
+      reader.begin += newline - begin + 1;
+    }
+    else if (!reader.eof && ReaderFill (reader, data.stats, data.instrumented))
+      continue;
+    else if (reader.begin == reader.end)
+      return false;
+    else // last line without a line feed, ReaderFill may have moved it
+    {
+      begin = reader.buffer.data () + reader.begin;
+      end = reader.buffer.data () + reader.end;
+      reader.begin = reader.end;
+    }
+
+    data.line_counter ++;
+    if (SkipLine (data, begin, end)) [[unlikely]]
+      continue;
+
+    data.inputline.assign (begin, end);
+    return true;
+  }
+}
+
+#ifdef FASTCSV2JSONXX_LATENCY
+// note the arrival of a record added to the output block
+static inline void
+LatencyMark (CData & data) noexcept
+{
+  if (!data.instrumented)
+    return;
+
+  if (!data.blockpending)
+  {
+    data.blockarrival = data.arrival;
+    data.blockpending = true;
+  }
+
+  if (++data.latencycounter == LATENCY_SAMPLE)
+  {
+    data.latencycounter = 0;
+    data.latencysamples.push_back (data.arrival);
+  }
+}
+#endif
+
+// -o shm:/name output, a ring shared with a consumer on the same host.
+// The protocol is documented in fastcsv2json_shm.h
+struct ShmRing
+{
+  std::string name = "";							// shm_open name
+  fc2j_shm_header *header = nullptr;				// shared header
+  char *ring = nullptr;								// ring, mapped twice in a row
+  std::size_t capacity = 0;							// ring bytes
+};
+
+constexpr std::size_t SHM_SIZE = 1 << 24;			// default ring bytes
+
+// futex operation on a word of the shared header
+static inline void
+ShmFutex (std::uint32_t *word, int operation, std::uint32_t value) noexcept
+{
+  syscall (SYS_futex, word, operation, value, nullptr, nullptr, 0);
+}
+
+// create the ring and its header
+// returns: an empty string on success, the error otherwise
+static std::string
+ShmOpen (ShmRing & shm, const std::string & name, std::size_t capacity)
+{
+  const auto page = static_cast<std::size_t> (sysconf (_SC_PAGESIZE));
+  capacity = (capacity + page - 1) / page * page;
+
+  // truncating an object in use would fault a consumer still mapping
+  // it, a new object leaves the old one to that consumer
+  shm_unlink (name.c_str ());
+  const int fd = shm_open (name.c_str (), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd == -1)
+    return std::strerror (errno);
+
+  std::string error = "";
+  void *header = MAP_FAILED, *ring = MAP_FAILED;
+  if (ftruncate (fd, FC2J_SHM_HEADER_SIZE + capacity) == -1)
+    error = std::strerror (errno);
+  else
+  {
+    header = mmap (nullptr, FC2J_SHM_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // reserve twice the ring, then map the ring into both halves
+    ring = mmap (nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    for (std::size_t half = 0; half < 2 && ring != MAP_FAILED; half ++)
+      if (mmap (static_cast<char *> (ring) + half * capacity, capacity, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, FC2J_SHM_HEADER_SIZE) == MAP_FAILED)
+      {
+        munmap (ring, 2 * capacity);
+        ring = MAP_FAILED;
+      }
+
+    if (header == MAP_FAILED || ring == MAP_FAILED)
+      error = std::strerror (errno);
+  }
+  close (fd);
+
+  if (error != "")
+  {
+    if (header != MAP_FAILED)
+      munmap (header, FC2J_SHM_HEADER_SIZE);
+    shm_unlink (name.c_str ());
+    return error;
+  }
+
+  shm.name = name;
+  shm.header = static_cast<fc2j_shm_header *> (header);
+  shm.ring = static_cast<char *> (ring);
+  shm.capacity = capacity;
+
+  shm.header->version = FC2J_SHM_VERSION;
+  shm.header->capacity = capacity;
+  shm.header->producer = getpid ();
+  __atomic_store_n (&shm.header->magic, FC2J_SHM_MAGIC, __ATOMIC_RELEASE);
+  return "";
+}
+
+// bump a futex word and wake its waiter, if any
+static inline void
+ShmWake (std::uint32_t *sequence, std::uint32_t *waiting) noexcept
+{
+  __atomic_fetch_add (sequence, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (waiting, __ATOMIC_SEQ_CST) != 0)
+    ShmFutex (sequence, FUTEX_WAKE, 1);
+}
+
+// copy bytes into the ring, waiting for the consumer while it is full
+static void
+ShmWrite (ShmRing & shm, std::string_view bytes)
+{
+  auto & header = *shm.header;
+  auto head = header.head;
+
+  while (!bytes.empty ())
+  {
+    auto tail = __atomic_load_n (&header.tail, __ATOMIC_ACQUIRE);
+    if (head - tail == shm.capacity)
+    {
+      __atomic_store_n (&header.producer_waiting, 1, __ATOMIC_SEQ_CST);
+      const auto sequence = __atomic_load_n (&header.tailseq, __ATOMIC_SEQ_CST);
+      tail = __atomic_load_n (&header.tail, __ATOMIC_SEQ_CST);
+      if (head - tail == shm.capacity)
+        ShmFutex (&header.tailseq, FUTEX_WAIT, sequence);
+      __atomic_store_n (&header.producer_waiting, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    const auto count = std::min<std::size_t> (bytes.size (), shm.capacity - (head - tail));
+    std::memcpy (shm.ring + head % shm.capacity, bytes.data (), count);
+    head += count;
+    bytes.remove_prefix (count);
+
+    __atomic_store_n (&header.head, head, __ATOMIC_RELEASE);
+    ShmWake (&header.headseq, &header.consumer_waiting);
+  }
+}
+
+// tell the consumer the stream ended and unmap the ring
+static void
+ShmClose (ShmRing & shm, bool failed)
+{
+  if (shm.header == nullptr)
+    return;
+
+  __atomic_store_n (&shm.header->state, failed ? FC2J_SHM_FAILED : FC2J_SHM_DONE,
+                    __ATOMIC_RELEASE);
+  ShmWake (&shm.header->headseq, &shm.header->consumer_waiting);
+
+  munmap (shm.ring, 2 * shm.capacity);
+  munmap (shm.header, FC2J_SHM_HEADER_SIZE);
+  shm.header = nullptr;
+}
+
+// -j conversion: the reader thread cuts the input into chunks of
+// complete lines, workers convert them in any order and a writer thread
+// writes them in order
+
+// column bindings of an input, shared by its chunks
+struct InputPlan
+{
+  std::vector<std::string> keys;					// key table
+  std::vector<Validator> validators;				// --validate checks
+  std::vector<Rewrite> rewrites;					// --mask and --replace
+  std::vector<HashRule> hashes;						// --hash-col
+  std::vector<std::ptrdiff_t> permutation;			// canonical column order
+  std::size_t validtokencount = 0;					// header token count
+  std::string inputname = "";						// input file or archive member
+  struct Archive *archive = nullptr;				// archive of the input, if any
+};
+
+constexpr std::size_t OUTPUT_BUFFER_SIZE = 1 << 18;	// bytes of a pooled output buffer
+constexpr std::size_t OUTPUT_BUFFER_ALIGN = 64;		// output buffer alignment
+constexpr unsigned BUFFERS_LOCAL = 16;				// buffers a thread keeps before sharing
+
+// output buffer of the -j pool, chained into the json of a chunk
+struct alignas (OUTPUT_BUFFER_ALIGN) OutputBuffer
+{
+  char data[OUTPUT_BUFFER_SIZE];					// json bytes
+  std::size_t used = 0;								// bytes of data filled
+  OutputBuffer *next = nullptr;						// next in a chunk or a free list
+};
+
+// free buffers of one thread. Only the owner touches local, the writer
+// pushes the buffers it wrote onto returned
+struct alignas (OUTPUT_BUFFER_ALIGN) BufferSlot
+{
+  OutputBuffer *local = nullptr;					// owner's free list
+  unsigned count = 0;								// buffers in local
+  std::atomic<OutputBuffer *> returned {nullptr};	// written buffers, lock-free stack
+};
+
+// -j output buffers: a fixed number allocated on demand, recycled
+// through per thread free lists and a global overflow stack. Stacks are
+// only ever taken whole, so popping cannot suffer from ABA. Running out
+// of buffers stalls a worker until the writer returns some, unless its
+// chunk is the one the writer waits for
+struct BufferPool
+{
+  std::vector<std::unique_ptr<BufferSlot>> slots;	// the workers, then the reader
+  std::atomic<OutputBuffer *> overflow {nullptr};	// buffers shared by every thread
+  std::atomic<std::uint32_t> released {0};			// bumped as the writer advances
+  std::atomic<std::uint64_t> next {0};				// sequence the writer waits for
+  std::uint64_t capacity = 0;						// buffers before stalling
+  std::atomic<std::uint64_t> allocated {0};			// buffers allocated
+  std::atomic<std::uint64_t> stalls {0};			// waits for a returned buffer
+  std::mutex mutex;									// guards buffers
+  std::vector<std::unique_ptr<OutputBuffer>> buffers;	// every buffer
+};
+
+// a block of complete lines and its json, or literal json when plan is
+// nullptr. Records end with their separator, the writer drops the last
+// one before the closing bracket
+struct Chunk
+{
+  std::uint64_t sequence = 0;						// position in the output
+  std::shared_ptr<const InputPlan> plan;			// bindings, nullptr for literal json
+  std::vector<char> csv;							// a former reader buffer
+  std::size_t begin = 0;							// first byte of the lines
+  std::size_t end = 0;								// end of the lines
+  unsigned firstline = 0;							// lines of the input before the chunk
+  char *region = nullptr;							// reserved part of the mapped output
+  std::uint64_t offset = 0;							// file offset of region
+  std::size_t reserved = 0;							// region bytes
+  std::size_t used = 0;								// region bytes written
+  OutputBuffer *first = nullptr;					// json past region, or all of it
+  OutputBuffer *last = nullptr;						// buffer being filled
+  std::size_t spilled = 0;							// json bytes in the buffers
+  unsigned owner = 0;								// pool slot of the buffers
+  std::uint64_t records = 0;						// json records
+  std::string error = "";							// why the conversion stopped
+#ifdef FASTCSV2JSONXX_LATENCY
+  std::chrono::steady_clock::time_point arrival;	// read completion of the lines
+#endif
+};
+
+// push the buffers from first to last onto a lock-free stack
+static inline void
+BufferPush (std::atomic<OutputBuffer *> & stack, OutputBuffer *first, OutputBuffer *last) noexcept
+{
+  last->next = stack.load (std::memory_order_relaxed);
+  while (!stack.compare_exchange_weak (last->next, first, std::memory_order_release,
+                                       std::memory_order_relaxed))
+    ;
+}
+
+// refill the free list of a slot from the buffers the writer returned
+// to it, or from the overflow stack. Buffers past BUFFERS_LOCAL go to
+// the overflow stack for the other threads
+// returns: false when both are empty
+static bool
+BufferRefill (BufferPool & pool, BufferSlot & slot) noexcept
+{
+  OutputBuffer *taken = slot.returned.exchange (nullptr, std::memory_order_acquire);
+  if (taken == nullptr)
+    taken = pool.overflow.exchange (nullptr, std::memory_order_acquire);
+  if (taken == nullptr)
+    return false;
+
+  OutputBuffer *keep = taken;
+  for (slot.count = 1; keep->next != nullptr && slot.count < BUFFERS_LOCAL; slot.count++)
+    keep = keep->next;
+  if (keep->next != nullptr)
+  {
+    OutputBuffer *rest = keep->next, *end = rest;
+    while (end->next != nullptr)
+      end = end->next;
+    keep->next = nullptr;
+    BufferPush (pool.overflow, rest, end);
+  }
+
+  slot.local = taken;
+  return true;
+}
+
+// take a free buffer for the json of chunk, on the thread of slot. A
+// buffer is allocated while the pool is under capacity, or when the
+// writer waits for chunk; otherwise the thread stalls until the writer
+// advances, a wait charged to the laps of data when given
+static OutputBuffer *
+BufferTake (BufferPool & pool, unsigned index, const Chunk & chunk, CData *data)
+{
+  auto & slot = *pool.slots[index];
+
+  for (;;)
+  {
+    if (slot.local != nullptr) [[likely]]
+    {
+      OutputBuffer *buffer = slot.local;
+      slot.local = buffer->next;
+      slot.count--;
+      buffer->next = nullptr;
+      buffer->used = 0;
+      return buffer;
+    }
+
+    // released before the checks, so an advance after them ends the wait
+    const auto released = pool.released.load (std::memory_order_acquire);
+    if (BufferRefill (pool, slot))
+      continue;
+
+    if (pool.allocated.load (std::memory_order_relaxed) < pool.capacity ||
+        chunk.plan == nullptr || chunk.sequence == pool.next.load (std::memory_order_acquire))
+    {
+      std::unique_ptr<OutputBuffer> buffer (new OutputBuffer);	// data left uninitialized
+      OutputBuffer *taken = buffer.get ();
+      {
+        const std::lock_guard<std::mutex> lock (pool.mutex);
+        pool.buffers.push_back (std::move (buffer));
+      }
+      pool.allocated.fetch_add (1, std::memory_order_relaxed);
+      return taken;
+    }
+
+    pool.stalls.fetch_add (1, std::memory_order_relaxed);
+    if (data != nullptr)
+      Lap (*data, STAGE_WRITE);
+    pool.released.wait (released, std::memory_order_acquire);
+    if (data != nullptr)
+      Lap (*data, STAGE_WAIT);
+  }
+}
+
+// return the buffers of a written chunk to the slot they came from
+static void
+BufferRelease (BufferPool & pool, Chunk & chunk) noexcept
+{
+  if (chunk.first != nullptr)
+    BufferPush (pool.slots[chunk.owner]->returned, chunk.first, chunk.last);
+  chunk.first = chunk.last = nullptr;
+  chunk.spilled = 0;
+}
+
+// append json to the buffers of chunk, taken on the thread of slot
+static void
+ChunkSpill (BufferPool & pool, unsigned index, Chunk & chunk, std::string_view json,
+            CData *data = nullptr)
+{
+  chunk.owner = index;
+  while (!json.empty ())
+  {
+    if (chunk.last == nullptr || chunk.last->used == OUTPUT_BUFFER_SIZE)
+    {
+      OutputBuffer *buffer = BufferTake (pool, index, chunk, data);
+      if (chunk.last != nullptr)
+        chunk.last->next = buffer;
+      else
+        chunk.first = buffer;
+      chunk.last = buffer;
+    }
+
+    const auto size = std::min (json.size (), OUTPUT_BUFFER_SIZE - chunk.last->used);
+    std::memcpy (chunk.last->data + chunk.last->used, json.data (), size);
+    chunk.last->used += size;
+    chunk.spilled += size;
+    json.remove_prefix (size);
+  }
+}
+
+static void ParallelLiteral (struct Parallel & parallel, std::string_view json);
+
+// write the output block
+static void
+WriteBlock (CData & data)
+{
+  if (data.parallel != nullptr) [[unlikely]] // in order with the chunks
+  {
+    if (!data.outblock.empty ())
+      ParallelLiteral (*data.parallel, data.outblock);
+    data.outblock.clear ();
+    return;
+  }
+
+  if (data.shm != nullptr) [[unlikely]]
+    ShmWrite (*data.shm, data.outblock);
+  else
+  {
+    data.out->write (data.outblock.data (), data.outblock.size ());
+    data.out->flush ();
+  }
+  data.outblock.clear ();
+
+#ifdef FASTCSV2JSONXX_LATENCY
+  if (!data.instrumented || !data.blockpending)
+    return;
+
+  const auto now = std::chrono::steady_clock::now ();
+  const auto
+  nanoseconds = [&] (std::chrono::steady_clock::time_point arrival)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (now - arrival).count ();
+  };
+
+  HistogramRecord (*data.stats.blocklatency, nanoseconds (data.blockarrival));
+  for (const auto & arrival : data.latencysamples)
+    HistogramRecord (*data.stats.recordlatency, nanoseconds (arrival));
+
+  data.latencysamples.clear ();
+  data.blockpending = false;
+#endif
+}
+
+// append text to a json string, escaping quotes, backslashes and
+// control characters
+static void
+AppendEscaped (std::string & json, std::string_view text)
+{
+  constexpr char hex[] = "0123456789abcdef";
+
+  auto start = text.begin ();
+  for (auto position = start; position != text.end (); position ++)
+  {
+    const auto c = static_cast<unsigned char> (*position);
+    if (c >= 0x20 && c != '"' && c != '\\') [[likely]]
+      continue;
+
+    json.append (start, position);
+    start = position + 1;
+    switch (c)
+    {
+    case '"': json += "\\\""; break;
+    case '\\': json += "\\\\"; break;
+    case '\n': json += "\\n"; break;
+    case '\r': json += "\\r"; break;
+    case '\t': json += "\\t"; break;
+    default:
+      json += "\\u00";
+      json += hex[c >> 4];
+      json += hex[c & 0xF];
+    }
+  }
+  json.append (start, text.end ());
+}
+
+// bind column options to their header positions
+// returns: an empty string on success, the error otherwise
+static std::string
+BindHeader (CData & data)
+{
+  data.validators = data.schema;
+  const auto error = SchemaBind (data.validators, data.header);
+  if (error != "")
+    return "Invalid schema: " + error;
+
+  // position of a rule's column. A canonical column this input lacks
+  // is absent, and so is not rewritten
+  const auto bind = [&] (const std::string & column, std::size_t & index)
+  {
+    const auto found = std::find (data.header.begin (), data.header.end (), column);
+    if (found != data.header.end ())
+      index = found - data.header.begin ();
+    else if (std::find (data.canonical.begin (), data.canonical.end (), column) !=
+             data.canonical.end ())
+      index = COLUMN_ABSENT;
+    else
+      return false;
+    return true;
+  };
+
+  for (auto & rule : data.rewrites)
+    if (!bind (rule.column, rule.index))
+      return "Column not in header: " + rule.column;
+
+  for (auto & rule : data.hashes)
+    if (!bind (rule.column, rule.index))
+      return "Column not in header: " + rule.column;
+
+  return "";
+}
+
+// compose the keys from the header rows, once: the non-empty cells of
+// a column joined by --header-join. Empty cells of the upper rows
+// repeat the cell to their left, as merged cells are exported. Then
+// render the key table, each key with the json around it
+static void
+HeaderCompose (CData & data)
+{
+  const auto columns = data.headerparts.back ().size ();
+  const auto rows = data.headerparts.size ();
+
+  for (std::size_t row = 0; row + 1 < rows; row ++)
+  {
+    auto & cells = data.headerparts[row];
+    cells.resize (columns);
+    for (std::size_t column = 1; column < columns; column ++)
+      if (cells[column].empty ())
+        cells[column] = cells[column - 1];
+  }
+
+  for (std::size_t column = 0; column < columns; column ++)
+  {
+    std::string key = "";
+    for (const auto & cells : data.headerparts)
+    {
+      if (cells[column].empty ())
+        continue;
+      if (!key.empty ())
+        key += data.headerjoin;
+      key += cells[column];
+    }
+    data.s_header.push_back (key);
+  }
+  data.headerparts.clear ();
+
+  // copy std::string header to std::string_view for performance
+  for (const auto & header : data.s_header)
+    data.header.push_back (std::string_view (header));
+
+  // valid token count equals the token count of the header
+  data.validtokencount = columns;
+
+  // keys in canonical order, each taken from its input column or a
+  // default. --canonical-schema command line argument
+  std::vector<std::string_view> names (data.header);
+  if (!data.canonical.empty ())
+  {
+    names.assign (data.canonical.begin (), data.canonical.end ());
+    for (const auto & name : data.canonical)
+    {
+      const auto found = std::find (data.header.begin (), data.header.end (), name);
+      data.permutation.push_back (found != data.header.end () ?
+                                  found - data.header.begin () : -1);
+    }
+  }
+
+  // json lines name their input. --members ndjson command line argument
+  std::string first = "{\"";
+  if (data.members == MEMBERS_NDJSON)
+  {
+    first = "{\"_file\":\"";
+    AppendEscaped (first, data.inputname);
+    first += "\",\"";
+  }
+
+  for (std::size_t column = 0; column < names.size (); column ++)
+  {
+    std::string key = column == 0 ? first : "\",\"";
+    if (data.escape)
+      AppendEscaped (key, names[column]);
+    else
+      key += names[column];
+    key += "\":\"";
+    data.keys.push_back (key);
+  }
+
+  // reserve chars for tokens to avoid string resize costs
+  for (unsigned counter = 0; counter < columns; counter++)
+    data.tokens[counter].reserve (STRING_RESERVE_SIZE);
+}
+
+// take a line before the keys exist: a title line before --header-row
+// or one of the --header-rows
+// returns: false when the conversion must stop, with data.error set
+static bool
+HeaderLine (CData & data, std::size_t ntokens)
+{
+  data.leadinglines ++;
+  if (data.leadinglines < data.headerrow)
+    return true;
+
+  if (ntokens == 0)
+  {
+    data.error = "Invalid header at line " + std::to_string (data.line_counter);
+    return false;
+  }
+
+  data.headerparts.emplace_back (data.tokens.begin (), data.tokens.begin () + ntokens);
+  if (data.headerparts.size () < data.headerrows)
+    return true;
+
+  HeaderCompose (data);
+  return true;
+}
+
+// apply the --bad-rows policy to a rejected row
+// returns: false when the conversion must stop, with data.error set
+static bool
+BadRow (CData & data, const char *reason, const Validator *validator = nullptr)
+{
+  if (data.instrumented) [[unlikely]]
+    Add (data.stats.badrows, 1);
+
+  if (data.badrows == BADROWS_SKIP) [[likely]]
+    return true;
+
+  std::string message =
+    "Bad row at line " + std::to_string (data.line_counter) + ": " + reason;
+  if (data.infilepaths.size () > 1 || data.reader.archive != nullptr)
+    message = data.inputname + ": " + message;
+  if (validator != nullptr)
+    message = message + ' ' + validator->keyword + " of " + validator->column;
+
+  if (data.badrows == BADROWS_ABORT)
+  {
+    data.error = message;
+    return false;
+  }
+
+  std::cerr << message << '\n';
+  return true;
+}
+
+// prepare a conversion: compile the options that read files, start the
+// instrumentation and begin the json array in the output block
+// returns: true on success, false with data.error set otherwise
+static bool
+ConvertStart (CData & data)
+{
+  // reserve std::string buffer to avoid often resize
+  data.inputline.reserve (STRING_RESERVE_SIZE * 4);
+  data.outputline.reserve (STRING_RESERVE_SIZE * 4);
+  data.outblock.reserve (OUTPUT_BLOCK_SIZE + STRING_RESERVE_SIZE * 4);
+
+  // compile the schema checks. --validate command line argument
+  if (data.schemapath != "")
+  {
+    const auto error = SchemaCompile (data.schemapath, data.schema);
+    if (error != "")
+    {
+      data.error = "Invalid schema: " + error;
+      return false;
+    }
+  }
+
+  // read the hash key. --hash-key command line argument
+  if (data.hashes.size () != 0)
+  {
+    const auto error = data.hashkeypath != "" ?
+                       HashKeyRead (data.hashkeypath, data.hashkey) :
+                       std::string ("--hash-col requires --hash-key");
+    if (error != "")
+    {
+      data.error = "Invalid hash key: " + error;
+      return false;
+    }
+  }
+
+  LapStart (data);
+
+  // begin a json array
+  data.outblock = data.members == MEMBERS_ARRAY ? "[" : "";
+  return true;
+}
+
+// filter and tokenize inputline, carrying a line that ends inside a
+// quoted field to the next one
+// returns: the token count or TOKENS_INCOMPLETE
+static std::size_t
+PrepareLine (CData & data)
+{
+  constexpr char space = ' ';
+
+  // join a record continued from the previous line. --dialect command
+  // line argument
+  if (!data.carry.empty ()) [[unlikely]]
+  {
+    data.carry += '\n';
+    data.carry += data.inputline;
+    data.inputline.swap (data.carry);
+    data.carry.clear ();
+  }
+
+  // replace char with space. -r command line argument
+  if (data.replacewithspace.size () != 0)
+  {
+    for (const auto & schar : data.replacewithspace)
+      std::ranges::replace (data.inputline, schar, space);
+  }
+
+  // erase characters. -e command line argument
+  if (data.erasechars.size () != 0)
+  {
+    for (const auto & echar : data.erasechars)
+      std::erase (data.inputline, echar);
+  }
+  Lap (data, STAGE_FILTER);
+
+  const auto ntokens = TokenizeLine (data);
+  Lap (data, STAGE_TOKENIZE);
+  if (ntokens == TOKENS_INCOMPLETE) [[unlikely]]
+    data.carry.swap (data.inputline);
+
+  return ntokens;
+}
+
+// append rendered records, each followed by its separator, to the
+// chunk: to the reserved region of the mapped output while it has room,
+// else to pooled buffers. -j command line argument
+static void
+ChunkAppend (CData & data, std::string_view json, std::uint64_t records)
+{
+  auto & chunk = *data.chunk;
+
+  if (chunk.used + json.size () <= chunk.reserved && chunk.first == nullptr) [[likely]]
+  {
+    std::memcpy (chunk.region + chunk.used, json.data (), json.size ());
+    chunk.used += json.size ();
+  }
+  else
+    ChunkSpill (*data.pool, data.poolslot, chunk, json, &data);
+
+  chunk.records += records;
+  Lap (data, STAGE_WRITE);
+  if (data.instrumented) [[unlikely]]
+  {
+    // bytes out are counted by the writer, which drops the last separator
+    Add (data.stats.records, records);
+  }
+}
+
+// whether the records of the input are batched: the default tokenizer,
+// so no escaping. --batch command line argument
+static inline bool
+BatchUsable (const CData & data) noexcept
+{
+  return data.batchrecords > 1 && data.tokenizer == nullptr;
+}
+
+// drop the batched records
+static void
+BatchClear (Batch & batch) noexcept
+{
+  batch.text.clear ();
+  batch.lineend.clear ();
+  batch.linenumber.clear ();
+#ifdef FASTCSV2JSONXX_LATENCY
+  batch.arrival.clear ();
+#endif
+}
+
+// copy size bytes as COPY_BLOCK byte stores, reading and writing up to
+// COPY_BLOCK - 1 bytes past both ranges. A fixed width value of up to
+// COPY_BLOCK bytes is a single unaligned vector store
+static inline char *
+CopyBlocks (char *target, const char *source, std::size_t size) noexcept
+{
+  std::memcpy (target, source, COPY_BLOCK);
+  for (std::size_t offset = COPY_BLOCK; offset < size; offset += COPY_BLOCK)
+    std::memcpy (target + offset, source + offset, COPY_BLOCK);
+  return target + size;
+}
+
+// plan the rendering of the valid records of the batch: the constant
+// bytes between values, and the columns whose width is the same in
+// every record
+// returns: the most bytes a record renders to
+static std::size_t
+BatchPlan (CData & data)
+{
+  auto & batch = data.batch;
+  const auto columns = data.validtokencount;
+  const auto records = batch.linenumber.size ();
+
+  batch.width.assign (columns, WIDTH_VARIABLE);
+  bool first = true;
+  for (std::size_t record = 0; record < records; record++)
+  {
+    if (batch.row[record] != ROW_VALID) [[unlikely]]
+      continue;
+
+    const std::uint32_t *length = batch.fieldlength.data () + record * columns;
+    if (first)
+    {
+      std::copy (length, length + columns, batch.width.begin ());
+      first = false;
+      continue;
+    }
+    for (std::size_t counter = 0; counter < columns; counter++)
+      if (batch.width[counter] != length[counter])
+        batch.width[counter] = WIDTH_VARIABLE;
+  }
+
+  batch.fragments.clear ();
+  batch.pieces.clear ();
+  std::size_t constant = 0, widest = 0;
+
+  const auto
+  piece = [&] (std::uint32_t column)
+  {
+    const std::uint32_t offset = batch.pieces.empty () ? 0 :
+                                 batch.pieces.back ().offset + batch.pieces.back ().size;
+    const std::uint32_t width = column != PIECE_END ? batch.width[column] : 0;
+    batch.pieces.push_back ({ offset, static_cast<std::uint32_t> (batch.fragments.size () - offset),
+                              column, width });
+    if (width != WIDTH_VARIABLE)
+      constant += width;
+  };
+
+  for (std::size_t counter = 0; counter < data.keys.size (); counter++)
+  {
+    const auto source = data.permutation.empty () ? static_cast<std::ptrdiff_t> (counter) :
+                        data.permutation[counter];
+    batch.fragments += data.keys[counter];
+    if (source < 0) // canonical column the input lacks
+      batch.fragments += data.canonicaldefaults[counter];
+    else
+      piece (source);
+  }
+  batch.fragments += "\"}";
+  piece (PIECE_END);
+  constant += batch.fragments.size ();
+  batch.fragments.append (COPY_BLOCK, '\0');
+
+  // variable width values are bounded by their line, rewritten ones by
+  // their sum. --mask, --replace and --hash-col command line arguments
+  for (std::size_t record = 0; record < records; record++)
+  {
+    std::size_t bound = batch.lineend[record] - (record != 0 ? batch.lineend[record - 1] : 0);
+    if ((!data.rewrites.empty () || !data.hashes.empty ()) && batch.row[record] == ROW_VALID)
+    {
+      const std::uint32_t *length = batch.fieldlength.data () + record * columns;
+      bound = std::accumulate (length, length + columns, std::size_t (0));
+    }
+    widest = std::max (widest, bound);
+  }
+
+  return constant + widest;
+}
+
+// render a valid batched record at target as planned
+// returns: the end of the record
+static inline char *
+BatchRender (const Batch & batch, std::size_t record, std::size_t columns, char *target)
+{
+  const char *text = batch.text.data ();
+  const char *fragments = batch.fragments.data ();
+  const std::uint32_t *start = batch.fieldstart.data () + record * columns;
+  const std::uint32_t *length = batch.fieldlength.data () + record * columns;
+
+  for (const auto & piece : batch.pieces)
+  {
+    target = CopyBlocks (target, fragments + piece.offset, piece.size);
+    if (piece.column == PIECE_END)
+      break;
+
+    const char *value = text + start[piece.column];
+    if (piece.width != WIDTH_VARIABLE) [[likely]]
+      target = CopyBlocks (target, value, piece.width);
+    else
+    {
+      std::memcpy (target, value, length[piece.column]);
+      target += length[piece.column];
+    }
+  }
+
+  return target;
+}
+
+// convert the batched records a stage at a time, into the output block
+// or the chunk. Rejected records go to the --bad-rows policy in line
+// order, an abort keeps the records before it
+// returns: false when the conversion must stop, with data.error set
+static bool
+BatchConvert (CData & data)
+{
+  auto & batch = data.batch;
+  const auto records = batch.linenumber.size ();
+  if (records == 0)
+    return true;
+
+  const auto columns = data.validtokencount;
+  const char delimiter = data.delimiter[0];
+  const char *text = batch.text.data ();
+
+  batch.fieldstart.resize (records * columns);
+  batch.fieldlength.resize (records * columns);
+  batch.row.assign (records, ROW_VALID);
+
+  // split every line, recording up to columns fields
+  for (std::size_t record = 0; record < records; record++)
+  {
+    std::uint32_t *start = batch.fieldstart.data () + record * columns;
+    std::uint32_t *length = batch.fieldlength.data () + record * columns;
+    const char *field = text + (record != 0 ? batch.lineend[record - 1] : 0);
+    const char *end = text + batch.lineend[record];
+    std::size_t count = 0;
+
+    for (;;)
+    {
+      const auto *next = static_cast<const char *> (std::memchr (field, delimiter, end - field));
+      const char *fieldend = next != nullptr ? next : end;
+      if (count < columns) [[likely]]
+      {
+        start[count] = field - text;
+        length[count] = fieldend - field;
+      }
+      count++;
+      if (next == nullptr)
+        break;
+      field = next + 1;
+    }
+
+    if (count != columns) [[unlikely]]
+      batch.row[record] = ROW_FIELDS;
+  }
+  Lap (data, STAGE_TOKENIZE);
+
+  // check tokens against the schema. --validate command line argument
+  if (data.validators.size () != 0)
+  {
+    batch.failed.resize (records);
+    for (std::size_t record = 0; record < records; record++)
+    {
+      if (batch.row[record] != ROW_VALID)
+        continue;
+
+      const std::uint32_t *start = batch.fieldstart.data () + record * columns;
+      const std::uint32_t *length = batch.fieldlength.data () + record * columns;
+      for (const auto & validator : data.validators)
+        if (!validator.check (std::string_view (text + start[validator.index],
+                                                length[validator.index])))
+        {
+          batch.row[record] = ROW_INVALID;
+          batch.failed[record] = &validator;
+          break;
+        }
+    }
+    Lap (data, STAGE_VALIDATE);
+  }
+
+  // mask, replace and hash, the new values appended to the batch text.
+  // --mask, --replace and --hash-col command line arguments
+  if (data.rewrites.size () != 0 || data.hashes.size () != 0)
+  {
+    for (std::size_t record = 0; record < records; record++)
+    {
+      if (batch.row[record] != ROW_VALID)
+        continue;
+
+      std::uint32_t *start = batch.fieldstart.data () + record * columns;
+      std::uint32_t *length = batch.fieldlength.data () + record * columns;
+      for (const auto & rule : data.rewrites)
+      {
+        if (rule.index == COLUMN_ABSENT ||
+            !RewriteToken (rule, std::string_view (batch.text).substr (start[rule.index],
+                                                                         length[rule.index]),
+                           data.scratch, data.matchstarts))
+          continue;
+
+        if (batch.text.size () + data.scratch.size () >= UINT32_MAX - COPY_BLOCK) [[unlikely]]
+        {
+          data.error = "Rewritten batch too large";
+          BatchClear (batch);
+          return false;
+        }
+        start[rule.index] = batch.text.size ();
+        length[rule.index] = data.scratch.size ();
+        batch.text += data.scratch;
+      }
+
+      for (const auto & rule : data.hashes)
+      {
+        if (rule.index == COLUMN_ABSENT)
+          continue;
+
+        const auto offset = batch.text.size ();
+        if (offset >= UINT32_MAX - HASH_HEX_SIZE - COPY_BLOCK) [[unlikely]]
+        {
+          data.error = "Rewritten batch too large";
+          BatchClear (batch);
+          return false;
+        }
+        batch.text.resize (offset + HASH_HEX_SIZE);
+        HashToken (rule, data.hashkey,
+                   std::string_view (batch.text).substr (start[rule.index], length[rule.index]),
+                   batch.text.data () + offset);
+        start[rule.index] = offset;
+        length[rule.index] = HASH_HEX_SIZE;
+      }
+    }
+    text = batch.text.data ();
+    Lap (data, STAGE_TRANSFORM);
+  }
+
+  // render as planned, with the separators of the output block or of a
+  // chunk, straight into json grown to the most bytes the batch renders
+  // to
+  const bool chunked = data.chunk != nullptr;
+  const std::string_view separator = data.members == MEMBERS_NDJSON ? "\n" : ",\n";
+  std::string & json = chunked ? data.outputline : data.outblock;
+  const auto line_counter = data.line_counter;
+  const auto outsize = data.outblock.size ();
+  std::uint64_t rendered = 0;
+  bool complete = true;
+
+  if (chunked)
+    data.outputline.clear ();
+
+  batch.text.append (COPY_BLOCK, '\0');
+  const auto bound = (BatchPlan (data) + separator.size ()) * records;
+  const auto used = json.size ();
+  json.resize (used + bound + COPY_BLOCK);
+  char *target = json.data () + used;
+
+  for (std::size_t record = 0; record < records; record++)
+  {
+    if (batch.row[record] != ROW_VALID) [[unlikely]]
+    {
+      data.line_counter = batch.linenumber[record];
+      complete = batch.row[record] == ROW_FIELDS ?
+                 BadRow (data, "invalid field count") :
+                 BadRow (data, "failed", batch.failed[record]);
+      if (!complete)
+        break;
+      continue;
+    }
+
+    if (!chunked && data.written != 0) [[likely]]
+      target = std::copy (separator.begin (), separator.end (), target);
+    target = BatchRender (batch, record, columns, target);
+    if (chunked)
+      target = std::copy (separator.begin (), separator.end (), target);
+
+    data.written ++;
+    rendered ++;
+#ifdef FASTCSV2JSONXX_LATENCY
+    if (!chunked)
+    {
+      data.arrival = batch.arrival[record];
+      LatencyMark (data);
+    }
+#endif
+  }
+  data.line_counter = line_counter;
+  json.resize (target - json.data ());
+  Lap (data, STAGE_RENDER);
+
+  if (chunked)
+    ChunkAppend (data, data.outputline, rendered);
+  else if (data.instrumented) [[unlikely]]
+  {
+    Add (data.stats.records, rendered);
+    Add (data.stats.bytes_out, data.outblock.size () - outsize);
+  }
+
+  BatchClear (batch);
+  return complete;
+}
+
+// add inputline to the batch, filtered, and convert the batch once it
+// is full. -r and -e command line arguments
+// returns: false when the conversion must stop, with data.error set
+static bool
+BatchAdd (CData & data)
+{
+  constexpr char space = ' ';
+  auto & batch = data.batch;
+  const auto begin = batch.text.size ();
+  batch.text += data.inputline;
+
+  // replace char with space. -r command line argument
+  for (const auto & schar : data.replacewithspace)
+    std::replace (batch.text.begin () + begin, batch.text.end (), schar, space);
+
+  // erase characters. -e command line argument
+  for (const auto & echar : data.erasechars)
+    batch.text.erase (std::remove (batch.text.begin () + begin, batch.text.end (), echar),
+                      batch.text.end ());
+
+  batch.lineend.push_back (batch.text.size ());
+  batch.linenumber.push_back (data.line_counter);
+#ifdef FASTCSV2JSONXX_LATENCY
+  batch.arrival.push_back (data.arrival);
+#endif
+  Lap (data, STAGE_FILTER);
+
+  if (batch.linenumber.size () < data.batchrecords && batch.text.size () < BATCH_BYTES) [[likely]]
+    return true;
+  return BatchConvert (data);
+}
+
+// end an input: convert the batched records, then reject a quoted field
+// left open by the last line. --dialect command line argument
+// returns: false when the conversion must stop, with data.error set
+static bool
+InputEnd (CData & data)
+{
+  if (!BatchConvert (data)) [[unlikely]]
+    return false;
+
+  if (data.carry.empty ()) [[likely]]
+    return true;
+
+  data.carry.clear ();
+  return BadRow (data, "unterminated quoted field");
+}
+
+
+// convert inputline into a json record appended to the output block
+// returns: false when the conversion must stop, with data.error set
+static bool
+ConvertLine (CData & data)
+{
+  constexpr char comma = ',';
+
+  // records after the header are converted a batch at a time, but for
+  // lines too long for the batch offsets. --batch command line argument
+  if (!data.keys.empty () && BatchUsable (data)) [[likely]]
+  {
+    if (data.inputline.size () < UINT32_MAX - BATCH_BYTES) [[likely]]
+      return BatchAdd (data);
+    if (!BatchConvert (data))
+      return false;
+  }
+
+  const auto ntokens = PrepareLine (data);
+  if (ntokens == TOKENS_INCOMPLETE) [[unlikely]] // quoted line feed
+    return true;
+
+  // lines up to the end of the header are not json records. Bind column
+  // options to the header once it is complete
+  if (data.keys.empty ()) [[unlikely]]
+  {
+    if (!HeaderLine (data, ntokens))
+      return false;
+    if (!data.keys.empty ())
+      data.error = BindHeader (data);
+    return data.error == "";
+  }
+
+  if (data.validtokencount != ntokens) [[unlikely]] // csv must be valid
+    return BadRow (data, "invalid field count");
+
+  // check tokens against the schema. --validate command line argument
+  if (data.validators.size () != 0)
+  {
+    const auto failed =
+      std::find_if (data.validators.begin (), data.validators.end (),
+                    [&] (const Validator & validator)
+    {
+      return !validator.check (data.tokens[validator.index]);
+    });
+    Lap (data, STAGE_VALIDATE);
+
+    if (failed != data.validators.end ())
+      return BadRow (data, "failed", &*failed);
+  }
+
+  // mask, replace and hash. --mask, --replace and --hash-col command
+  // line arguments
+  if (data.rewrites.size () != 0 || data.hashes.size () != 0)
+  {
+    for (const auto & rule : data.rewrites)
+      if (rule.index != COLUMN_ABSENT &&
+          RewriteToken (rule, data.tokens[rule.index], data.scratch, data.matchstarts))
+        data.tokens[rule.index].swap (data.scratch);
+    for (const auto & rule : data.hashes)
+      if (rule.index != COLUMN_ABSENT) [[likely]]
+      {
+        char digits[HASH_HEX_SIZE];
+        HashToken (rule, data.hashkey, data.tokens[rule.index], digits);
+        data.tokens[rule.index].assign (digits, HASH_HEX_SIZE);
+      }
+    Lap (data, STAGE_TRANSFORM);
+  }
+
+  // begin json record, keys from the key table
+  data.outputline.clear ();
+  if (data.permutation.empty ()) [[likely]]
+  {
+    for (unsigned counter = 0; counter < ntokens; counter++)
+    {
+      data.outputline += data.keys[counter];
+      if (data.escape) [[unlikely]]
+        AppendEscaped (data.outputline, data.tokens[counter]);
+      else
+        data.outputline += data.tokens[counter];
+    }
+  }
+  else // canonical column order. --canonical-schema command line argument
+  {
+    for (std::size_t counter = 0; counter < data.keys.size (); counter++)
+    {
+      const auto source = data.permutation[counter];
+      const std::string_view value = source >= 0 ? data.tokens[source] :
+                                     data.canonicaldefaults[counter];
+      data.outputline += data.keys[counter];
+      if (data.escape) [[unlikely]]
+        AppendEscaped (data.outputline, value);
+      else
+        data.outputline += value;
+    }
+  }
+  // end json record
+  data.outputline += "\"}";
+  Lap (data, STAGE_RENDER);
+
+  if (data.chunk != nullptr) [[unlikely]]
+  {
+    data.outputline += data.members == MEMBERS_NDJSON ? "\n" : ",\n";
+    ChunkAppend (data, data.outputline, 1);
+    return true;
+  }
+
+  // comma after json record, json lines only need the line feed
+  const auto outsize = data.outblock.size ();
+  if (data.written != 0) [[likely]]
+  {
+    if (data.members != MEMBERS_NDJSON) [[likely]]
+      data.outblock += comma;
+    data.outblock += '\n';
+  }
+  data.outblock += data.outputline;
+  if (data.instrumented) [[unlikely]]
+  {
+    Add (data.stats.records, 1);
+    Add (data.stats.bytes_out, data.outblock.size () - outsize);
+  }
+  data.written ++;
+#ifdef FASTCSV2JSONXX_LATENCY
+  LatencyMark (data);
+#endif
+
+  return true;
+}
+
+// end the json array in the output block
+// returns: false when the conversion must stop, with data.error set
+static bool
+ConvertFinish (CData & data)
+{
+  const auto complete = InputEnd (data);
+
+  if (data.members == MEMBERS_ARRAY) [[likely]]
+  {
+    data.outblock += ']';
+    if (data.instrumented) [[unlikely]]
+      Add (data.stats.bytes_out, 2); // json array brackets
+  }
+  else if (data.members == MEMBERS_NDJSON && data.written != 0)
+  {
+    data.outblock += '\n';
+    if (data.instrumented) [[unlikely]]
+      Add (data.stats.bytes_out, 1);
+  }
+
+  return complete;
+}
+
+// convert one complete line fed to a converter or a worker
+// returns: false when the conversion must stop
+static bool
+ConvertFedLine (CData & data, std::string_view line)
+{
+  data.line_counter ++;
+  if (SkipLine (data, line.data (), line.data () + line.size ())) [[unlikely]]
+    return true;
+
+  data.inputline.assign (line);
+  if (data.instrumented) [[unlikely]]
+    Add (data.stats.bytes_in, line.size () + 1);
+  Lap (data, STAGE_READ);
+
+  return ConvertLine (data);
+}
+
+// position among the inputs: the -i files and the members of those
+// that are archives
+struct InputCursor
+{
+  std::size_t file = 0;								// next -i file
+  int fd = -1;										// open plain file
+  Archive archive;									// open archive
+  std::uint64_t prefix = 0;							// zip member bytes decoded, 0 all
+
+  ~InputCursor ()
+  {
+    ArchiveClose (archive);
+    if (fd != -1)
+      close (fd);
+  }
+};
+
+// reset the state kept per input
+static void
+InputReset (CData & data)
+{
+  data.line_counter = 0;
+  data.leadinglines = 0;
+  data.validtokencount = 0;
+  data.carry.clear ();
+  data.keys.clear ();
+  data.s_header.clear ();
+  data.header.clear ();
+  data.headerparts.clear ();
+  data.permutation.clear ();
+}
+
+// move to the next input: an archive member, a file, or STDIN when no
+// file is given. -i command line argument
+// returns: false after the last input, or on error with data.error set
+static bool
+InputNext (CData & data, InputCursor & cursor)
+{
+  if (cursor.fd != -1)
+  {
+    close (cursor.fd);
+    cursor.fd = -1;
+  }
+
+  const auto inputs = std::max<std::size_t> (data.infilepaths.size (), 1);
+  for (;;)
+  {
+    if (cursor.archive.kind != ARCHIVE_NONE)
+    {
+      if (ArchiveNext (cursor.archive))
+      {
+        InputReset (data);
+        data.inputname = cursor.archive.name;
+        data.reader.fd = -1;
+        data.reader.archive = &cursor.archive;
+        ReaderOpen (data.reader);
+        return true;
+      }
+
+      ArchiveClose (cursor.archive);
+      if (cursor.archive.error != "")
+      {
+        data.error = data.infilepaths[cursor.file - 1] + ": " + cursor.archive.error;
+        return false;
+      }
+    }
+
+    if (cursor.file == inputs)
+      return false;
+    const auto index = cursor.file ++;
+
+    InputReset (data);
+    data.reader.archive = nullptr;
+    data.reader.fd = 0;
+    data.inputname = "";
+    if (!data.infilepaths.empty ())
+    {
+      const auto & path = data.infilepaths[index];
+      if (const auto kind = ArchiveProbe (path); kind != ARCHIVE_NONE)
+      {
+        const auto error = ArchiveOpen (cursor.archive, path, kind);
+        if (error != "")
+        {
+          ArchiveClose (cursor.archive);
+          data.error = path + ": " + error;
+          return false;
+        }
+        cursor.archive.window = data.decoders;
+        cursor.archive.prefix = cursor.prefix;
+        if (data.memorylimit != 0)
+          cursor.archive.budget = std::min (ARCHIVE_AHEAD_SIZE, data.memorylimit / 8);
+        continue;
+      }
+
+      cursor.fd = open (path.c_str (), O_RDONLY | O_CLOEXEC);
+      if (cursor.fd == -1)
+      {
+        data.error = "Cannot open input file: " + path;
+        return false;
+      }
+      data.reader.fd = cursor.fd;
+      data.inputname = path;
+    }
+
+    ReaderOpen (data.reader);
+    return true;
+  }
+}
+
+// read the header of every input once, the canonical columns are their
+// union in order of appearance. --canonical-schema command line argument
+// returns: true on success, false with data.error set otherwise
+static bool
+CanonicalSchema (CData & data)
+{
+  if (data.infilepaths.empty ())
+  {
+    data.error = "--canonical-schema requires input files";
+    return false;
+  }
+
+  // only the start of a zip member is inflated, more when the header
+  // runs past it
+  InputCursor cursor;
+  cursor.prefix = ARCHIVE_HEADER_PREFIX;
+  while (InputNext (data, cursor))
+  {
+    while (data.keys.empty () && GetLine (data))
+    {
+      const auto ntokens = PrepareLine (data);
+      if (ntokens != TOKENS_INCOMPLETE && !HeaderLine (data, ntokens))
+        break;
+    }
+
+    if (data.error != "")
+      return false;
+
+    for (const auto & column : data.s_header)
+      if (std::find (data.canonical.begin (), data.canonical.end (), column) ==
+          data.canonical.end ())
+        data.canonical.push_back (column);
+  }
+
+  for (const auto & column : data.canonical)
+  {
+    const auto found =
+      std::find_if (data.columndefaults.begin (), data.columndefaults.end (),
+                    [&] (const auto & entry) { return entry.first == column; });
+    data.canonicaldefaults.push_back (found != data.columndefaults.end () ?
+                                      found->second : std::string (""));
+  }
+
+  return data.error == "";
+}
+
+// output file of an input with --members split: DIRECTORY/NAME.json,
+// NAME the input path without its extension, directories flattened
+static std::string
+SplitPath (const CData & data)
+{
+  std::string name = data.inputname;
+  if (data.reader.archive == nullptr)
+    name = name.substr (name.rfind ('/') + 1);
+  std::ranges::replace (name, '/', '_');
+
+  const auto dot = name.rfind ('.');
+  if (dot != std::string::npos && dot != 0)
+    name.resize (dot);
+
+  return data.outfilepath + '/' + name + ".json";
+}
+
+// cpu a thread may run on and its place in the topology
+struct CpuPlace
+{
+  int cpu = 0;										// cpu number
+  int package = 0;									// physical package id
+  int core = 0;										// core id in the package
+  unsigned rank = 0;								// position of the core in its package
+  unsigned sibling = 0;								// smt thread of the core, 0 first
+};
+
+// number in a sysfs file
+// returns: fallback when the file is missing or unreadable
+static int
+SysfsNumber (const std::string & path, int fallback)
+{
+  std::ifstream file (path);
+  int number;
+  return file >> number ? number : fallback;
+}
+
+// cpus this process may run on, topology from /sys/devices/system/cpu.
+// A cpu without topology files is a core of its own
+static std::vector<CpuPlace>
+CpuTopology ()
+{
+  std::vector<CpuPlace> places;
+  cpu_set_t allowed;
+  if (sched_getaffinity (0, sizeof (allowed), &allowed) != 0)
+    return places;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+  {
+    if (!CPU_ISSET (cpu, &allowed))
+      continue;
+
+    const std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string (cpu) + "/topology/";
+    CpuPlace place;
+    place.cpu = cpu;
+    place.package = SysfsNumber (topology + "physical_package_id", 0);
+    place.core = SysfsNumber (topology + "core_id", cpu);
+    places.push_back (place);
+  }
+
+  // number the cores of each package and the threads of each core
+  std::vector<std::pair<int, int>> cores;
+  for (const auto & place : places)
+    cores.emplace_back (place.package, place.core);
+  std::ranges::sort (cores);
+  cores.erase (std::unique (cores.begin (), cores.end ()), cores.end ());
+
+  for (auto & place : places)
+  {
+    const auto core = std::ranges::find (cores, std::pair (place.package, place.core));
+    place.rank = core - std::ranges::find (cores, place.package, &std::pair<int, int>::first);
+    place.sibling = std::ranges::count_if (places, [&] (const CpuPlace & other)
+    {
+      return other.package == place.package && other.core == place.core && other.cpu < place.cpu;
+    });
+  }
+
+  return places;
+}
+
+// parse a --pin cpu list such as 0,2,4-7
+// returns: false when malformed
+static bool
+CpuList (std::string_view text, std::vector<int> & cpus)
+{
+  while (!text.empty ())
+  {
+    const auto comma = text.find (',');
+    const auto range = text.substr (0, comma);
+    const auto dash = range.find ('-');
+
+    // a number filling from to to: from_chars leaves ptr at to for an
+    // empty range, only ec tells it failed
+    const auto
+    number = [] (const char *from, const char *to, int & value)
+    {
+      const auto [ptr, ec] = std::from_chars (from, to, value);
+      return ec == std::errc () && ptr == to;
+    };
+
+    int first, last;
+    const auto begin = range.data (), end = range.data () + range.size ();
+    const auto middle = dash == std::string_view::npos ? end : begin + dash;
+    if (!number (begin, middle, first) || (middle != end && !number (middle + 1, end, last)))
+      return false;
+    if (middle == end)
+      last = first;
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back (cpu);
+
+    if (comma == std::string_view::npos)
+      break;
+    text.remove_prefix (comma + 1);
+    if (text.empty ())
+      return false;
+  }
+
+  return !cpus.empty ();
+}
+
+// cpus of the threads: -j workers take the first ones, then the reader
+// and the writer, wrapping around when there are more threads than cpus.
+// compact fills the cores of a package before the next, scatter deals
+// cores out to the packages in turn; both take one thread of every core
+// before any smt sibling, so converting workers only share a core once
+// each has one. Sets data.stats.pinning. --pin command line argument
+// returns: error message, empty on success
+static std::string
+PinPlan (CData & data, bool parallel)
+{
+  auto places = CpuTopology ();
+  if (places.empty ())
+    return "Cannot read the cpus to pin to";
+
+  if (data.pin == "compact")
+    std::ranges::sort (places, {}, [] (const CpuPlace & place)
+    {
+      return std::tuple (place.sibling, place.package, place.rank, place.cpu);
+    });
+  else if (data.pin == "scatter")
+    std::ranges::sort (places, {}, [] (const CpuPlace & place)
+    {
+      return std::tuple (place.sibling, place.rank, place.package, place.cpu);
+    });
+  else
+  {
+    std::vector<int> cpus;
+    CpuList (data.pin, cpus);
+    std::vector<CpuPlace> listed;
+    for (const int cpu : cpus)
+    {
+      const auto place = std::ranges::find (places, cpu, &CpuPlace::cpu);
+      if (place == places.end ())
+        return "Cannot pin to cpu " + std::to_string (cpu);
+      listed.push_back (*place);
+    }
+    places = std::move (listed);
+  }
+
+  data.pincpus.clear ();
+  for (const auto & place : places)
+    data.pincpus.push_back (place.cpu);
+
+  const auto
+  cpu = [&] (unsigned slot)
+  {
+    return std::to_string (data.pincpus[slot % data.pincpus.size ()]);
+  };
+
+  auto & report = data.stats.pinning;
+  report = (data.pin == "compact" || data.pin == "scatter" ? data.pin : "list");
+  if (!parallel)
+  {
+    report += ", converter on cpu " + cpu (0);
+    return "";
+  }
+
+  std::vector<std::pair<int, int>> cores;
+  report += ", workers on cpus ";
+  for (unsigned counter = 0; counter < data.threads; counter++)
+  {
+    const auto & place = places[counter % places.size ()];
+    cores.emplace_back (place.package, place.core);
+    report += (counter != 0 ? "," : "") + cpu (counter);
+  }
+  report += ", reader on cpu " + cpu (data.threads) + ", writer on cpu " + cpu (data.threads + 1);
+
+  std::ranges::sort (cores);
+  const auto shared = std::ranges::unique (cores).size ();
+  if (shared != 0)
+    report += ", " + std::to_string (shared) + " workers on cores already taken";
+
+  return "";
+}
+
+// pin the calling thread to the cpu of its --pin slot: a -j worker's
+// index, the worker count for the reader and one more for the writer
+static void
+PinThread (const CData & data, unsigned slot) noexcept
+{
+  if (data.pincpus.empty ())
+    return;
+
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  CPU_SET (data.pincpus[slot % data.pincpus.size ()], &set);
+  sched_setaffinity (0, sizeof (set), &set);
+}
+
+constexpr unsigned CHUNKS_PER_WORKER = 2;			// chunks in flight per worker
+constexpr std::uint64_t MAP_WINDOW = std::uint64_t (1) << 40;	// mapped output address space
+constexpr std::uint64_t MAP_GROWTH = 1 << 28;		// mapped output file growth step
+constexpr std::uint64_t TUNE_WINDOW = 1 << 24;		// input bytes per --auto-tune measurement
+constexpr std::uint64_t TUNE_BUDGET = 1 << 28;		// input bytes --auto-tune measures
+constexpr double TUNE_GAIN = 1.03;					// throughput ratio a step must reach
+constexpr unsigned TUNE_BLOCK_MIN = 16;				// log2 of the smallest read block tried
+constexpr unsigned TUNE_BLOCK_MAX = 26;				// log2 of the largest read block tried
+
+// cgroup v2 directory of the process, from /proc/self/cgroup and the
+// cgroup2 mount in /proc/self/mountinfo. Sets mount to the mount point
+// returns: empty without a cgroup v2 hierarchy
+static std::string
+CgroupPath (std::string & mount)
+{
+  std::ifstream cgroups ("/proc/self/cgroup");
+  std::string line, path;
+  while (std::getline (cgroups, line))
+    if (line.starts_with ("0::"))
+      path = line.substr (3);
+  if (path == "")
+    return "";
+
+  std::ifstream mounts ("/proc/self/mountinfo");
+  while (std::getline (mounts, line))
+  {
+    // id parent device root mountpoint options ... - type source options
+    const auto separator = line.find (" - ");
+    if (separator == std::string::npos || line.compare (separator + 3, 8, "cgroup2 ") != 0)
+      continue;
+
+    std::istringstream fields (line);
+    std::string id, parent, device, root;
+    fields >> id >> parent >> device >> root >> mount;
+    if (root != "/" && path.starts_with (root))
+      path.erase (0, root.size ());
+    while (path.ends_with ('/'))
+      path.pop_back ();
+    return mount + path;
+  }
+
+  return "";
+}
+
+// cpus and memory the conversion may use: the cpus of the affinity mask,
+// fewer under a cgroup v2 cpu.max quota, and the cgroup v2 memory.max.
+// The limits of the ancestors up to the cgroup mount apply as well, with
+// --cgroup only those of its directory
+static void
+ResourceLimits (CData & data)
+{
+  cpu_set_t allowed;
+  data.cpus = sched_getaffinity (0, sizeof (allowed), &allowed) == 0 ?
+              CPU_COUNT (&allowed) : std::thread::hardware_concurrency ();
+  data.cpus = std::max (1u, data.cpus);
+  data.memorylimit = 0;
+
+  std::string mount = data.cgrouppath;
+  std::string directory = data.cgrouppath != "" ? data.cgrouppath : CgroupPath (mount);
+  unsigned quota = 0;								// cpus of the tightest cpu.max
+  while (directory != "")
+  {
+    std::uint64_t value, period;
+    std::string field;
+
+    std::ifstream cpumax (directory + "/cpu.max");
+    if (cpumax >> field >> period && period != 0 &&
+        std::from_chars (field.data (), field.data () + field.size (), value).ec == std::errc ())
+    {
+      const auto cpus = static_cast<unsigned> (std::max<std::uint64_t> (1, (value + period - 1) / period));
+      quota = quota != 0 ? std::min (quota, cpus) : cpus;
+    }
+
+    std::ifstream memorymax (directory + "/memory.max");
+    if (memorymax >> field &&
+        std::from_chars (field.data (), field.data () + field.size (), value).ec == std::errc ())
+      data.memorylimit = data.memorylimit != 0 ? std::min (data.memorylimit, value) : value;
+
+    if (directory.size () <= mount.size () || !directory.starts_with (mount))
+      break;
+    directory.resize (directory.rfind ('/'));
+  }
+
+  if (quota != 0)
+    data.cpus = std::min (data.cpus, quota);
+
+  // the quota is shown apart, the affinity mask may allow fewer cpus
+  if (quota != 0 || data.memorylimit != 0)
+  {
+    data.stats.limits = "cpus " + std::to_string (data.cpus);
+    if (quota != 0)
+      data.stats.limits += " (cpu.max " + std::to_string (quota) + ")";
+    data.stats.limits += ", memory " +
+                         (data.memorylimit != 0 ? std::to_string (data.memorylimit) : "unlimited");
+  }
+}
+
+// largest read block whose -j chunks in flight fit in half the memory
+// limit. A chunk holds about two blocks of csv, two of json and two
+// output buffers
+// returns: SIZE_MAX without a memory limit
+static std::size_t
+BlockFits (const CData & data) noexcept
+{
+  if (data.memorylimit == 0)
+    return SIZE_MAX;
+
+  const std::uint64_t chunks = data.threads * CHUNKS_PER_WORKER + 2;
+  const auto
+  fits = [&] (std::size_t block)
+  {
+    return chunks * (4 * block + 2 * OUTPUT_BUFFER_SIZE) <= data.memorylimit / 2;
+  };
+
+  std::size_t block = std::size_t (1) << TUNE_BLOCK_MIN;
+  while (block < (std::size_t (1) << TUNE_BLOCK_MAX) && fits (block * 2))
+    block *= 2;
+
+  return block;
+}
+
+// parameters climbed by --auto-tune
+enum TuneParameter : unsigned
+{
+  TUNE_BLOCK = 0,									// log2 of the read block size
+  TUNE_WORKERS,										// workers taking chunks
+  TUNE_DECODERS,									// zip members decoded ahead
+  TUNE_COUNT
+};
+
+// --auto-tune hill climber, run by the reader. Each measurement window
+// steps one parameter; a step that does not beat the best throughput is
+// undone and the direction reversed, after both directions the next
+// parameter is climbed
+struct Tuner
+{
+  bool enabled = false;								// --auto-tune
+  bool warm = false;								// warm up window passed
+  bool settled = false;								// best values kept for good
+  std::uint64_t measured = 0;						// input bytes measured
+  std::uint64_t windowbytes = 0;					// input bytes of this window
+  std::chrono::steady_clock::time_point windowstart;	// start of this window
+  double best = 0;									// best throughput, bytes per second
+  std::array<unsigned, TUNE_COUNT> value {};		// values being measured
+  std::array<unsigned, TUNE_COUNT> bestvalue {};	// values of best
+  std::array<unsigned, TUNE_COUNT> low {};			// smallest values
+  std::array<unsigned, TUNE_COUNT> high {};			// largest values
+  unsigned parameter = TUNE_BLOCK;					// parameter being climbed
+  int direction = 1;								// step of the parameter
+  unsigned reversals = 0;							// directions tried for parameter
+  unsigned failures = 0;							// steps without gain in a row
+  unsigned steps = 0;								// measurements taken
+};
+
+// slot of the completion ring, a cache line each
+struct alignas (64) CompletionSlot
+{
+  std::atomic<Chunk *> chunk {nullptr};				// completed chunk of the slot's sequence
+};
+
+// -j engine. Chunks cycle from free to the reader, to work, to a worker,
+// to the completion ring and to the writer, which returns them to free.
+// The ring is indexed by sequence: every chunk in flight is less than
+// the chunk count past the one the writer waits for, so slots never
+// collide and completing a chunk is a store
+struct Parallel
+{
+  std::vector<std::unique_ptr<CData>> workerdata;	// conversion data of each worker
+  std::vector<std::thread> workers;					// worker threads
+  std::unique_ptr<CData> writerdata;				// statistics of the writer
+  std::thread writer;								// writer thread
+  std::vector<std::unique_ptr<Chunk>> chunks;		// every chunk
+  std::mutex mutex;									// guards the queues and stopping
+  std::condition_variable workready;				// a chunk to convert, or stopping
+  std::condition_variable freeready;				// a free chunk
+  std::deque<Chunk *> work;							// chunks to convert
+  std::vector<Chunk *> free;						// chunks to fill
+  std::vector<CompletionSlot> completed;			// completion ring, a power of two
+  std::atomic<std::uint32_t> completions {0};		// futex word, bumped to wake the writer
+  std::atomic<std::uint64_t> writerwaiting {UINT64_MAX};	// sequence the writer sleeps on
+  std::atomic<std::uint64_t> last {UINT64_MAX};		// chunk count, once the last is queued
+  std::uint64_t sequence = 0;						// next chunk sequence
+  bool stopping = false;							// the last chunk is queued
+  std::atomic<bool> failed {false};					// a chunk or the output failed
+  std::string error = "";							// first failure in output order
+  int fd = -1;										// mapped output file
+  char *map = nullptr;								// output mapping, MAP_WINDOW bytes
+  std::uint64_t reserved = 0;						// output bytes reserved, by the reader
+  std::uint64_t filesize = 0;						// output file size, by the reader
+  bool unreserved = false;							// a reservation failed, by the reader
+  std::uint64_t length = 0;							// output bytes written, by the writer
+  std::uint64_t linebound = 0;						// most json bytes of a line
+  std::uint64_t valuefactor = 1;					// most json bytes of a value byte
+  unsigned active = 0;								// workers taking chunks
+  Tuner tuner;										// --auto-tune state
+  BufferPool pool;									// output buffers past the mapping
+};
+
+// whether the inputs can be cut at any line feed: quoting dialects
+// continue records over line feeds. -j command line argument
+static bool
+ParallelUsable (const CData & data) noexcept
+{
+  return (data.threads > 1 || data.autotune) && data.members != MEMBERS_SPLIT &&
+         (data.tokenizer == nullptr || data.tokenizer == TokenizeDialect<DialectTsv>);
+}
+
+// copy the options a worker converts with
+static void
+ParallelSetup (CData & worker, const CData & data)
+{
+  worker.delimiter = data.delimiter;
+  worker.tokenizer = data.tokenizer;
+  worker.escape = data.escape;
+  worker.replacewithspace = data.replacewithspace;
+  worker.erasechars = data.erasechars;
+  worker.members = data.members;
+  worker.infilepaths = data.infilepaths;
+  worker.skiplines = data.skiplines;
+  worker.commentchar = data.commentchar;
+  worker.skipping = data.skipping;
+  worker.badrows = data.badrows;
+  worker.hashkey = data.hashkey;
+  worker.canonicaldefaults = data.canonicaldefaults;
+  worker.stats.enabled = data.stats.enabled;
+  worker.stats.hardware = data.stats.hardware;
+  worker.tracepath = data.tracepath;
+  worker.metricsaddress = data.metricsaddress;
+  worker.batchrecords = data.batchrecords;
+  worker.pincpus = data.pincpus;
+
+  worker.inputline.reserve (STRING_RESERVE_SIZE * 4);
+  worker.outputline.reserve (STRING_RESERVE_SIZE * 4);
+}
+
+// bind a worker to the columns of the input of its next chunk
+static void
+ParallelBind (CData & worker, const InputPlan & plan)
+{
+  worker.keys = plan.keys;
+  worker.validators = plan.validators;
+  worker.rewrites = plan.rewrites;
+  worker.hashes = plan.hashes;
+  worker.permutation = plan.permutation;
+  worker.validtokencount = plan.validtokencount;
+  worker.inputname = plan.inputname;
+  worker.reader.archive = plan.archive;
+
+  for (std::size_t counter = 0; counter < plan.validtokencount; counter++)
+    worker.tokens[counter].reserve (STRING_RESERVE_SIZE);
+}
+
+// take a free chunk, waiting for the writer to return one
+static Chunk *
+ParallelChunk (Parallel & parallel)
+{
+  std::unique_lock<std::mutex> lock (parallel.mutex);
+  parallel.freeready.wait (lock, [&] { return !parallel.free.empty (); });
+
+  Chunk *chunk = parallel.free.back ();
+  parallel.free.pop_back ();
+  return chunk;
+}
+
+// return a chunk to the free list, cleared
+static void
+ParallelRelease (Parallel & parallel, Chunk *chunk)
+{
+  chunk->plan.reset ();
+  chunk->region = nullptr;
+  chunk->offset = chunk->reserved = chunk->used = 0;
+  chunk->first = chunk->last = nullptr;
+  chunk->spilled = 0;
+  chunk->records = 0;
+  chunk->error.clear ();
+
+  {
+    const std::lock_guard<std::mutex> lock (parallel.mutex);
+    parallel.free.push_back (chunk);
+  }
+  parallel.freeready.notify_one ();
+}
+
+// reserve size bytes of the mapped output for a chunk, allocating the
+// file blocks ahead of the reservations: a store to a page without a
+// block, on a full or quota limited disk, raises SIGBUS. After a failed
+// reservation the chunks spill to the pool and the writer writes them.
+// Without a reservation the chunk may still be written up to offset,
+// into the slack of the chunks before it
+// returns: false when no region could be reserved
+static bool
+ParallelReserve (Parallel & parallel, Chunk & chunk, std::uint64_t size)
+{
+  chunk.offset = parallel.reserved;
+  if (parallel.unreserved || parallel.reserved + size > MAP_WINDOW) [[unlikely]]
+    return false;
+
+  if (parallel.reserved + size > parallel.filesize)
+  {
+    const auto filesize = std::min (MAP_WINDOW, std::max (parallel.reserved + size,
+                                                          parallel.filesize + MAP_GROWTH));
+    if (posix_fallocate (parallel.fd, parallel.filesize, filesize - parallel.filesize) != 0)
+    {
+      parallel.unreserved = true;
+      return false;
+    }
+    parallel.filesize = filesize;
+  }
+
+#ifdef MADV_POPULATE_WRITE
+  // fault the region in with one call, rather than a page at a time on
+  // the worker. Kernels before 5.14 do not know the advice
+  const auto mask = static_cast<std::uintptr_t> (sysconf (_SC_PAGESIZE)) - 1;
+  const auto region = reinterpret_cast<std::uintptr_t> (parallel.map + parallel.reserved);
+  if (madvise (reinterpret_cast<void *> (region & ~mask), (region & mask) + size,
+               MADV_POPULATE_WRITE) == -1 && errno != EINVAL)
+  {
+    parallel.unreserved = true;
+    return false;
+  }
+#endif
+
+  chunk.region = parallel.map + parallel.reserved;
+  chunk.reserved = size;
+  parallel.reserved += size;
+  return true;
+}
+
+// write bytes to the mapped output file at its length, after the mapped
+// bytes, once a reservation failed
+// returns: false on error, with errno set
+static bool
+WriteAt (Parallel & parallel, const char *bytes, std::size_t size) noexcept
+{
+  while (size != 0)
+  {
+    const auto count = pwrite (parallel.fd, bytes, size, parallel.length);
+    if (count == -1 && errno == EINTR)
+      continue;
+    if (count == -1)
+      return false;
+    bytes += count;
+    size -= count;
+    parallel.length += count;
+  }
+  return true;
+}
+
+// hand a converted or literal chunk to the writer: a store into the
+// slot of its sequence, then a bump of the futex word and a wake only
+// when the writer sleeps on that sequence. Other completions leave the
+// word alone, so they do not end the wait of the writer
+static void
+ParallelComplete (Parallel & parallel, Chunk *chunk) noexcept
+{
+  auto & slot = parallel.completed[chunk->sequence & (parallel.completed.size () - 1)];
+  slot.chunk.store (chunk, std::memory_order_seq_cst);
+  if (parallel.writerwaiting.load (std::memory_order_seq_cst) == chunk->sequence)
+  {
+    parallel.completions.fetch_add (1, std::memory_order_seq_cst);
+    parallel.completions.notify_one ();
+  }
+}
+
+// queue literal json after the chunks queued so far
+static void
+ParallelLiteral (Parallel & parallel, std::string_view json)
+{
+  Chunk *chunk = ParallelChunk (parallel);
+
+  if (parallel.map != nullptr && ParallelReserve (parallel, *chunk, json.size ()))
+  {
+    std::memcpy (chunk->region, json.data (), json.size ());
+    chunk->used = json.size ();
+  }
+  else
+    ChunkSpill (parallel.pool, parallel.pool.slots.size () - 1, *chunk, json);
+
+  {
+    const std::lock_guard<std::mutex> lock (parallel.mutex);
+    chunk->sequence = parallel.sequence ++;
+  }
+  ParallelComplete (parallel, chunk);
+}
+
+// worker thread: convert chunks until the engine stops. Workers from
+// parallel.active on wait until --auto-tune lets them in or the engine
+// drains. After a failure chunks are passed on unconverted, the writer
+// drops them
+static void
+ParallelWorker (Parallel & parallel, CData & worker, unsigned index)
+{
+  PinThread (worker, index);
+  LapStart (worker, "worker");
+  std::shared_ptr<const InputPlan> plan;
+
+  for (;;)
+  {
+    Chunk *chunk;
+    Lap (worker, STAGE_WRITE);
+    {
+      std::unique_lock<std::mutex> lock (parallel.mutex);
+      parallel.workready.wait (lock, [&]
+      {
+        return (!parallel.work.empty () && index < parallel.active) || parallel.stopping;
+      });
+      if (parallel.work.empty ())
+        break;
+      chunk = parallel.work.front ();
+      parallel.work.pop_front ();
+    }
+
+    Lap (worker, STAGE_WAIT);
+
+    if (!parallel.failed.load (std::memory_order_relaxed)) [[likely]]
+    {
+      if (chunk->plan != plan)
+      {
+        plan = chunk->plan;
+        ParallelBind (worker, *plan);
+      }
+
+      worker.line_counter = chunk->firstline;
+      worker.chunk = chunk;
+
+      const std::string_view lines (chunk->csv.data () + chunk->begin, chunk->end - chunk->begin);
+      for (std::size_t position = 0; position < lines.size (); )
+      {
+        auto newline = lines.find ('\n', position);
+        if (newline == std::string_view::npos)
+          newline = lines.size ();
+
+        if (!ConvertFedLine (worker, lines.substr (position, newline - position))) [[unlikely]]
+        {
+          chunk->error.swap (worker.error);
+          worker.error.clear ();
+          break;
+        }
+        position = newline + 1;
+      }
+
+      if (chunk->error == "" && !BatchConvert (worker)) [[unlikely]]
+      {
+        chunk->error.swap (worker.error);
+        worker.error.clear ();
+      }
+      BatchClear (worker.batch);
+      worker.chunk = nullptr;
+    }
+
+    ParallelComplete (parallel, chunk);
+  }
+
+  // charge the events since the last split while the thread's group counts
+  StatsSplitHardware (worker.stats);
+}
+
+// note the first failure in output order and stop the reader
+static void
+ParallelFail (Parallel & parallel, const std::string & error)
+{
+  if (parallel.failed.load ())
+    return;
+
+  const std::lock_guard<std::mutex> lock (parallel.mutex);
+  parallel.error = error;
+  parallel.failed.store (true);
+}
+
+// take the chunk of sequence next from the completion ring, sleeping on
+// the futex word only while its slot is empty. The writerwaiting
+// sequence is stored before the slot is checked, and the slot before
+// writerwaiting is loaded: either the completion sees the writer
+// waiting and bumps the word, or the writer sees the slot filled
+// returns: nullptr after the last chunk
+static Chunk *
+ParallelNext (Parallel & parallel, std::uint64_t next)
+{
+  auto & slot = parallel.completed[next & (parallel.completed.size () - 1)];
+
+  for (;;)
+  {
+    if (Chunk *chunk = slot.chunk.load (std::memory_order_acquire); chunk != nullptr) [[likely]]
+    {
+      slot.chunk.store (nullptr, std::memory_order_relaxed);
+      return chunk;
+    }
+    if (next == parallel.last.load (std::memory_order_acquire))
+      return nullptr;
+
+    parallel.writerwaiting.store (next, std::memory_order_seq_cst);
+    const auto seen = parallel.completions.load (std::memory_order_seq_cst);
+    if (slot.chunk.load (std::memory_order_seq_cst) == nullptr &&
+        next != parallel.last.load (std::memory_order_acquire))
+      parallel.completions.wait (seen, std::memory_order_seq_cst);
+    parallel.writerwaiting.store (UINT64_MAX, std::memory_order_relaxed);
+  }
+}
+
+// writer thread: write the chunks in sequence. A mapped output gets
+// each chunk moved down to the end of the output, unless it was
+// converted in place; records written into the region of a chunk never
+// reach past the region, so the move does not overwrite later chunks.
+// Other outputs are written with the last record separator held back
+static void
+ParallelWriter (Parallel & parallel, CData & data)
+{
+  const std::size_t droppable = data.members == MEMBERS_ARRAY ? 2 : 0;	// ",\n"
+  bool trailing = false;							// output ends with a separator
+  bool failed = false;								// records after a failure are dropped
+
+  const auto
+  output = [&] (std::string_view bytes)
+  {
+    if (data.shm != nullptr)
+      ShmWrite (*data.shm, bytes);
+    else
+      data.out->write (bytes.data (), bytes.size ());
+  };
+
+  // the mapped output goes by pwrite after a failed reservation
+  bool written = false;
+
+  auto & writer = *parallel.writerdata;
+  PinThread (data, data.threads + 1);
+  LapStart (writer, "writer");
+  for (std::uint64_t next = 0; ; next++)
+  {
+    Chunk *chunk = ParallelNext (parallel, next);
+    Lap (writer, STAGE_WAIT);
+    if (chunk == nullptr)
+      break;
+
+    const bool literal = chunk->plan == nullptr;
+    if (literal || !failed)
+    {
+      if (parallel.map != nullptr)
+      {
+        if (literal && trailing)
+          parallel.length -= droppable;
+
+        // reservations are made in sequence and stop at the first that
+        // failed: from the first chunk without one that does not fit the
+        // slack before it, no region is left to move into and the chunks
+        // are written after the mapped bytes
+        if (!written && chunk->region == nullptr &&
+            parallel.length + chunk->spilled > chunk->offset)
+          written = true;
+
+        if (written)
+        {
+          bool complete = true;
+          for (auto *buffer = chunk->first; buffer != nullptr && complete; buffer = buffer->next)
+            complete = WriteAt (parallel, buffer->data, buffer->used);
+          if (!complete)
+          {
+            ParallelFail (parallel, "Cannot write output file: " + data.outfilepath + ": " +
+                          std::strerror (errno));
+            failed = true;
+          }
+        }
+        else
+        {
+          char *target = parallel.map + parallel.length;
+          if (chunk->used != 0 && target != chunk->region)
+            std::memmove (target, chunk->region, chunk->used);
+          parallel.length += chunk->used;
+
+          if (chunk->spilled != 0)
+          {
+            if (parallel.length + chunk->spilled > chunk->offset + chunk->reserved)
+              ParallelFail (parallel, "Output larger than its reservation: " + data.outfilepath);
+            else
+              for (auto *buffer = chunk->first; buffer != nullptr; buffer = buffer->next)
+              {
+                std::memcpy (parallel.map + parallel.length, buffer->data, buffer->used);
+                parallel.length += buffer->used;
+              }
+          }
+        }
+      }
+      else
+      {
+        std::size_t size = chunk->spilled;
+        if (!literal && chunk->records != 0)
+        {
+          if (trailing)
+            output (std::string_view (",\n", droppable));
+          size -= droppable;
+        }
+        for (auto *buffer = chunk->first; buffer != nullptr && size != 0; buffer = buffer->next)
+        {
+          const auto bytes = std::min (size, buffer->used);
+          output (std::string_view (buffer->data, bytes));
+          size -= bytes;
+        }
+        data.out->flush ();
+      }
+
+      // the separator a chunk ends with is counted once a record chunk
+      // follows, the writer drops it otherwise
+      if (writer.instrumented && !literal && chunk->records != 0) [[unlikely]]
+        Add (writer.stats.bytes_out,
+             chunk->used + chunk->spilled - droppable + (trailing ? droppable : 0));
+
+      if (literal)
+        trailing = false;
+      else if (chunk->records != 0)
+        trailing = true;
+
+#ifdef FASTCSV2JSONXX_LATENCY
+      // the records of a chunk share its arrival
+      if (data.instrumented && !literal && chunk->records != 0)
+      {
+        const std::uint64_t latency =
+          std::chrono::duration_cast<std::chrono::nanoseconds>
+          (std::chrono::steady_clock::now () - chunk->arrival).count ();
+        HistogramRecord (*data.stats.blocklatency, latency);
+        for (auto sample = chunk->records / LATENCY_SAMPLE; sample != 0; sample--)
+          HistogramRecord (*data.stats.recordlatency, latency);
+      }
+#endif
+    }
+
+    if (!literal && chunk->error != "")
+    {
+      ParallelFail (parallel, chunk->error);
+      failed = true;
+    }
+    if (parallel.failed.load (std::memory_order_relaxed))
+      failed = true;
+
+    // the buffers are written, wake the threads stalled on the pool
+    BufferRelease (parallel.pool, *chunk);
+    ParallelRelease (parallel, chunk);
+    parallel.pool.next.store (next + 1, std::memory_order_release);
+    parallel.pool.released.fetch_add (1, std::memory_order_release);
+    parallel.pool.released.notify_all ();
+    Lap (writer, STAGE_WRITE);
+  }
+
+  StatsSplitHardware (writer.stats);
+}
+
+// move the complete lines of the input into a chunk, reading a block
+// first. The chunk's former buffer becomes the reader buffer, holding
+// the partial last line
+// returns: false at the end of the input
+static bool
+ChunkRead (CData & data, Chunk & chunk)
+{
+  auto & reader = data.reader;
+  std::size_t length;
+
+  for (;;)
+  {
+    const char *begin = reader.buffer.data () + reader.begin;
+    const auto available = reader.end - reader.begin;
+
+    if (reader.eof)
+    {
+      if (available == 0)
+        return false;
+      length = available;
+      break;
+    }
+
+    if (available >= reader.blocksize)
+    {
+      const auto *last = static_cast<const char *> (memrchr (begin, '\n', available));
+      if (last != nullptr)
+      {
+        length = last - begin + 1;
+        break;
+      }
+    }
+
+    ReaderFill (reader, data.stats, data.instrumented);
+  }
+
+  chunk.csv.swap (reader.buffer);
+  chunk.begin = reader.begin;
+  chunk.end = reader.begin + length;
+
+  const auto tail = reader.end - chunk.end;
+  if (reader.buffer.size () < std::max (tail, reader.blocksize * 2))
+    reader.buffer.resize (std::max (tail, reader.blocksize * 2));
+  std::memcpy (reader.buffer.data (), chunk.csv.data () + chunk.end, tail);
+  reader.begin = 0;
+  reader.end = tail;
+
+  return true;
+}
+
+// set the ranges and start values of --auto-tune. Decoders are only
+// climbed when a zip archive is among the inputs
+static void
+TuneStart (const CData & data, Parallel & parallel)
+{
+  auto & tuner = parallel.tuner;
+  tuner.enabled = data.autotune;
+  if (!tuner.enabled)
+    return;
+
+  const unsigned block = std::bit_width (data.reader.blocksize) - 1;
+  tuner.low[TUNE_BLOCK] = std::min (block, TUNE_BLOCK_MIN);
+  tuner.high[TUNE_BLOCK] =
+    std::max (block, std::min<unsigned> (TUNE_BLOCK_MAX, std::bit_width (BlockFits (data)) - 1));
+  tuner.value[TUNE_BLOCK] = block;
+
+  tuner.low[TUNE_WORKERS] = 1;
+  tuner.high[TUNE_WORKERS] = tuner.value[TUNE_WORKERS] = parallel.active;
+
+  const unsigned decoders = data.decoders;
+  tuner.low[TUNE_DECODERS] = tuner.high[TUNE_DECODERS] = tuner.value[TUNE_DECODERS] = decoders;
+  if (std::ranges::any_of (data.infilepaths, [] (const std::string & path)
+  {
+    return ArchiveProbe (path) == ARCHIVE_ZIP;
+  }))
+  {
+    tuner.low[TUNE_DECODERS] = 1;
+    tuner.high[TUNE_DECODERS] = decoders * 2;
+  }
+
+  tuner.bestvalue = tuner.value;
+  tuner.windowstart = std::chrono::steady_clock::now ();
+}
+
+// give up the direction of the climbed parameter, and the parameter
+// after both directions
+static void
+TuneReverse (Tuner & tuner) noexcept
+{
+  tuner.direction = -tuner.direction;
+  if (++tuner.reversals == 2)
+  {
+    tuner.parameter = (tuner.parameter + 1) % TUNE_COUNT;
+    tuner.direction = 1;
+    tuner.reversals = 0;
+  }
+}
+
+// next values to measure: one step from the best values, settling when
+// no parameter can step
+static void
+TuneMove (Tuner & tuner) noexcept
+{
+  for (unsigned tries = 0; tries < 2 * TUNE_COUNT; tries++)
+  {
+    const auto next = static_cast<int> (tuner.bestvalue[tuner.parameter]) + tuner.direction;
+    if (next >= static_cast<int> (tuner.low[tuner.parameter]) &&
+        next <= static_cast<int> (tuner.high[tuner.parameter]))
+    {
+      tuner.value = tuner.bestvalue;
+      tuner.value[tuner.parameter] = next;
+      return;
+    }
+    TuneReverse (tuner);
+  }
+
+  tuner.value = tuner.bestvalue;
+  tuner.settled = true;
+}
+
+// put the values being measured into effect. The read block applies
+// from the next chunk, the decoders from the next zip member
+static void
+TuneApply (CData & data, Parallel & parallel)
+{
+  const auto & tuner = parallel.tuner;
+  data.reader.blocksize = std::size_t (1) << tuner.value[TUNE_BLOCK];
+
+  data.decoders = tuner.value[TUNE_DECODERS];
+  if (data.reader.archive != nullptr)
+    data.reader.archive->window = data.decoders;
+
+  {
+    const std::lock_guard<std::mutex> lock (parallel.mutex);
+    parallel.active = tuner.value[TUNE_WORKERS];
+  }
+  parallel.workready.notify_all ();
+}
+
+// account a queued chunk to the measurement window and step the climber
+// when the window is full. The first window warms the engine up and is
+// not compared. Chunks queue no faster than the workers and the writer
+// free them, so the reader rate is the engine throughput
+static void
+TuneStep (CData & data, Parallel & parallel, std::uint64_t bytes)
+{
+  auto & tuner = parallel.tuner;
+  if (!tuner.enabled || tuner.settled) [[likely]]
+    return;
+
+  tuner.windowbytes += bytes;
+  if (tuner.windowbytes < TUNE_WINDOW)
+    return;
+
+  const auto now = std::chrono::steady_clock::now ();
+  const double
+  seconds = std::chrono::duration<double> (now - tuner.windowstart).count (),
+  throughput = seconds > 0 ? tuner.windowbytes / seconds : 0.0;
+
+  tuner.measured += tuner.windowbytes;
+  tuner.windowbytes = 0;
+  tuner.windowstart = now;
+
+  if (!tuner.warm)
+  {
+    tuner.warm = true;
+    return;
+  }
+
+  if (tuner.steps++ == 0 || throughput > tuner.best * TUNE_GAIN)
+  {
+    tuner.best = throughput;
+    tuner.bestvalue = tuner.value;
+    tuner.failures = 0;
+  }
+  else
+  {
+    tuner.failures++;
+    TuneReverse (tuner);
+  }
+
+  if (tuner.measured >= TUNE_BUDGET || tuner.failures == 2 * TUNE_COUNT)
+  {
+    tuner.value = tuner.bestvalue;
+    tuner.settled = true;
+  }
+  else
+    TuneMove (tuner);
+
+  TuneApply (data, parallel);
+}
+
+// --auto-tune outcome for --stats
+static std::string
+TuneReport (const Parallel & parallel)
+{
+  const auto & tuner = parallel.tuner;
+  std::ostringstream report;
+  report << "read block " << (std::size_t (1) << tuner.bestvalue[TUNE_BLOCK]) / 1024 << "K"
+         << ", workers " << tuner.bestvalue[TUNE_WORKERS] << " of " << tuner.high[TUNE_WORKERS];
+  if (tuner.low[TUNE_DECODERS] != tuner.high[TUNE_DECODERS])
+    report << ", zip decoders " << tuner.bestvalue[TUNE_DECODERS];
+  if (tuner.steps == 0)
+    report << ", input too short to measure";
+  else
+    report << ", " << tuner.steps << " measurements over " << (tuner.measured >> 20) << "M"
+           << ", best " << static_cast<std::uint64_t> (tuner.best / 1e6) << " MB/s";
+  return report.str ();
+}
+
+// convert the rest of the input on the workers, once its header is bound
+// returns: false when the conversion must stop, with data.error set
+static bool
+ParallelInput (CData & data, Parallel & parallel)
+{
+  WriteBlock (data);
+
+  auto plan = std::make_shared<InputPlan> ();
+  plan->keys = data.keys;
+  plan->validators = data.validators;
+  plan->rewrites = data.rewrites;
+  plan->hashes = data.hashes;
+  plan->permutation = data.permutation;
+  plan->validtokencount = data.validtokencount;
+  plan->inputname = data.inputname;
+  plan->archive = data.reader.archive;
+
+  // the json of a line is at most its keys, separator, closing and
+  // defaults, plus its value bytes grown by escapes and --replace, or 16
+  // hex digits for a --hash-col. A valid line has delimiter count plus
+  // one values, so without escapes and rules the bound is exact
+  std::uint64_t growth = data.escape ? 6 : 1, keybytes = 0, defaultbytes = 0;
+  for (const auto & rule : data.rewrites)
+    if (!rule.mask)
+      growth *= std::max<std::size_t> (rule.replacement.size (), 1);
+  for (const auto & key : data.keys)
+    keybytes += key.size ();
+  for (const auto & value : data.canonicaldefaults)
+    defaultbytes += value.size ();
+
+  parallel.linebound = (data.members == MEMBERS_NDJSON ? 1 : 2) + keybytes + 2 +
+                       growth * defaultbytes + 16 * data.hashes.size ();
+  parallel.valuefactor = growth;
+
+  const char delimiter = data.delimiter[0];
+  const bool delimiterkept =
+    std::ranges::find (data.replacewithspace, delimiter) == data.replacewithspace.end ();
+
+  while (!parallel.failed.load (std::memory_order_relaxed))
+  {
+    Lap (data, STAGE_READ);
+    Chunk *chunk = ParallelChunk (parallel);
+    Lap (data, STAGE_WAIT);
+    if (!ChunkRead (data, *chunk))
+    {
+      ParallelRelease (parallel, chunk);
+      break;
+    }
+
+    const char *begin = chunk->csv.data () + chunk->begin;
+    const char *end = chunk->csv.data () + chunk->end;
+    const std::uint64_t newlines = std::count (begin, end, '\n');
+    const std::uint64_t lines = newlines + (end[-1] != '\n');
+
+    chunk->plan = plan;
+    chunk->firstline = data.line_counter;
+    data.line_counter += lines;
+#ifdef FASTCSV2JSONXX_LATENCY
+    chunk->arrival = data.reader.arrival;
+#endif
+
+    if (parallel.map != nullptr)
+    {
+      const std::uint64_t delimiters = delimiterkept ? std::count (begin, end, delimiter) : 0;
+      ParallelReserve (parallel, *chunk, lines * parallel.linebound +
+                       (end - begin - newlines - delimiters) * parallel.valuefactor);
+    }
+    Lap (data, STAGE_READ);
+
+    {
+      const std::lock_guard<std::mutex> lock (parallel.mutex);
+      chunk->sequence = parallel.sequence ++;
+      parallel.work.push_back (chunk);
+    }
+    // a gated worker woken alone would swallow the wake up
+    if (parallel.active < parallel.workers.size ())
+      parallel.workready.notify_all ();
+    else
+      parallel.workready.notify_one ();
+
+    TuneStep (data, parallel, end - begin);
+  }
+
+  if (!parallel.failed.load ())
+    return true;
+
+  const std::lock_guard<std::mutex> lock (parallel.mutex);
+  data.error = parallel.error;
+  return false;
+}
+
+// start the workers and the writer. A regular -o file is written
+// through a mapping: chunks are converted into regions reserved for
+// them and moved together by the writer, without write calls
+static void
+ParallelStart (CData & data, Parallel & parallel)
+{
+  if (data.outfilepath != "" && data.shm == nullptr)
+  {
+    struct stat st;
+    parallel.fd = open (data.outfilepath.c_str (), O_RDWR | O_CLOEXEC);
+    if (parallel.fd != -1 && fstat (parallel.fd, &st) == 0 && S_ISREG (st.st_mode))
+    {
+      void *map = mmap (nullptr, MAP_WINDOW, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_NORESERVE, parallel.fd, 0);
+      if (map != MAP_FAILED)
+        parallel.map = static_cast<char *> (map);
+    }
+
+    if (parallel.map == nullptr && parallel.fd != -1)
+    {
+      close (parallel.fd);
+      parallel.fd = -1;
+    }
+  }
+
+  const unsigned chunks = data.threads * CHUNKS_PER_WORKER + 2;
+  parallel.completed = std::vector<CompletionSlot> (std::bit_ceil (chunks));
+  for (unsigned counter = 0; counter < chunks; counter++)
+  {
+    parallel.chunks.push_back (std::make_unique<Chunk> ());
+    parallel.free.push_back (parallel.chunks.back ().get ());
+  }
+
+  // enough buffers for the json of every chunk in flight, a block of
+  // csv rendering to about twice its size, plus a partly filled one and
+  // one kept free per chunk
+  for (unsigned counter = 0; counter < data.threads + 1; counter++)
+    parallel.pool.slots.push_back (std::make_unique<BufferSlot> ());
+  parallel.pool.capacity = chunks * (2 * data.reader.blocksize / OUTPUT_BUFFER_SIZE + 2);
+
+  for (unsigned counter = 0; counter < data.threads; counter++)
+  {
+    parallel.workerdata.push_back (std::make_unique<CData> ());
+    ParallelSetup (*parallel.workerdata.back (), data);
+    parallel.workerdata.back ()->pool = &parallel.pool;
+    parallel.workerdata.back ()->poolslot = counter;
+
+    if (data.metricsaddress != "")
+    {
+      const std::lock_guard<std::mutex> lock (metricsmutex);
+      metricsthreads.push_back (&parallel.workerdata.back ()->stats);
+    }
+  }
+
+  parallel.writerdata = std::make_unique<CData> ();
+  ParallelSetup (*parallel.writerdata, data);
+  if (data.metricsaddress != "")
+  {
+    const std::lock_guard<std::mutex> lock (metricsmutex);
+    metricsthreads.push_back (&parallel.writerdata->stats);
+  }
+
+  parallel.active = data.threads;
+  TuneStart (data, parallel);
+
+  for (unsigned counter = 0; counter < data.threads; counter++)
+    parallel.workers.emplace_back (ParallelWorker, std::ref (parallel),
+                                   std::ref (*parallel.workerdata[counter]), counter);
+  parallel.writer = std::thread (ParallelWriter, std::ref (parallel), std::ref (data));
+
+  data.parallel = &parallel;
+  WriteBlock (data);
+}
+
+// stop the engine after the last chunk, trim the mapped output and fold
+// the worker and writer statistics into data.stats
+// returns: false when a chunk or the output failed, with data.error set
+static bool
+ParallelStop (CData & data, Parallel & parallel)
+{
+  {
+    const std::lock_guard<std::mutex> lock (parallel.mutex);
+    parallel.stopping = true;
+    parallel.last.store (parallel.sequence, std::memory_order_release);
+  }
+  parallel.workready.notify_all ();
+  parallel.completions.fetch_add (1, std::memory_order_seq_cst);
+  parallel.completions.notify_all ();
+
+  for (auto & worker : parallel.workers)
+    worker.join ();
+  parallel.writer.join ();
+  data.parallel = nullptr;
+
+  if (parallel.tuner.enabled)
+    data.stats.tuning = TuneReport (parallel);
+  data.stats.buffercapacity = parallel.pool.capacity;
+  data.stats.bufferallocs = parallel.pool.allocated.load ();
+  data.stats.bufferstalls = parallel.pool.stalls.load ();
+
+  if (parallel.map != nullptr)
+  {
+    munmap (parallel.map, MAP_WINDOW);
+    if (ftruncate (parallel.fd, parallel.length) == -1)
+      ParallelFail (parallel, "Cannot write output file: " + data.outfilepath);
+    close (parallel.fd);
+  }
+
+  {
+    const std::lock_guard<std::mutex> lock (metricsmutex);
+    const auto
+    fold = [&] (Statistics & stats)
+    {
+      std::erase (metricsthreads, &stats);
+
+      Add (data.stats.records, stats.records.load (std::memory_order_relaxed));
+      Add (data.stats.badrows, stats.badrows.load (std::memory_order_relaxed));
+      Add (data.stats.bytes_in, stats.bytes_in.load (std::memory_order_relaxed));
+      Add (data.stats.bytes_out, stats.bytes_out.load (std::memory_order_relaxed));
+      for (unsigned stage = 0; stage < STAGE_COUNT; stage++)
+      {
+        data.stats.ns[stage] += stats.ns[stage];
+        for (unsigned counter = 0; counter < HW_COUNT; counter++)
+          data.stats.hw[stage][counter] += stats.hw[stage][counter];
+      }
+
+      // each thread counted its own events in its own counter group
+      if (stats.hardware)
+        StatsCloseHardware (stats);
+    };
+
+    for (const auto & worker : parallel.workerdata)
+      fold (worker->stats);
+    fold (parallel.writerdata->stats);
+  }
+
+  if (!parallel.failed.load ())
+    return true;
+
+  data.error = parallel.error;
+  return false;
+}
+
+// archives are written as json lines unless --members says otherwise
+static void
+MembersDefault (CData & data)
+{
+  if (!data.membersset &&
+      std::ranges::any_of (data.infilepaths, [] (const std::string & path)
+  {
+    return ArchiveProbe (path) != ARCHIVE_NONE;
+  }))
+    data.members = MEMBERS_NDJSON;
+}
+
+// convert every input to the output, the lines after each header on
+// worker threads with -j. os is the output file of --members split
+// returns: false on failure, with data.error set to the first error
+static bool
+ConvertInputs (CData & data, std::ofstream & os)
+{
+  // convert on worker threads. -j command line argument
+  Parallel parallel;
+  if (ParallelUsable (data))
+    ParallelStart (data, parallel);
+
+  std::string error = "";
+  InputCursor cursor;
+
+  // each input until eof or error
+  while (error == "" && InputNext (data, cursor))
+  {
+    // a json array file per input. --members split command line argument
+    if (data.members == MEMBERS_SPLIT)
+    {
+      os.close ();
+      os.open (SplitPath (data));
+      if (!os)
+      {
+        error = "Cannot open output file: " + SplitPath (data);
+        break;
+      }
+      data.outblock += '[';
+      data.written = 0;
+    }
+
+    while (GetLine (data))
+    {
+      if (data.instrumented) [[unlikely]]
+        Add (data.stats.bytes_in, data.inputline.size () + 1);
+      Lap (data, STAGE_READ);
+#ifdef FASTCSV2JSONXX_LATENCY
+      data.arrival = data.reader.arrival;
+#endif
+
+      if (!ConvertLine (data)) [[unlikely]]
+      {
+        error = data.error;
+        break;
+      }
+
+      // the lines after the header go to the workers
+      if (data.parallel != nullptr && !data.keys.empty ()) [[unlikely]]
+      {
+        if (!ParallelInput (data, parallel))
+          error = data.error;
+        break;
+      }
+
+      if (data.outblock.size () >= OUTPUT_BLOCK_SIZE)
+        WriteBlock (data);
+      Lap (data, STAGE_WRITE);
+    }
+
+    if (error == "" && !InputEnd (data)) [[unlikely]]
+      error = data.error;
+
+    if (data.members == MEMBERS_SPLIT)
+    {
+      data.outblock += ']';
+      WriteBlock (data);
+    }
+  }
+
+  if (error == "")
+    error = data.error;
+
+  // end json array and flush output buffer
+  if (!ConvertFinish (data) && error == "") [[unlikely]]
+    error = data.error;
+  WriteBlock (data);
+  if (data.parallel != nullptr && !ParallelStop (data, parallel) && error == "")
+    error = data.error;
+  Lap (data, STAGE_WRITE);
+
+  data.error = error;
+  return error == "";
+}
+
+// generate json
+// returns 0 on success, 1 otherwise
+[[maybe_unused]] static int
+GenerateJson (CData & data)
+{
+  MembersDefault (data);
+  if (data.members == MEMBERS_SPLIT && (data.outfilepath == "" || data.outfilepath.starts_with ("shm:")))
+  {
+    std::cerr << "--members split requires -o DIRECTORY" << '\n';
+    return 1;
+  }
+
+  // set output path. -o command line argument
+  std::ofstream os;
+  ShmRing shm;
+  if (data.outfilepath.starts_with ("shm:"))
+  {
+    const auto error = ShmOpen (shm, data.outfilepath.substr (4),
+                                data.shmsize != 0 ? data.shmsize : SHM_SIZE);
+    if (error != "")
+    {
+      std::cerr << "Cannot open shared memory output: " << data.outfilepath
+                << ": " << error << '\n';
+      return 1;
+    }
+    data.shm = &shm;
+  }
+  else if (data.outfilepath != "")
+  {
+    if (data.members != MEMBERS_SPLIT)
+      os.open (data.outfilepath);
+    data.out = &os;
+  }
+
+  // decouple iostream from stdio
+  std::ios::sync_with_stdio(false);
+  data.out->tie(nullptr);
+
+  if ((data.canonicalschema && !CanonicalSchema (data)) || !ConvertStart (data))
+  {
+    std::cerr << data.error << '\n';
+    ShmClose (shm, true);
+    return 1;
+  }
+
+  // pin the reader here, the workers and the writer as they start.
+  // --pin command line argument
+  if (data.pin != "")
+  {
+    const auto error = PinPlan (data, ParallelUsable (data));
+    if (error != "")
+    {
+      std::cerr << error << '\n';
+      ShmClose (shm, true);
+      return 1;
+    }
+    PinThread (data, ParallelUsable (data) ? data.threads : 0);
+  }
+
+  // serve metrics while converting. --metrics command line argument
+  MetricsServer metrics;
+  if (MetricsStart (data, metrics) != 0)
+  {
+    ShmClose (shm, true);
+    return 1;
+  }
+
+  int result = 0;
+  if (!ConvertInputs (data, os))
+  {
+    std::cerr << data.error << '\n';
+    result = 1;
+  }
+
+  if (data.shm != nullptr)
+    ShmClose (shm, result != 0);
+  else if (data.outfilepath != "")
+    os.close ();
+
+  MetricsStop (metrics);
+  StatsReport (data.stats);
+
+  if (data.tracepath != "" && TraceWrite (data.tracepath) != 0)
+    result = 1;
+
+  return result;
+}
+
+// help screen
+int
+Help (CData & data) noexcept
+{
+  std::cerr << "Usage: " << programname << " [OPTION]" << '\n';
+  std::cerr << "Convert csv to json array" << '\n' << '\n';
+  std::cerr << "Options:" << '\n' << '\n';
+  std::cerr <<
+            "-d, --delimiter            Delimiter as pipe, comma, semicolumn, column, space" << '\n' <<
+            "                           or tab. Default is comma" << '\n' <<
+            "-h, --help                 This help screen" << '\n' <<
+            "-i, --infile               Input file path, default STDIN. Can be used" << '\n' <<
+            "                           multiple times, the inputs are converted into one" << '\n' <<
+            "                           json array, each with its own header. Zip, tar" << '\n' <<
+            "                           and tar.gz files are read in place, each csv or" << '\n' <<
+            "                           tsv member being an input" << '\n' <<
+            "-o, --outfile              Output file path, default STDOUT. shm:/name" << '\n' <<
+            "                           writes to a shared memory ring for a consumer," << '\n' <<
+            "                           see fastcsv2json_shm.h" << '\n' <<
+            "-r, --replace-with-space   Replace comma, semicolumn, column, tab, backslash," << '\n' <<
+            "                           lf, cr, dquote, squote and slash characters of input" << '\n' <<
+            "                           with a space. Can be used multiple times" << '\n' <<
+            "-e, --erase-char           Remove comma, semicolumn, column, tab, backslash," << '\n' <<
+            "                           lf, cr, dquote, squote, slash and space characters" << '\n' <<
+            "                           from input. Can be used multiple times" << '\n' <<
+            "-j, --threads N            Convert on N worker threads, with a reader and a" << '\n' <<
+            "                           writer thread. A regular -o file is written" << '\n' <<
+            "                           through a memory mapping. Quoting dialects and" << '\n' <<
+            "                           --members split convert on one thread. Default" << '\n' <<
+            "                           is 1" << '\n' <<
+            "    --dialect NAME         Quoting and escaping rules, json escaping keys and" << '\n' <<
+            "                           values: tsv (tab, \\t \\n \\r \\\\ escapes), excel" << '\n' <<
+            "                           (rfc4180 with =\"text\" fields and a byte order" << '\n' <<
+            "                           mark), rfc4180 (comma, \"\" escapes inside quotes," << '\n' <<
+            "                           crlf) or unix (rfc4180 with backslash escapes, lf)." << '\n' <<
+            "                           -d overrides the delimiter" << '\n' <<
+            "    --comment-char CHAR    Skip lines starting with CHAR" << '\n' <<
+            "    --skip-lines N         Skip the first N lines of input, before the header." << '\n' <<
+            "                           Blank lines are always skipped" << '\n' <<
+            "    --header-row N         The header is line N, not counting skipped lines." << '\n' <<
+            "                           Lines before it are dropped. Default is 1" << '\n' <<
+            "    --header-rows N        The header spans N lines, keys join the non-empty" << '\n' <<
+            "                           cells of a column. Empty cells repeat the cell to" << '\n' <<
+            "                           their left, except in the last line. Default is 1" << '\n' <<
+            "    --header-join TEXT     Separator of joined header cells. Default is ." << '\n' <<
+            "    --members OUTPUT       Write the inputs as one json array (array), as" << '\n' <<
+            "                           json lines with a _file key naming the input" << '\n' <<
+            "                           (ndjson, the default for archives) or each to" << '\n' <<
+            "                           its own json array file in the -o directory" << '\n' <<
+            "                           (split)" << '\n' <<
+            "    --canonical-schema     Render every input with the same keys in the same" << '\n' <<
+            "                           order: the union of the input headers, read once" << '\n' <<
+            "                           before converting. Absent columns are empty" << '\n' <<
+            "    --column-default COL:VALUE" << '\n' <<
+            "                           Value of column COL where an input lacks it, with" << '\n' <<
+            "                           --canonical-schema. Can be used multiple times" << '\n' <<
+            "    --validate SCHEMA      Check fields against a json schema subset: type," << '\n' <<
+            "                           enum, pattern, minimum, maximum, minLength," << '\n' <<
+            "                           maxLength and required (non-empty)" << '\n' <<
+            "    --mask COL:REGEX       Replace every match of REGEX in column COL with" << '\n' <<
+            "                           asterisks. A leading ^ and a trailing $ anchor" << '\n' <<
+            "                           REGEX at the field start and end. Can be used" << '\n' <<
+            "                           multiple times" << '\n' <<
+            "    --replace COL:REGEX:TEXT" << '\n' <<
+            "                           Replace every match of REGEX in column COL with" << '\n' <<
+            "                           TEXT, anchored as --mask. Can be used multiple" << '\n' <<
+            "                           times" << '\n' <<
+            "    --hash-col COL[:ALGO]  Replace column COL with the hex of its keyed hash." << '\n' <<
+            "                           ALGO is siphash (siphash-2-4, default) or" << '\n' <<
+            "                           siphash13 (siphash-1-3). Can be used multiple times" << '\n' <<
+            "    --hash-key FILE        Hash key file of 32 hex digits, optionally" << '\n' <<
+            "                           followed by a newline, or of exactly 16 bytes" << '\n' <<
+            "    --bad-rows POLICY      Rows with a wrong field count or failing --validate" << '\n' <<
+            "                           are dropped (skip), dropped and printed to STDERR" << '\n' <<
+            "                           (report) or stop the conversion (abort)." << '\n' <<
+            "                           Default is skip" << '\n' <<
+            "    --shm-size SIZE        Ring size of -o shm:/name, K and M suffixes" << '\n' <<
+            "                           allowed. Default is 16M" << '\n' <<
+            "    --read-block SIZE      Input block size, K and M suffixes allowed." << '\n' <<
+            "                           Default is 1M" << '\n' <<
+            "    --read-depth N         Input blocks to read ahead. Default is 4" << '\n' <<
+            "    --batch N              Records tokenized, then validated, then rendered" << '\n' <<
+            "                           together. 1 converts a line at a time. Default" << '\n' <<
+            "                           is 1024" << '\n' <<
+            "    --auto-tune            Measure the throughput over the first 256M of" << '\n' <<
+            "                           input and climb the read block size, the -j" << '\n' <<
+            "                           workers converting and the zip members decoded" << '\n' <<
+            "                           ahead to the best. -j is the most workers, one" << '\n' <<
+            "                           per cpu if not given. --stats prints the outcome" << '\n' <<
+            "    --cgroup DIR           Read the cpu.max and memory.max limits from the" << '\n' <<
+            "                           cgroup v2 directory DIR. Default is the cgroup" << '\n' <<
+            "                           of the process and its ancestors. The cpus set" << '\n' <<
+            "                           the --auto-tune workers and the zip members" << '\n' <<
+            "                           decoded at once, the memory caps the default" << '\n' <<
+            "                           read block and the zip bytes decoded ahead." << '\n' <<
+            "                           --stats prints the limits" << '\n' <<
+            "    --pin MODE             Pin the -j workers, then the reader and the" << '\n' <<
+            "                           writer, to cpus. MODE is compact (a package" << '\n' <<
+            "                           at a time), scatter (packages in turn) or a" << '\n' <<
+            "                           cpu list as 0,2,4-7. compact and scatter use" << '\n' <<
+            "                           one thread of every core before smt siblings." << '\n' <<
+            "                           --stats prints the layout" << '\n' <<
+            "    --stats                Print record counts and time per conversion stage" << '\n' <<
+            "                           to STDERR" << '\n' <<
+            "    --stats=hw             As --stats, adding cycles, IPC, per byte costs," << '\n' <<
+            "                           branch, L1D, LLC and dTLB misses per stage." << '\n' <<
+            "                           Counters are read once per ms of work and" << '\n' <<
+            "                           split across the stages by their time" << '\n' <<
+            "    --trace FILE           Write conversion stage spans per thread to FILE" << '\n' <<
+            "                           as chrome trace event json, for perfetto" << '\n' <<
+            "    --metrics ADDRESS      Serve prometheus metrics while converting, on" << '\n' <<
+            "                           unix:/path or host:port" << '\n' <<
+            "-v, --version              Version information, license and copyright" << '\n' << '\n' <<
+            "example: " << programname << " -d pipe < myfile.csv > myfile.json" << '\n';
+
+  std::cerr << '\n';
+  return 1;
+}
+
+// hash function for std::string switch
+constexpr unsigned int
+hash(const char *s, int off = 0) noexcept
+{
+  return !s[off] ? 5381 : (hash(s, off+1)*33) ^ s[off];
+}
+
+// parse a size with an optional K or M suffix
+// returns: the size, 0 on error
+static std::size_t
+ParseSize (const std::string & argument) noexcept
+{
+  std::size_t size = 0, position = 0;
+
+  try
+  {
+    size = std::stoul (argument, &position);
+  }
+  catch (...)
+  {
+    return 0;
+  }
+
+  const auto suffix = argument.substr (position);
+  if (suffix == "K" || suffix == "k")
+    size <<= 10;
+  else if (suffix == "M" || suffix == "m")
+    size <<= 20;
+  else if (suffix != "")
+    return 0;
+
+  return size;
+}
+
+// parse command line arguments
+static int
+ParseArguments (int argc, char *argv[], CData & data)
+{
+  std::vector<std::string> argument;
+
+  for (int c = 0; c < argc; c++)
+    argument.push_back (std::string (argv[c]));
+
+  int result = 0, counter = 1;
+  bool delimiterset = false;						// -d given
+  bool threadsset = false;							// -j given
+  bool blockset = false;							// --read-block given
+  std::string_view dialectdelimiter = "";			// --dialect default delimiter
+
+  while (counter < argc)
+  {
+    if (argument.at (counter) == "-d" ||
+             argument.at (counter) == "--delimiter") // delimiter
+    {
+      counter ++;
+      delimiterset = true;
+      if (counter < argc)
+      {
+        switch (hash (argv[counter]))
+        {
+        case hash ("pipe") :
+          data.delimiter = "|";
+          break;
+        case hash ("comma") :
+          data.delimiter = ",";
+          break;
+        case hash ("semicolumn") :
+          data.delimiter = ";";
+          break;
+        case hash ("column") :
+          data.delimiter = ":";
+          break;
+        case hash ("space") :
+          data.delimiter = " ";
           break;
         case hash ("tab") :
           data.delimiter = "\t";
@@ -316,119 +6694,475 @@ ParseArguments (int argc, char *argv[], CData & data)
         }
       }
     }
-    else if (argument.at (counter) == "-i" ||
-             argument.at (counter) == "--infile")	// input file
+    else if (argument.at (counter) == "-i" ||
+             argument.at (counter) == "--infile")	// input file
+    {
+      counter ++;
+      if (counter < argc)
+        data.infilepaths.push_back (argument.at (counter));
+    }
+    else if (argument.at (counter) == "-o" ||
+             argument.at (counter) == "--outfile" ||
+             argument.at (counter) == "--output")	// output file
+    {
+      counter ++;
+      if (counter < argc)
+        data.outfilepath = argument.at (counter);
+    }
+    else if (argument.at (counter) == "-r" ||
+             argument.at (counter) == "--replace-with-space")	// character from input
+      // to replace with space
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        switch (hash (argv[counter]))
+        {
+        case hash ("pipe") :
+          data.replacewithspace.push_back ('|');
+          break;
+        case hash ("comma") :
+          data.replacewithspace.push_back (',');
+          break;
+        case hash ("semicolumn") :
+          data.replacewithspace.push_back (';');
+          break;
+        case hash ("column") :
+          data.replacewithspace.push_back (':');
+          break;
+        case hash ("tab") :
+          data.replacewithspace.push_back (9);
+          break;
+        case hash ("backslash") :
+          data.replacewithspace.push_back ('\\');
+          break;
+        case hash ("lf") :
+          data.replacewithspace.push_back (10);
+          break;
+        case hash ("cr") :
+          data.replacewithspace.push_back (13);
+          break;
+        case hash ("squote") :
+          data.replacewithspace.push_back ('\'');
+          break;
+        case hash ("dquote") :
+          data.replacewithspace.push_back ('\"');
+          break;
+        case hash ("slash") :
+          data.replacewithspace.push_back ('/');
+          break;
+        default:
+          std::cerr << "Unknown character: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "-e" ||
+             argument.at (counter) == "--erase-char")	// character from input
+      // to erase
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        switch (hash (argv[counter]))
+        {
+        case hash ("pipe") :
+          data.erasechars.push_back ('|');
+          break;
+        case hash ("comma") :
+          data.erasechars.push_back (',');
+          break;
+        case hash ("semicolumn") :
+          data.erasechars.push_back (';');
+          break;
+        case hash ("column") :
+          data.erasechars.push_back (':');
+          break;
+        case hash ("space") :
+          data.erasechars.push_back (' ');
+          break;
+        case hash ("tab") :
+          data.erasechars.push_back (9);
+          break;
+        case hash ("backslash") :
+          data.erasechars.push_back ('\\');
+          break;
+        case hash ("lf") :
+          data.erasechars.push_back (10);
+          break;
+        case hash ("cr") :
+          data.erasechars.push_back (13);
+          break;
+        case hash ("squote") :
+          data.erasechars.push_back ('\'');
+          break;
+        case hash ("dquote") :
+          data.erasechars.push_back ('\"');
+          break;
+        case hash ("slash") :
+          data.erasechars.push_back ('/');
+          break;
+        default:
+          std::cerr << "Unknown character: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "--validate")	// schema
+    {
+      counter ++;
+      if (counter < argc)
+        data.schemapath = argument.at (counter);
+    }
+    else if (argument.at (counter) == "--mask" ||
+             argument.at (counter) == "--replace")	// column rewrite
+    {
+      const bool mask = argument.at (counter) == "--mask";
+      counter ++;
+      if (counter < argc)
+      {
+        Rewrite rule;
+        const auto error = RewriteCompile (argument.at (counter), mask, rule);
+        if (error != "")
+        {
+          std::cerr << "Invalid " << argument.at (counter - 1) << ' '
+                    << argument.at (counter) << ": " << error << '\n';
+          result = 1;
+        }
+        data.rewrites.push_back (std::move (rule));
+      }
+    }
+    else if (argument.at (counter) == "--hash-col")	// column to hash
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        HashRule rule;
+        const auto & spec = argument.at (counter);
+        const auto colon = spec.rfind (':');
+        rule.column = spec.substr (0, colon);
+        const auto algorithm = colon != std::string::npos ? spec.substr (colon + 1) : "siphash";
+
+        switch (hash (algorithm.c_str ()))
+        {
+        case hash ("siphash") :
+          break;
+        case hash ("siphash13") :
+          rule.crounds = 1;
+          rule.drounds = 3;
+          break;
+        default:
+          std::cerr << "Unknown hash algorithm: " << algorithm << '\n';
+          result = 1;
+        }
+        data.hashes.push_back (std::move (rule));
+      }
+    }
+    else if (argument.at (counter) == "--hash-key")	// hash key file
+    {
+      counter ++;
+      if (counter < argc)
+        data.hashkeypath = argument.at (counter);
+    }
+    else if (argument.at (counter) == "--dialect" ||
+             argument.at (counter).starts_with ("--dialect="))	// dialect
+    {
+      std::string name = "";
+      if (argument.at (counter) != "--dialect")
+        name = argument.at (counter).substr (10);
+      else if (++ counter < argc)
+        name = argument.at (counter);
+
+      data.escape = true;
+      dialectdelimiter = ",";
+      switch (hash (name.c_str ()))
+      {
+      case hash ("tsv") :
+        data.tokenizer = TokenizeDialect<DialectTsv>;
+        dialectdelimiter = "\t";
+        break;
+      case hash ("excel") :
+        data.tokenizer = TokenizeDialect<DialectExcel>;
+        break;
+      case hash ("rfc4180") :
+        data.tokenizer = TokenizeDialect<DialectRfc4180>;
+        break;
+      case hash ("unix") :
+        data.tokenizer = TokenizeDialect<DialectUnix>;
+        break;
+      default:
+        std::cerr << "Unknown dialect: " << name << '\n';
+        result = 1;
+      }
+    }
+    else if (argument.at (counter) == "--comment-char")	// comment lines
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        if (argument.at (counter).size () != 1)
+        {
+          std::cerr << "Invalid comment character: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+        else
+          data.commentchar = argument.at (counter)[0];
+      }
+    }
+    else if (argument.at (counter) == "--skip-lines")	// preamble lines
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        try
+        {
+          data.skiplines = std::stoul (argument.at (counter));
+        }
+        catch (...)
+        {
+          std::cerr << "Invalid line count: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "--header-row" ||
+             argument.at (counter) == "--header-rows")	// header position
+    {
+      const bool rows = argument.at (counter) == "--header-rows";
+      counter ++;
+      if (counter < argc)
+      {
+        unsigned long count = 0;
+        try
+        {
+          count = std::stoul (argument.at (counter));
+        }
+        catch (...)
+        {
+        }
+
+        if (count == 0 || count > MAX_TOKEN_COUNT)
+        {
+          std::cerr << "Invalid header line: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+        else if (rows)
+          data.headerrows = count;
+        else
+          data.headerrow = count;
+      }
+    }
+    else if (argument.at (counter) == "--header-join")	// header key separator
     {
       counter ++;
       if (counter < argc)
-        data.infilepath = argument.at (counter);
+        data.headerjoin = argument.at (counter);
     }
-    else if (argument.at (counter) == "-o" ||
-             argument.at (counter) == "--outfile")	// output file
+    else if (argument.at (counter) == "--canonical-schema")	// uniform columns
+    {
+      data.canonicalschema = true;
+    }
+    else if (argument.at (counter) == "--column-default")	// absent column value
     {
       counter ++;
       if (counter < argc)
-        data.outfilepath = argument.at (counter);
+      {
+        const auto & value = argument.at (counter);
+        const auto separator = value.find (':');
+        if (separator == std::string::npos || separator == 0)
+        {
+          std::cerr << "Invalid column default: " << value << '\n';
+          result = 1;
+        }
+        else
+          data.columndefaults.emplace_back (value.substr (0, separator),
+                                            value.substr (separator + 1));
+      }
     }
-    else if (argument.at (counter) == "-r" ||
-             argument.at (counter) == "--replace-with-space")	// character from input
-      // to replace with space
+    else if (argument.at (counter) == "--members")	// output per input
     {
       counter ++;
       if (counter < argc)
       {
+        data.membersset = true;
         switch (hash (argv[counter]))
         {
-        case hash ("pipe") :
-          data.replacewithspace.push_back ('|');
-          break;
-        case hash ("comma") :
-          data.replacewithspace.push_back (',');
-          break;
-        case hash ("semicolumn") :
-          data.replacewithspace.push_back (';');
+        case hash ("array") :
+          data.members = MEMBERS_ARRAY;
           break;
-        case hash ("column") :
-          data.replacewithspace.push_back (':');
-          break;
-        case hash ("tab") :
-          data.replacewithspace.push_back (9);
-          break;
-        case hash ("backslash") :
-          data.replacewithspace.push_back ('\\');
-          break;
-        case hash ("lf") :
-          data.replacewithspace.push_back (10);
-          break;
-        case hash ("cr") :
-          data.replacewithspace.push_back (13);
-          break;
-        case hash ("squote") :
-          data.replacewithspace.push_back ('\'');
-          break;
-        case hash ("dquote") :
-          data.replacewithspace.push_back ('\"');
+        case hash ("ndjson") :
+          data.members = MEMBERS_NDJSON;
           break;
-        case hash ("slash") :
-          data.replacewithspace.push_back ('/');
+        case hash ("split") :
+          data.members = MEMBERS_SPLIT;
           break;
         default:
-          std::cerr << "Unknown character: " << argument.at (counter) << '\n';
+          std::cerr << "Unknown members output: " << argument.at (counter) << '\n';
           result = 1;
         }
       }
     }
-    else if (argument.at (counter) == "-e" ||
-             argument.at (counter) == "--erase-char")	// character from input
-      // to erase
+    else if (argument.at (counter) == "--bad-rows")	// bad row policy
     {
       counter ++;
       if (counter < argc)
       {
         switch (hash (argv[counter]))
         {
-        case hash ("pipe") :
-          data.erasechars.push_back ('|');
-          break;
-        case hash ("comma") :
-          data.erasechars.push_back (',');
-          break;
-        case hash ("semicolumn") :
-          data.erasechars.push_back (';');
-          break;
-        case hash ("column") :
-          data.erasechars.push_back (':');
-          break;
-        case hash ("space") :
-          data.erasechars.push_back (' ');
-          break;
-        case hash ("tab") :
-          data.erasechars.push_back (9);
-          break;
-        case hash ("backslash") :
-          data.erasechars.push_back ('\\');
-          break;
-        case hash ("lf") :
-          data.erasechars.push_back (10);
-          break;
-        case hash ("cr") :
-          data.erasechars.push_back (13);
+        case hash ("skip") :
+          data.badrows = BADROWS_SKIP;
           break;
-        case hash ("squote") :
-          data.erasechars.push_back ('\'');
-          break;
-        case hash ("dquote") :
-          data.erasechars.push_back ('\"');
+        case hash ("report") :
+          data.badrows = BADROWS_REPORT;
           break;
-        case hash ("slash") :
-          data.erasechars.push_back ('/');
+        case hash ("abort") :
+          data.badrows = BADROWS_ABORT;
           break;
         default:
-          std::cerr << "Unknown character: " << argument.at (counter) << '\n';
+          std::cerr << "Unknown bad row policy: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "--shm-size")	// shared memory ring size
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        data.shmsize = ParseSize (argument.at (counter));
+        if (data.shmsize == 0)
+        {
+          std::cerr << "Invalid ring size: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "--read-block")	// input block size
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        data.reader.blocksize = ParseSize (argument.at (counter));
+        blockset = true;
+        if (data.reader.blocksize == 0)
+        {
+          std::cerr << "Invalid block size: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "-j" ||
+             argument.at (counter) == "--threads")	// worker threads
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        try
+        {
+          data.threads = std::stoul (argument.at (counter));
+        }
+        catch (...)
+        {
+          data.threads = 0;
+        }
+        if (data.threads == 0)
+        {
+          std::cerr << "Invalid thread count: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+        threadsset = true;
+      }
+    }
+    else if (argument.at (counter) == "--batch")	// records per batch
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        try
+        {
+          data.batchrecords = std::stoul (argument.at (counter));
+        }
+        catch (...)
+        {
+          data.batchrecords = 0;
+        }
+        if (data.batchrecords == 0)
+        {
+          std::cerr << "Invalid batch size: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "--auto-tune")	// tune while converting
+    {
+      data.autotune = true;
+    }
+    else if (argument.at (counter) == "--cgroup")	// cgroup of the limits
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        struct stat st;
+        data.cgrouppath = argument.at (counter);
+        if (stat (data.cgrouppath.c_str (), &st) != 0 || !S_ISDIR (st.st_mode))
+        {
+          std::cerr << "Invalid cgroup directory: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "--pin")	// pin threads to cpus
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        std::vector<int> cpus;
+        data.pin = argument.at (counter);
+        if (data.pin != "compact" && data.pin != "scatter" && !CpuList (data.pin, cpus))
+        {
+          std::cerr << "Invalid pinning: " << argument.at (counter) << '\n';
+          result = 1;
+        }
+      }
+    }
+    else if (argument.at (counter) == "--read-depth")	// blocks to read ahead
+    {
+      counter ++;
+      if (counter < argc)
+      {
+        try
+        {
+          data.reader.depth = std::stoul (argument.at (counter));
+        }
+        catch (...)
+        {
+          std::cerr << "Invalid read depth: " << argument.at (counter) << '\n';
           result = 1;
         }
       }
     }
+    else if (argument.at (counter) == "--stats")	// statistics
+    {
+      data.stats.enabled = true;
+    }
+    else if (argument.at (counter) == "--stats=hw")	// statistics and
+      // hardware counters
+    {
+      data.stats.enabled = true;
+      data.stats.hardware = true;
+    }
+    else if (argument.at (counter) == "--trace")	// trace file
+    {
+      counter ++;
+      if (counter < argc)
+        data.tracepath = argument.at (counter);
+    }
+    else if (argument.at (counter) == "--metrics")	// metrics address
+    {
+      counter ++;
+      if (counter < argc)
+        data.metricsaddress = argument.at (counter);
+    }
     else if (argument.at (counter) == "-h" ||
              argument.at (counter) == "--help")	// help
     {
@@ -461,9 +7195,227 @@ ParseArguments (int argc, char *argv[], CData & data)
     counter ++;
   }
 
+  data.skipping = data.skiplines != 0 || data.commentchar != 0;
+
+  // --auto-tune climbs up to a worker per cpu unless -j caps it, the zip
+  // members are decoded ahead a cpu each, the default read block keeps
+  // the -j chunks within the memory limit
+  ResourceLimits (data);
+  if (data.autotune && !threadsset)
+    data.threads = data.cpus;
+  if (data.decoders == 0)
+    data.decoders = std::max (2u, data.cpus);
+  if (!blockset)
+    data.reader.blocksize = std::min (data.reader.blocksize, BlockFits (data));
+
+  // a --dialect picks the delimiter unless -d does
+  if (dialectdelimiter != "" && !delimiterset)
+    data.delimiter = dialectdelimiter;
+
   return result;
 }
 
+// engine of the push converter
+struct fastcsv2jsonxx::Converter::Engine
+{
+  CData data;										// conversion data
+  std::string partial = "";							// partial last line fed
+  bool finished = false;							// Finish was called
+};
+
+// parse library options, as on the command line without the program
+// name
+// returns: false with data.error set on invalid options
+static bool
+ParseOptions (const std::vector<std::string> & options, CData & data)
+{
+  std::vector<std::string> arguments = { programname };
+  arguments.insert (arguments.end (), options.begin (), options.end ());
+  std::vector<char *> argv;
+  for (auto & argument : arguments)
+    argv.push_back (argument.data ());
+  argv.push_back (nullptr);
+
+  if (ParseArguments (static_cast<int> (arguments.size ()), argv.data (), data) != 0)
+  {
+    data.error = "Invalid options";
+    return false;
+  }
+  return true;
+}
+
+fastcsv2jsonxx::Converter::Converter (const std::vector<std::string> & options)
+  : engine (std::make_unique<Engine> ())
+{
+  auto & data = engine->data;
+
+  // the -j engine reads its own input, fed bytes convert on the caller's
+  // thread
+  if (!ParseOptions (options, data))
+    return;
+  if (data.threads > 1 || data.autotune)
+    data.error = "-j and --auto-tune are not supported by the push converter";
+  else
+    ConvertStart (data);
+}
+
+fastcsv2jsonxx::Converter::~Converter () = default;
+
+bool
+fastcsv2jsonxx::Converter::Feed (std::string_view bytes)
+{
+  auto & data = engine->data;
+  if (data.error != "" || engine->finished)
+    return false;
+
+  while (!bytes.empty ())
+  {
+    const auto *newline =
+      static_cast<const char *> (std::memchr (bytes.data (), '\n', bytes.size ()));
+    if (newline == nullptr)
+    {
+      engine->partial.append (bytes);
+      break;
+    }
+
+    const auto length = static_cast<std::size_t> (newline - bytes.data ());
+    bool converted;
+    if (engine->partial.empty ())
+      converted = ConvertFedLine (data, bytes.substr (0, length));
+    else
+    {
+      engine->partial.append (bytes.substr (0, length));
+      converted = ConvertFedLine (data, engine->partial);
+      engine->partial.clear ();
+    }
+
+    bytes.remove_prefix (length + 1);
+    if (!converted)
+      return false;
+  }
+
+  return true;
+}
+
+bool
+fastcsv2jsonxx::Converter::Finish ()
+{
+  auto & data = engine->data;
+  if (data.error != "" || engine->finished)
+    return false;
+
+  if (!engine->partial.empty () && !ConvertFedLine (data, engine->partial))
+    return false;
+  engine->partial.clear ();
+
+  const auto complete = ConvertFinish (data);
+  StatsReport (data.stats);
+  engine->finished = true;
+
+  return complete;
+}
+
+void
+fastcsv2jsonxx::Converter::Fail (std::string_view reason)
+{
+  engine->data.error = reason.empty () ? "Conversion failed" : reason;
+}
+
+std::string
+fastcsv2jsonxx::Converter::Take ()
+{
+  std::string block;
+  block.swap (engine->data.outblock);
+  engine->data.outblock.reserve (OUTPUT_BLOCK_SIZE + STRING_RESERVE_SIZE * 4);
+  return block;
+}
+
+std::size_t
+fastcsv2jsonxx::Converter::Pending () const noexcept
+{
+  return engine->data.outblock.size ();
+}
+
+const std::string &
+fastcsv2jsonxx::Converter::Error () const noexcept
+{
+  return engine->data.error;
+}
+
+// convert a whole input into json with the command line engine, the -j
+// reader, workers and writer included. The output goes to a string
+// stream that rethrows the allocation failures of the calling thread
+// returns: false on failure, with data.error set
+static bool
+ConvertWhole (CData & data, std::string & json)
+{
+  data.outfilepath = "";
+  data.tracepath = "";
+  data.metricsaddress = "";
+  MembersDefault (data);
+  if (data.members == MEMBERS_SPLIT)
+  {
+    data.error = "--members split is not supported by the library";
+    return false;
+  }
+
+  std::ostringstream stream;
+  stream.exceptions (std::ios::badbit);
+  std::ofstream os;
+  data.out = &stream;
+
+  if ((data.canonicalschema && !CanonicalSchema (data)) || !ConvertStart (data))
+    return false;
+
+  const bool complete = ConvertInputs (data, os);
+  StatsReport (data.stats);
+  json = std::move (stream).str ();
+
+  return complete;
+}
+
+bool
+fastcsv2jsonxx::Convert (std::string_view csv, const std::vector<std::string> & options,
+                         std::string & json, std::string & error)
+{
+  CData data;
+  if (ParseOptions (options, data))
+  {
+    data.infilepaths.clear ();
+    data.reader.memory = true;
+    data.reader.bytes = csv;
+    ConvertWhole (data, json);
+  }
+
+  error = data.error;
+  return error == "";
+}
+
+bool
+fastcsv2jsonxx::ConvertFile (const std::string & path, const std::vector<std::string> & options,
+                             std::string & json, std::string & error)
+{
+  CData data;
+  if (ParseOptions (options, data))
+  {
+    data.infilepaths = { path };
+    ConvertWhole (data, json);
+  }
+
+  error = data.error;
+  return error == "";
+}
+
+std::string_view
+fastcsv2jsonxx::Version () noexcept
+{
+  static const std::string version = std::to_string (VERSION_MAJOR) + '.' +
+                                     std::to_string (VERSION_MINOR) + '.' +
+                                     std::to_string (VERSION_PATCH);
+  return version;
+}
+
+#ifndef FASTCSV2JSONXX_LIBRARY
 // returns 0 on success, a positive int otherwise
 int
 main (int argc, char *argv[])
@@ -473,3 +7425,4 @@ main (int argc, char *argv[])
   auto result = ParseArguments (argc, argv, data);
   return result != 0 ? result : GenerateJson (data);
 }
+#endif
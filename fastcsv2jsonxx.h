@@ -0,0 +1,96 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+//
+// fastcsv2json++:
+// incremental conversion interface of the converter engine,
+// built into libfastcsv2jsonxx.a by make lib
+//
+// Copyright © 2024 Lucas Tsatiris. All rights reserved.
+//
+
+#ifndef FASTCSV2JSONXX_H
+#define FASTCSV2JSONXX_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fastcsv2jsonxx
+{
+
+// push converter: feed csv bytes in pieces of any size, take the json
+// produced so far. Not thread safe, one converter per conversion
+class Converter
+{
+public:
+  // options as on the command line, without the program name. Input,
+  // output, --metrics and --trace options are ignored, -j and
+  // --auto-tune fail the converter, see Error () and Convert ()
+  explicit Converter (const std::vector<std::string> & options = {});
+  ~Converter ();
+
+  Converter (const Converter &) = delete;
+  Converter & operator = (const Converter &) = delete;
+
+  // convert the complete lines in bytes, keeping a partial last line
+  // returns: false on error, see Error ()
+  bool Feed (std::string_view bytes);
+
+  // convert the partial last line and end the json array
+  // returns: false on error, see Error ()
+  bool Finish ();
+
+  // stop the conversion with an error, Feed and Finish fail afterwards
+  void Fail (std::string_view reason);
+
+  // take the json produced since the last call
+  std::string Take ();
+
+  // size of the json waiting to be taken
+  std::size_t Pending () const noexcept;
+
+  // why the conversion stopped, empty when it did not
+  const std::string & Error () const noexcept;
+
+private:
+  struct Engine;
+  std::unique_ptr<Engine> engine;
+};
+
+// convert a whole csv input into json, as the command line does: with
+// -j the input is read, converted and written on threads of their own
+// while the caller waits. Options are as for the Converter, -j and
+// --auto-tune included, -i options are ignored
+// returns: false on error, with error set
+bool Convert (std::string_view csv, const std::vector<std::string> & options,
+              std::string & json, std::string & error);
+
+// as Convert, the input the csv file or the zip, tar or tar.gz archive
+// at path
+// returns: false on error, with error set
+bool ConvertFile (const std::string & path, const std::vector<std::string> & options,
+                  std::string & json, std::string & error);
+
+// engine version as major.minor.patch
+std::string_view Version () noexcept;
+
+} // namespace fastcsv2jsonxx
+
+#endif // FASTCSV2JSONXX_H
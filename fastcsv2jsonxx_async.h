@@ -0,0 +1,358 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+//
+// fastcsv2json++:
+// c++20 coroutine interface: an epoll executor and an async generator
+// of json blocks read from a non blocking file descriptor
+//
+// Copyright © 2024 Lucas Tsatiris. All rights reserved.
+//
+
+#ifndef FASTCSV2JSONXX_ASYNC_H
+#define FASTCSV2JSONXX_ASYNC_H
+
+#include "fastcsv2jsonxx.h"
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace fastcsv2jsonxx
+{
+
+// single threaded executor: resumes coroutines waiting for readiness of
+// file descriptors and coroutines scheduled to run again
+class EpollExecutor
+{
+public:
+  EpollExecutor () : epollfd (epoll_create1 (EPOLL_CLOEXEC))
+  {
+    if (epollfd == -1)
+      throw std::runtime_error (std::strerror (errno));
+  }
+
+  ~EpollExecutor () { close (epollfd); }
+
+  EpollExecutor (const EpollExecutor &) = delete;
+  EpollExecutor & operator = (const EpollExecutor &) = delete;
+
+  // awaitable readiness of a file descriptor
+  struct Awaiter
+  {
+    EpollExecutor & executor;
+    int fd;
+    std::uint32_t events;
+
+    bool await_ready () const noexcept { return false; }
+    void await_suspend (std::coroutine_handle<> handle)
+    {
+      executor.Wait (fd, events, handle);
+    }
+    void await_resume () const noexcept {}
+  };
+
+  // awaitable turn on the run queue
+  struct Yield
+  {
+    EpollExecutor & executor;
+
+    bool await_ready () const noexcept { return false; }
+    void await_suspend (std::coroutine_handle<> handle)
+    {
+      executor.Schedule (handle);
+    }
+    void await_resume () const noexcept {}
+  };
+
+  Awaiter Readable (int fd) { return { *this, fd, EPOLLIN }; }
+  Awaiter Writable (int fd) { return { *this, fd, EPOLLOUT }; }
+  Yield Next () { return { *this }; }
+
+  // run handle on the next turn of the loop
+  void Schedule (std::coroutine_handle<> handle) { ready.push_back (handle); }
+
+  // stop watching fd, call before closing it. A coroutine still waiting
+  // for fd, or scheduled by its readiness, is dropped and never resumed
+  void Forget (int fd)
+  {
+    const auto found = registered.find (fd);
+    if (found == registered.end ())
+      return;
+
+    if (found->second.armed)
+      waiting --;
+    std::erase (ready, found->second.handle);
+    epoll_ctl (epollfd, EPOLL_CTL_DEL, fd, nullptr);
+    registered.erase (found);
+  }
+
+  // resume coroutines until none is waiting
+  void Run ()
+  {
+    std::vector<epoll_event> events (64);
+
+    while (!ready.empty () || waiting != 0)
+    {
+      while (!ready.empty ())
+      {
+        auto handle = ready.front ();
+        ready.pop_front ();
+        handle.resume ();
+      }
+
+      if (waiting == 0)
+        break;
+
+      const auto count =
+        epoll_wait (epollfd, events.data (), static_cast<int> (events.size ()), -1);
+      if (count == -1)
+      {
+        if (errno == EINTR)
+          continue;
+        throw std::runtime_error (std::strerror (errno));
+      }
+
+      for (int counter = 0; counter < count; counter ++)
+      {
+        auto & registration = registered.at (events[counter].data.fd);
+        registration.armed = false;
+        waiting --;
+        ready.push_back (registration.handle);
+      }
+    }
+  }
+
+private:
+  // one shot registration, re-armed by every wait
+  void Wait (int fd, std::uint32_t events, std::coroutine_handle<> handle)
+  {
+    epoll_event event {};
+    event.events = events | EPOLLONESHOT;
+    event.data.fd = fd;
+
+    const auto operation = registered.contains (fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl (epollfd, operation, fd, &event) == 0)
+    {
+      registered[fd] = { handle, true };
+      waiting ++;
+      return;
+    }
+
+    // regular files are always ready and cannot be watched
+    if (errno == EPERM)
+    {
+      Schedule (handle);
+      return;
+    }
+
+    throw std::runtime_error (std::strerror (errno));
+  }
+
+  // coroutine of a file descriptor added to epoll
+  struct Registration
+  {
+    std::coroutine_handle<> handle;					// last coroutine waiting
+    bool armed = false;								// waiting, the event not seen
+  };
+
+  int epollfd;										// epoll instance
+  std::size_t waiting = 0;							// coroutines waiting for events
+  std::deque<std::coroutine_handle<>> ready;		// run queue
+  std::unordered_map<int, Registration> registered;	// file descriptors added
+};
+
+// eager, detached coroutine, for the consumers of AsyncGenerator
+struct Task
+{
+  struct promise_type
+  {
+    Task get_return_object () noexcept { return {}; }
+    std::suspend_never initial_suspend () noexcept { return {}; }
+    std::suspend_never final_suspend () noexcept { return {}; }
+    void return_void () noexcept {}
+    void unhandled_exception () { std::terminate (); }
+  };
+};
+
+// lazy generator awaited from a coroutine: co_await generator.Next ()
+// yields the next value, or nothing when the generator returned
+template <typename T>
+class AsyncGenerator
+{
+public:
+  struct promise_type
+  {
+    std::optional<T> value;
+    std::coroutine_handle<> consumer;
+    std::exception_ptr exception;
+
+    AsyncGenerator get_return_object () noexcept
+    {
+      return AsyncGenerator (std::coroutine_handle<promise_type>::from_promise (*this));
+    }
+
+    std::suspend_always initial_suspend () noexcept { return {}; }
+
+    // resume the consumer waiting in Next ()
+    struct Transfer
+    {
+      bool await_ready () const noexcept { return false; }
+      std::coroutine_handle<> await_suspend (std::coroutine_handle<promise_type> handle) noexcept
+      {
+        return handle.promise ().consumer;
+      }
+      void await_resume () const noexcept {}
+    };
+
+    Transfer final_suspend () noexcept { return {}; }
+
+    Transfer yield_value (T next)
+    {
+      value.emplace (std::move (next));
+      return {};
+    }
+
+    void return_void () noexcept {}
+    void unhandled_exception () noexcept { exception = std::current_exception (); }
+  };
+
+  AsyncGenerator (AsyncGenerator && other) noexcept
+    : handle (std::exchange (other.handle, nullptr)) {}
+  AsyncGenerator & operator = (AsyncGenerator &&) = delete;
+  ~AsyncGenerator ()
+  {
+    if (handle)
+      handle.destroy ();
+  }
+
+  // awaitable next value
+  struct NextAwaiter
+  {
+    std::coroutine_handle<promise_type> handle;
+
+    bool await_ready () const noexcept { return handle.done (); }
+    std::coroutine_handle<> await_suspend (std::coroutine_handle<> consumer) noexcept
+    {
+      handle.promise ().consumer = consumer;
+      return handle;
+    }
+    std::optional<T> await_resume ()
+    {
+      auto & promise = handle.promise ();
+      if (promise.exception)
+        std::rethrow_exception (std::exchange (promise.exception, nullptr));
+
+      std::optional<T> result;
+      if (promise.value)
+      {
+        result.emplace (std::move (*promise.value));
+        promise.value.reset ();
+      }
+      return result;
+    }
+  };
+
+  NextAwaiter Next () { return { handle }; }
+
+private:
+  explicit AsyncGenerator (std::coroutine_handle<promise_type> coroutine)
+    : handle (coroutine) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+// convert the csv read from fd, yielding json blocks. fd is read only
+// while the consumer asks for blocks, so a slow consumer holds back the
+// producer instead of letting blocks pile up. Read errors stop the
+// converter, see converter.Error (). fd is non blocking while the
+// generator lives, executor must outlive it
+inline AsyncGenerator<std::string>
+ConvertAsync (EpollExecutor & executor, int fd, Converter & converter,
+              std::size_t readsize = 1 << 16)
+{
+  // give fd back as it was when the generator ends or is destroyed,
+  // also while waiting for fd
+  struct Restore
+  {
+    EpollExecutor & executor;
+    int fd;
+    int flags;
+
+    ~Restore ()
+    {
+      executor.Forget (fd);
+      if (flags != -1)
+        fcntl (fd, F_SETFL, flags);
+    }
+  };
+
+  const Restore restore { executor, fd, fcntl (fd, F_GETFL) };
+  if (restore.flags != -1)
+    fcntl (fd, F_SETFL, restore.flags | O_NONBLOCK);
+
+  std::string buffer (readsize, '\0');
+  bool converting = true;
+
+  while (converting)
+  {
+    const auto count = read (fd, buffer.data (), buffer.size ());
+    if (count == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        co_await executor.Readable (fd);
+        continue;
+      }
+      if (errno == EINTR)
+        continue;
+
+      converter.Fail (std::strerror (errno));
+      break;
+    }
+
+    if (count == 0)
+    {
+      converter.Finish ();
+      converting = false;
+    }
+    else
+      converting = converter.Feed (std::string_view (buffer.data (),
+                                                     static_cast<std::size_t> (count)));
+
+    if (converter.Pending () != 0)
+      co_yield converter.Take ();
+  }
+}
+
+} // namespace fastcsv2jsonxx
+
+#endif // FASTCSV2JSONXX_ASYNC_H
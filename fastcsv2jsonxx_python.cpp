@@ -0,0 +1,294 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+//
+// fastcsv2json++:
+// python module, built by make python
+//
+//   import fastcsv2jsonxx
+//   json = fastcsv2jsonxx.convert (b"a,b\n1,2\n", ["-d", "comma"])
+//   json = fastcsv2jsonxx.convert_file ("myfile.csv", ["-j", "4"])
+//   bytes (json), memoryview (json)
+//
+// Copyright © 2024 Lucas Tsatiris. All rights reserved.
+//
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "fastcsv2jsonxx.h"
+
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// json produced by a conversion, exported through the buffer protocol
+// without copying it
+struct Output
+{
+  PyObject_HEAD
+  std::string *json;
+};
+
+static void
+OutputDealloc (PyObject *self)
+{
+  delete reinterpret_cast<Output *> (self)->json;
+  Py_TYPE (self)->tp_free (self);
+}
+
+static int
+OutputGetBuffer (PyObject *self, Py_buffer *view, int flags)
+{
+  auto *json = reinterpret_cast<Output *> (self)->json;
+  return PyBuffer_FillInfo (view, self, json->data (),
+                            static_cast<Py_ssize_t> (json->size ()), 1, flags);
+}
+
+static Py_ssize_t
+OutputLength (PyObject *self)
+{
+  return static_cast<Py_ssize_t> (reinterpret_cast<Output *> (self)->json->size ());
+}
+
+static PyBufferProcs outputbuffer = { OutputGetBuffer, nullptr };
+
+static PySequenceMethods outputsequence = { OutputLength };
+
+static PyTypeObject outputtype = {
+  PyVarObject_HEAD_INIT (nullptr, 0)
+  "fastcsv2jsonxx.Output",							// tp_name
+  sizeof (Output),									// tp_basicsize
+};
+
+// returns: new Output owning json, nullptr on error
+static PyObject *
+OutputNew (std::string && json)
+{
+  auto *output = PyObject_New (Output, &outputtype);
+  if (output == nullptr)
+    return nullptr;
+
+  try
+  {
+    output->json = new std::string (std::move (json));
+  }
+  catch (const std::bad_alloc &)
+  {
+    output->json = nullptr;
+    Py_DECREF (output);
+    return PyErr_NoMemory ();
+  }
+
+  return reinterpret_cast<PyObject *> (output);
+}
+
+// options from a python sequence of str
+// returns: false with a python error set on failure
+static bool
+OptionsParse (PyObject *object, std::vector<std::string> & options)
+{
+  if (object == nullptr || object == Py_None)
+    return true;
+
+  PyObject *sequence = PySequence_Fast (object, "options must be a sequence of str");
+  if (sequence == nullptr)
+    return false;
+
+  const auto count = PySequence_Fast_GET_SIZE (sequence);
+  for (Py_ssize_t counter = 0; counter < count; counter ++)
+  {
+    PyObject *item = PySequence_Fast_GET_ITEM (sequence, counter);
+    Py_ssize_t size;
+    const char *text = PyUnicode_Check (item) ? PyUnicode_AsUTF8AndSize (item, &size) : nullptr;
+    if (text == nullptr)
+    {
+      Py_DECREF (sequence);
+      if (!PyErr_Occurred ())
+        PyErr_SetString (PyExc_TypeError, "options must be a sequence of str");
+      return false;
+    }
+    try
+    {
+      options.emplace_back (text, static_cast<std::size_t> (size));
+    }
+    catch (const std::bad_alloc &)
+    {
+      Py_DECREF (sequence);
+      PyErr_NoMemory ();
+      return false;
+    }
+  }
+
+  Py_DECREF (sequence);
+  return true;
+}
+
+// convert csv bytes, or the file at path when path is given, without
+// holding the gil. With -j the engine's reader, workers and writer run
+// on threads of their own. No c++ exception may leave the block, the
+// thread state is restored at its end
+// returns: json as an Output, nullptr with a python error set on failure
+static PyObject *
+Convert (std::string_view csv, const std::vector<std::string> & options,
+         const char *path = nullptr)
+{
+  std::string json, error;
+  bool nomemory = false;
+
+  Py_BEGIN_ALLOW_THREADS
+  try
+  {
+    if (path != nullptr)
+      fastcsv2jsonxx::ConvertFile (path, options, json, error);
+    else
+      fastcsv2jsonxx::Convert (csv, options, json, error);
+  }
+  catch (const std::bad_alloc &)
+  {
+    nomemory = true;
+  }
+  Py_END_ALLOW_THREADS
+
+  if (nomemory)
+    return PyErr_NoMemory ();
+
+  if (error != "")
+  {
+    PyErr_SetString (PyExc_ValueError, error.c_str ());
+    return nullptr;
+  }
+
+  return OutputNew (std::move (json));
+}
+
+PyDoc_STRVAR (convertdoc,
+"convert(data, options=None)\n--\n\n"
+"Convert csv in a bytes-like object to a json array. options are command\n"
+"line options such as [\"-d\", \"pipe\"] or [\"-j\", \"4\"], -j converting on\n"
+"threads of its own. The gil is released while converting. Returns an\n"
+"Output, a read only bytes-like object. Raises ValueError when the\n"
+"conversion fails, MemoryError when memory runs out.");
+
+static PyObject *
+ModuleConvert (PyObject *, PyObject *args, PyObject *kwargs)
+{
+  static const char *keywords[] = { "data", "options", nullptr };
+  Py_buffer csv;
+  PyObject *object = nullptr;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwargs, "y*|O", const_cast<char **> (keywords),
+                                    &csv, &object))
+    return nullptr;
+
+  std::vector<std::string> options;
+  PyObject *result = nullptr;
+  if (OptionsParse (object, options))
+    result = Convert (std::string_view (static_cast<const char *> (csv.buf),
+                                        static_cast<std::size_t> (csv.len)), options);
+
+  PyBuffer_Release (&csv);
+  return result;
+}
+
+PyDoc_STRVAR (convertfiledoc,
+"convert_file(path, options=None)\n--\n\n"
+"Convert the csv file, or the zip, tar or tar.gz archive at path to json,\n"
+"as convert(). Raises OSError when path cannot be opened.");
+
+static PyObject *
+ModuleConvertFile (PyObject *, PyObject *args, PyObject *kwargs)
+{
+  static const char *keywords[] = { "path", "options", nullptr };
+  PyObject *path;
+  PyObject *object = nullptr;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O&|O", const_cast<char **> (keywords),
+                                    PyUnicode_FSConverter, &path, &object))
+    return nullptr;
+
+  std::vector<std::string> options;
+  if (!OptionsParse (object, options))
+  {
+    Py_DECREF (path);
+    return nullptr;
+  }
+
+  // the engine opens the file again, an unreadable path raises as open ()
+  const int fd = open (PyBytes_AS_STRING (path), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    PyErr_SetFromErrnoWithFilenameObject (PyExc_OSError, path);
+    Py_DECREF (path);
+    return nullptr;
+  }
+  close (fd);
+
+  PyObject *result = Convert (std::string_view (), options, PyBytes_AS_STRING (path));
+  Py_DECREF (path);
+  return result;
+}
+
+static PyMethodDef modulemethods[] = {
+  { "convert", reinterpret_cast<PyCFunction> (reinterpret_cast<void (*) ()> (ModuleConvert)),
+    METH_VARARGS | METH_KEYWORDS, convertdoc },
+  { "convert_file", reinterpret_cast<PyCFunction> (reinterpret_cast<void (*) ()> (ModuleConvertFile)),
+    METH_VARARGS | METH_KEYWORDS, convertfiledoc },
+  { nullptr, nullptr, 0, nullptr }
+};
+
+static PyModuleDef moduledefinition = {
+  PyModuleDef_HEAD_INIT,
+  "fastcsv2jsonxx",
+  "Fast csv to json array conversion",
+  -1,
+  modulemethods,
+};
+
+PyMODINIT_FUNC
+PyInit_fastcsv2jsonxx ()
+{
+  outputtype.tp_dealloc = OutputDealloc;
+  outputtype.tp_flags = Py_TPFLAGS_DEFAULT;
+  outputtype.tp_doc = PyDoc_STR ("json produced by a conversion, a read only bytes-like object");
+  outputtype.tp_as_buffer = &outputbuffer;
+  outputtype.tp_as_sequence = &outputsequence;
+
+  if (PyType_Ready (&outputtype) < 0)
+    return nullptr;
+
+  PyObject *module = PyModule_Create (&moduledefinition);
+  if (module == nullptr)
+    return nullptr;
+
+  Py_INCREF (&outputtype);
+  if (PyModule_AddObject (module, "Output", reinterpret_cast<PyObject *> (&outputtype)) < 0)
+  {
+    Py_DECREF (&outputtype);
+    Py_DECREF (module);
+    return nullptr;
+  }
+
+  return module;
+}
@@ -0,0 +1,180 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+//
+// fastcsv2json++:
+// test of fastcsv2jsonxx_async.h, run by make check-async. Pipe and
+// socket sources written in small pieces by another thread, read by a
+// slow consumer, must give the json of a single Feed
+//
+// Copyright © 2024 Lucas Tsatiris. All rights reserved.
+//
+
+#include "fastcsv2jsonxx_async.h"
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#include <sys/socket.h>
+
+using namespace fastcsv2jsonxx;
+
+static int failures = 0;
+
+// report a check
+static void
+Check (bool passed, const std::string & name)
+{
+  std::cout << (passed ? "ok: " : "FAIL: ") << name << '\n';
+  if (!passed)
+    failures ++;
+}
+
+// csv with quotes, escapes and rows of every length
+static std::string
+Csv ()
+{
+  std::string csv = "id,name,note\n";
+  for (unsigned row = 0; row < 20000; row++)
+    csv += std::to_string (row) + ",name " + std::to_string (row * 7919 % 1000) +
+           ",\"" + std::string (row % 37, 'x') + "\\\"\n";
+  return csv;
+}
+
+// json of csv fed at once
+static std::string
+Expected (const std::string & csv)
+{
+  Converter converter;
+  converter.Feed (csv);
+  converter.Finish ();
+  return converter.Take ();
+}
+
+// write csv to fd in pieces of 777 bytes, then close it
+static void
+Produce (int fd, const std::string & csv)
+{
+  for (std::size_t offset = 0; offset < csv.size (); )
+  {
+    const auto count = write (fd, csv.data () + offset, std::min<std::size_t> (777, csv.size () - offset));
+    if (count > 0)
+      offset += static_cast<std::size_t> (count);
+  }
+  close (fd);
+}
+
+// take every block, sleeping and yielding between them
+static Task
+ConsumeSlowly (EpollExecutor & executor, AsyncGenerator<std::string> & generator,
+               std::string & json, unsigned & blocks)
+{
+  while (auto block = co_await generator.Next ())
+  {
+    json += *block;
+    blocks ++;
+    usleep (200);
+    co_await executor.Next ();
+  }
+}
+
+// take one block
+static Task
+ConsumeOne (AsyncGenerator<std::string> & generator, std::string & json)
+{
+  if (auto block = co_await generator.Next ())
+    json += *block;
+}
+
+// convert a stream socket or pipe written by another thread
+static void
+TestSource (const std::string & name, int reader, int writer, const std::string & csv)
+{
+  const auto flags = fcntl (reader, F_GETFL);
+  std::thread producer (Produce, writer, std::cref (csv));
+
+  EpollExecutor executor;
+  Converter converter;
+  std::string json;
+  unsigned blocks = 0;
+  {
+    auto generator = ConvertAsync (executor, reader, converter, 4096);
+    ConsumeSlowly (executor, generator, json, blocks);
+    executor.Run ();
+  }
+  producer.join ();
+
+  Check (json == Expected (csv) && converter.Error () == "", name + " json");
+  Check (blocks > 1, name + " json in blocks");
+  Check (fcntl (reader, F_GETFL) == flags, name + " flags restored");
+  close (reader);
+}
+
+// destroy a generator waiting for its descriptor: the executor must
+// forget it and the descriptor get its flags back
+static void
+TestDestroyWaiting ()
+{
+  int pipefd[2];
+  if (pipe (pipefd) != 0)
+  {
+    Check (false, "pipe");
+    return;
+  }
+
+  const auto flags = fcntl (pipefd[0], F_GETFL);
+  EpollExecutor executor;
+  Converter converter;
+  std::string json;
+  {
+    auto generator = ConvertAsync (executor, pipefd[0], converter);
+    ConsumeOne (generator, json);
+  }
+
+  // nothing waits any more, so Run returns at once and nothing resumes
+  executor.Run ();
+  Check (json == "", "destroyed while waiting, not resumed");
+  Check (fcntl (pipefd[0], F_GETFL) == flags, "destroyed while waiting, flags restored");
+
+  close (pipefd[0]);
+  close (pipefd[1]);
+}
+
+int
+main ()
+{
+  const auto csv = Csv ();
+
+  int pipefd[2];
+  if (pipe (pipefd) == 0)
+    TestSource ("pipe", pipefd[0], pipefd[1], csv);
+  else
+    Check (false, "pipe");
+
+  int sockets[2];
+  if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == 0)
+    TestSource ("socket", sockets[0], sockets[1], csv);
+  else
+    Check (false, "socketpair");
+
+  TestDestroyWaiting ();
+
+  return failures != 0 ? 1 : 0;
+}
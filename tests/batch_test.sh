@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# fastcsv2json++:
+# test of the batched render, run by make check-batch. Fixed width
+# inputs with absent canonical columns must give the json of --batch 1,
+# also from an AddressSanitizer build: the block stores of the render
+# read past the batch text and the fragments, into their padding
+#
+# Copyright © 2024 Lucas Tsatiris. All rights reserved.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+work=$(mktemp -d)
+failures=0
+trap 'rm -rf "$work"' EXIT
+
+# report a check
+Check ()
+{
+  if [ "$1" = 0 ]; then
+    echo "ok: $2"
+  else
+    echo "FAIL: $2"
+    failures=$((failures + 1))
+  fi
+}
+
+# fixed width values of 0, 1, 7, 16, 17 and 33 bytes, around the 16 byte
+# stores. The last input has one record, its last value ends the text
+awk 'BEGIN { print "id,code,flag"
+             for (row = 0; row < 5000; row ++)
+               printf "%07d,code-%011d,%d\n", row, row, row % 2 }' > "$work/a.csv"
+awk 'BEGIN { print "id,note,qty,empty"
+             for (row = 0; row < 5000; row ++)
+               printf "%07d,note-%012d,%033d,\n", row, row, row }' > "$work/b.csv"
+printf 'qty,id\n%033d,%07d\n' 7 7 > "$work/c.csv"
+
+inputs="-i $work/a.csv -i $work/b.csv -i $work/c.csv --canonical-schema"
+defaults="--column-default code:none --column-default note:-"
+for binary in ./fastcsv2jsonxx tests/fastcsv2jsonxx_asan; do
+  for options in "" "$defaults" "$defaults -j 3 --read-block 4K" "$defaults --members ndjson" \
+                 "$defaults --mask code:-0+" "--batch 7"; do
+    $binary $inputs $options --batch 1 > "$work/line.json" &&
+      $binary $inputs $options > "$work/batch.json" 2> "$work/error"
+    [ $? = 0 ] && [ ! -s "$work/error" ]
+    Check $? "$binary batched${options:+ }$options"
+    cmp -s "$work/line.json" "$work/batch.json"
+    Check $? "$binary batch matches --batch 1${options:+ }$options"
+  done
+done
+
+[ $failures = 0 ]
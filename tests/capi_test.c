@@ -0,0 +1,276 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * fastcsv2json++:
+ * test of the C interface in fastcsv2json.h, linked with
+ * libfastcsv2json.so and run by make check-capi
+ *
+ * Copyright © 2024 Lucas Tsatiris. All rights reserved.
+ */
+
+#include "fastcsv2json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+/* report a check */
+static void
+Check (int passed, const char *name)
+{
+  printf ("%s: %s\n", passed ? "ok" : "FAIL", name);
+  if (!passed)
+    failures ++;
+}
+
+/* json received by the write callback */
+typedef struct Output
+{
+  char *data;
+  size_t size;
+  size_t capacity;
+  size_t blocks;						/* write calls */
+  size_t smallest;						/* smallest block but the last */
+  size_t last;							/* size of the last block */
+} Output;
+
+static int
+Write (void *context, const char *data, size_t size)
+{
+  Output *output = context;
+
+  if (output->size + size > output->capacity)
+  {
+    output->capacity = (output->size + size) * 2;
+    output->data = realloc (output->data, output->capacity);
+    if (output->data == NULL)
+      return 1;
+  }
+
+  memcpy (output->data + output->size, data, size);
+  output->size += size;
+  if (output->blocks != 0 && output->last < output->smallest)
+    output->smallest = output->last;
+  output->last = size;
+  output->blocks ++;
+  return 0;
+}
+
+static int
+WriteFails (void *context, const char *data, size_t size)
+{
+  (void) context;
+  (void) data;
+  (void) size;
+  return 1;
+}
+
+/* csv of rows lines with fields of every length
+   returns: the csv, to be freed */
+static char *
+Csv (size_t rows, size_t *size)
+{
+  char *csv = malloc (rows * 64 + 32);
+  size_t length = (size_t) sprintf (csv, "id,name,note\n");
+
+  for (size_t row = 0; row < rows; row ++)
+  {
+    length += (size_t) sprintf (csv + length, "%zu,name %zu,", row, row * 7919 % 1000);
+    memset (csv + length, 'x', row % 37);
+    length += row % 37;
+    csv[length ++] = '\n';
+  }
+
+  *size = length;
+  return csv;
+}
+
+/* convert csv fed in pieces of piece bytes, a single feed when 0
+   returns: the status of the last call */
+static fc2j_status
+Convert (const char *csv, size_t size, size_t piece, Output *output)
+{
+  fc2j_options options;
+  fc2j_converter *converter;
+
+  fc2j_options_init (&options);
+  options.write = Write;
+  options.context = output;
+
+  fc2j_status status = fc2j_open (&options, &converter);
+  if (status != FC2J_OK)
+    return status;
+
+  for (size_t offset = 0; offset < size && status == FC2J_OK; )
+  {
+    /* pieces of varying size, splitting lines anywhere */
+    size_t count = piece != 0 ? piece + offset % 13 : size;
+    if (count > size - offset)
+      count = size - offset;
+    status = fc2j_feed (converter, csv + offset, count);
+    offset += count;
+  }
+
+  if (status == FC2J_OK)
+    status = fc2j_finish (converter);
+  fc2j_close (converter);
+  return status;
+}
+
+static void
+TestPieces (void)
+{
+  size_t size;
+  char *csv = Csv (30000, &size);
+  Output whole = { 0 }, pieces = { 0 };
+
+  pieces.smallest = (size_t) -1;
+  Check (Convert (csv, size, 0, &whole) == FC2J_OK, "single feed");
+  Check (Convert (csv, size, 1, &pieces) == FC2J_OK, "feed in pieces");
+  Check (pieces.size == whole.size && memcmp (pieces.data, whole.data, whole.size) == 0,
+         "pieces give the json of a single feed");
+  Check (pieces.blocks > 1 && pieces.smallest >= 65536,
+         "json in blocks of at least block_size");
+
+  free (csv);
+  free (whole.data);
+  free (pieces.data);
+}
+
+static void
+TestWriteFailure (void)
+{
+  fc2j_options options;
+  fc2j_converter *converter;
+  size_t size;
+  char *csv = Csv (30000, &size);
+
+  fc2j_options_init (&options);
+  options.write = WriteFails;
+
+  Check (fc2j_open (&options, &converter) == FC2J_OK, "open");
+  fc2j_status status = fc2j_feed (converter, csv, size);
+  Check (status == FC2J_EWRITE, "feed reports the failed write");
+  Check (strlen (fc2j_error (converter)) != 0, "error after the failed write");
+  Check (fc2j_feed (converter, csv, size) == FC2J_ESTATE, "feed after the failed write");
+  Check (fc2j_finish (converter) == FC2J_ESTATE, "finish after the failed write");
+  fc2j_close (converter);
+
+  /* json shorter than a block fails in finish */
+  Check (fc2j_open (&options, &converter) == FC2J_OK, "open");
+  Check (fc2j_feed (converter, "a\n1\n", 4) == FC2J_OK, "feed below block_size");
+  Check (fc2j_finish (converter) == FC2J_EWRITE, "finish reports the failed write");
+  fc2j_close (converter);
+
+  free (csv);
+}
+
+static void
+TestState (void)
+{
+  fc2j_options options;
+  fc2j_converter *converter;
+  Output output = { 0 };
+
+  fc2j_options_init (&options);
+  options.write = Write;
+  options.context = &output;
+
+  Check (fc2j_open (&options, &converter) == FC2J_OK, "open");
+  Check (fc2j_feed (converter, "a,b\n1,2\n", 8) == FC2J_OK, "feed");
+  Check (fc2j_finish (converter) == FC2J_OK, "finish");
+  Check (output.size == 19 && memcmp (output.data, "[{\"a\":\"1\",\"b\":\"2\"}]", 19) == 0,
+         "json");
+  Check (fc2j_finish (converter) == FC2J_ESTATE, "finish after finish");
+  Check (fc2j_feed (converter, "3,4\n", 4) == FC2J_ESTATE, "feed after finish");
+  Check (strlen (fc2j_error (converter)) == 0, "no error after finish");
+  fc2j_close (converter);
+  fc2j_close (NULL);
+
+  free (output.data);
+}
+
+static void
+TestInvalid (void)
+{
+  fc2j_options options;
+  fc2j_converter *converter = (fc2j_converter *) &options;
+  Output output = { 0 };
+
+  fc2j_options_init (&options);
+  options.write = Write;
+  options.context = &output;
+
+  options.delimiter = 'x';
+  Check (fc2j_open (&options, &converter) == FC2J_EINVAL && converter == NULL,
+         "bad delimiter");
+  options.delimiter = '|';
+  Check (fc2j_open (&options, &converter) == FC2J_OK, "pipe delimiter");
+  fc2j_close (converter);
+  options.delimiter = ',';
+
+  options.size = sizeof (size_t);
+  Check (fc2j_open (&options, &converter) == FC2J_EINVAL, "short options");
+  options.size = sizeof (options);
+
+  options.write = NULL;
+  Check (fc2j_open (&options, &converter) == FC2J_EINVAL, "no write callback");
+  options.write = Write;
+
+  Check (fc2j_open (&options, NULL) == FC2J_EINVAL, "no converter pointer");
+  Check (fc2j_feed (NULL, "a\n", 2) == FC2J_EINVAL, "feed without converter");
+
+  const char *unknown[] = { "--no-such-option" };
+  options.argv = unknown;
+  options.argc = 1;
+  Check (fc2j_open (&options, &converter) == FC2J_EINVAL, "unknown option");
+
+  const char *parallel[] = { "-j", "4" };
+  options.argv = parallel;
+  options.argc = 2;
+  Check (fc2j_open (&options, &converter) == FC2J_EINVAL, "-j rejected");
+
+  /* a conversion error stops the converter */
+  const char *abort[] = { "--bad-rows", "abort" };
+  options.argv = abort;
+  Check (fc2j_open (&options, &converter) == FC2J_OK, "open with --bad-rows abort");
+  fc2j_status status = fc2j_feed (converter, "a,b\n1\n", 6);
+  if (status == FC2J_OK)
+    status = fc2j_finish (converter);
+  Check (status == FC2J_ECONVERT, "bad row stops the conversion");
+  Check (strstr (fc2j_error (converter), "line 2") != NULL, "error of the bad row");
+  Check (fc2j_feed (converter, "1,2\n", 4) == FC2J_ESTATE, "feed after the bad row");
+  fc2j_close (converter);
+
+  Check (strchr (fc2j_version (), '.') != NULL, "version");
+  free (output.data);
+}
+
+int
+main (void)
+{
+  TestPieces ();
+  TestWriteFailure ();
+  TestState ();
+  TestInvalid ();
+
+  return failures != 0 ? 1 : 0;
+}
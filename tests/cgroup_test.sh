@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# fastcsv2json++:
+# test of the cgroup v2 limits read with --cgroup from fake cgroup
+# directories, run by make check-cgroup
+#
+# Copyright © 2024 Lucas Tsatiris. All rights reserved.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+work=$(mktemp -d)
+failures=0
+trap 'rm -rf "$work"' EXIT
+
+# report a check
+Check ()
+{
+  if [ "$1" = 0 ]; then
+    echo "ok: $2"
+  else
+    echo "FAIL: $2"
+    failures=$((failures + 1))
+  fi
+}
+
+# fake cgroup directory NAME with cpu.max CPU and memory.max MEMORY
+Cgroup ()
+{
+  mkdir "$work/$1"
+  echo "$2" > "$work/$1/cpu.max"
+  echo "$3" > "$work/$1/memory.max"
+}
+
+# the --stats lines of a -j 4 conversion under cgroup NAME
+Stats ()
+{
+  ./fastcsv2jsonxx -i "$work/in.csv" -j 4 --stats --cgroup "$work/$1" -o "$work/$1.json" 2>&1
+}
+
+awk 'BEGIN { print "id,name,amount"
+             for (row = 0; row < 200000; row ++)
+               printf "%d,name %d,%d.%02d\n", row, row * 7919 % 1000, row, row % 100 }' \
+  > "$work/in.csv"
+./fastcsv2jsonxx -i "$work/in.csv" -o "$work/serial.json"
+
+# a quota of 1.5 cpus rounds up to 2, the affinity mask may allow fewer
+cpus=$(nproc)
+[ "$cpus" -gt 2 ] && cpus=2
+Cgroup quota "150000 100000" max
+Stats quota | grep -q "^cgroup limits: cpus $cpus (cpu.max 2), memory unlimited$"
+Check $? "cpu.max 150000 100000 is 2 cpus"
+
+Cgroup unlimited "max 100000" max
+! Stats unlimited | grep -q "^cgroup limits"
+Check $? "cpu.max and memory.max of max are no limits"
+
+# a 32M memory.max caps the read block, so the same input takes more reads
+Cgroup memory "max 100000" 33554432
+reads=$(Stats memory | sed -n 's/^read calls: \([0-9]*\),.*/\1/p')
+unlimited=$(Stats unlimited | sed -n 's/^read calls: \([0-9]*\),.*/\1/p')
+Stats memory | grep -q "^cgroup limits: cpus $(nproc), memory 33554432$" &&
+  [ "$reads" -gt "$unlimited" ]
+Check $? "memory.max caps the read block"
+cmp -s "$work/serial.json" "$work/memory.json"
+Check $? "output under the memory limit"
+
+./fastcsv2jsonxx -i "$work/in.csv" --cgroup "$work/nonexistent" > /dev/null 2> "$work/error"
+[ $? = 1 ] && grep -q "Invalid cgroup directory" "$work/error"
+Check $? "missing --cgroup directory"
+
+[ $failures = 0 ]
@@ -0,0 +1,425 @@
+#!/bin/sh
+#
+# fastcsv2json++:
+# test of the command line options, run by make check-cli. Small inputs
+# go through each option, the json and the errors must match the
+# expected ones
+#
+# Copyright © 2024 Lucas Tsatiris. All rights reserved.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+work=$(mktemp -d)
+failures=0
+trap 'rm -rf "$work"' EXIT
+
+# report a check
+Check ()
+{
+  if [ "$1" = 0 ]; then
+    echo "ok: $2"
+  else
+    echo "FAIL: $2"
+    failures=$((failures + 1))
+  fi
+}
+
+# check that a conversion with the options after NAME prints the json
+# and the errors on STDIN, the errors after a line of --
+Expect ()
+{
+  name=$1
+  shift
+  printf '%s\n' "$(cat)" > "$work/expected"
+  ./fastcsv2jsonxx "$@" > "$work/json" 2> "$work/error"
+  { printf '%s\n' "$(cat "$work/json")"
+    [ -s "$work/error" ] && printf -- '--\n%s\n' "$(cat "$work/error")"; } > "$work/actual"
+  cmp -s "$work/expected" "$work/actual" || diff -u "$work/expected" "$work/actual"
+  Check $? "$name"
+}
+
+# --validate: every keyword of the schema subset, and schema errors
+printf 'id,name,amount,kind\n1,ann,10,a\n2,bob,x,b\n3,cy,300,a\n4,,5,a\n5,dot,-1,b\n6,ed,2.5e1,a\n7,bea,1,c\n8,edwina,1,a\n9,e,1,a\n10.5,bea,1,b\n' \
+  > "$work/validate.csv"
+cat > "$work/schema.json" <<'JSON'
+{"type": "object",
+ "properties": {"amount": {"type": "number", "minimum": 0, "maximum": 100},
+                "name": {"type": "string", "pattern": "^[a-e][a-z]*$", "minLength": 2, "maxLength": 5},
+                "kind": {"enum": ["a", "b"]},
+                "id": {"type": "integer"}},
+ "required": ["id", "name"]}
+JSON
+Expect "--validate keywords" -i "$work/validate.csv" --validate "$work/schema.json" --bad-rows report <<'JSON'
+[{"id":"1","name":"ann","amount":"10","kind":"a"},
+{"id":"6","name":"ed","amount":"2.5e1","kind":"a"}]
+--
+Bad row at line 3: failed type of amount
+Bad row at line 4: failed maximum of amount
+Bad row at line 5: failed pattern of name
+Bad row at line 6: failed minimum of amount
+Bad row at line 8: failed enum of kind
+Bad row at line 9: failed maxLength of name
+Bad row at line 10: failed minLength of name
+Bad row at line 11: failed type of id
+JSON
+
+printf 'id,name\n1,a\n2,\n3,c\n' > "$work/required.csv"
+echo '{"required": ["name"]}' > "$work/required.json"
+Expect "--validate required" -i "$work/required.csv" --validate "$work/required.json" <<'JSON'
+[{"id":"1","name":"a"},
+{"id":"3","name":"c"}]
+JSON
+
+Expect "--bad-rows abort keeps the records before" \
+  -i "$work/required.csv" --validate "$work/required.json" --bad-rows abort <<'JSON'
+[{"id":"1","name":"a"}]
+--
+Bad row at line 3: failed required of name
+JSON
+
+echo '{"properties": {"amount": {"type": "nope"}}}' > "$work/type.json"
+Expect "--validate unsupported type" -i "$work/validate.csv" --validate "$work/type.json" <<'JSON'
+
+--
+Invalid schema: unsupported type nope for amount
+JSON
+
+echo '{"properties": {"name": {"pattern": "("}}}' > "$work/pattern.json"
+Expect "--validate invalid pattern" -i "$work/validate.csv" --validate "$work/pattern.json" <<'JSON'
+
+--
+Invalid schema: pattern of name: missing )
+JSON
+
+# --mask and --replace: unanchored, anchored and repeated matches, in
+# batches and a line at a time
+printf 'id,card,note\n1,4111-1111-1111-1234,call 555-1234 now\n2,5500-0000-0000-0004,none\n3,x,555-9999 555-0000\n' \
+  > "$work/rewrite.csv"
+for batch in 1024 1; do
+  Expect "--mask and --replace, --batch $batch" -i "$work/rewrite.csv" --batch $batch \
+    --mask 'card:[0-9]{4}-' --replace 'note:[0-9]{3}-[0-9]{4}:<phone>' <<'JSON'
+[{"id":"1","card":"***************1234","note":"call <phone> now"},
+{"id":"2","card":"***************0004","note":"none"},
+{"id":"3","card":"x","note":"<phone> <phone>"}]
+JSON
+done
+
+Expect "--mask anchored with ^ and \$" -i "$work/rewrite.csv" --mask 'card:^[0-9]+' --mask 'note:[0-9]+$' <<'JSON'
+[{"id":"1","card":"****-1111-1111-1234","note":"call 555-1234 now"},
+{"id":"2","card":"****-0000-0000-0004","note":"none"},
+{"id":"3","card":"x","note":"555-9999 555-****"}]
+JSON
+
+Expect "--mask invalid regex" -i "$work/rewrite.csv" --mask 'card:(' <<'JSON'
+
+--
+Invalid --mask card:(: missing )
+JSON
+
+# --hash-col: siphash-2-4 and siphash-1-3 digests under hex and byte
+# keys, and the keys refused
+printf 'id,email\n1,a@x.org\n2,b@y.org\n' > "$work/hash.csv"
+printf '000102030405060708090a0b0c0d0e0f\n' > "$work/hex.key"
+printf '0123456789abcdef' > "$work/bytes.key"
+Expect "--hash-col with a hex key" -i "$work/hash.csv" --hash-col email --hash-key "$work/hex.key" <<'JSON'
+[{"id":"1","email":"2f94db43971612dc"},
+{"id":"2","email":"3181841e501b1f8c"}]
+JSON
+
+Expect "--hash-col siphash13" -i "$work/hash.csv" --hash-col email:siphash13 --hash-key "$work/hex.key" <<'JSON'
+[{"id":"1","email":"9d1b76e0cd4b7394"},
+{"id":"2","email":"8b17774951eb5260"}]
+JSON
+
+Expect "--hash-col with a 16 byte key" -i "$work/hash.csv" --hash-col email --hash-key "$work/bytes.key" <<'JSON'
+[{"id":"1","email":"229c016da510776b"},
+{"id":"2","email":"5fccb55687ce6d9c"}]
+JSON
+
+printf '000102030405060708090a0b0c0d0e0\n' > "$work/short.key"
+printf '000102030405060708090a0b0c0d0e0f\n\n' > "$work/long.key"
+for key in short long; do
+  Expect "--hash-key refuses a $key key" -i "$work/hash.csv" --hash-col email --hash-key "$work/$key.key" <<JSON
+
+--
+Invalid hash key: need 32 hex digits or exactly 16 bytes in $work/$key.key
+JSON
+done
+
+Expect "--hash-col requires --hash-key" -i "$work/hash.csv" --hash-col email <<'JSON'
+
+--
+Invalid hash key: --hash-col requires --hash-key
+JSON
+
+# --dialect: the escapes of each tokenizer, -d over a dialect, an open
+# quote at the end of the input
+printf 'id\tname\tnote\n1\tann\ta\\tb\\nc\\\\d\n2\t"q"\tx\n' > "$work/dialect.tsv"
+Expect "--dialect tsv" -i "$work/dialect.tsv" --dialect tsv <<'JSON'
+[{"id":"1","name":"ann","note":"a\tb\nc\\d"},
+{"id":"2","name":"\"q\"","note":"x"}]
+JSON
+
+printf '\357\273\277id,name,note\r\n1,"a ""b"", c","x\r\ny"\r\n2,="007",plain\r\n' > "$work/excel.csv"
+Expect "--dialect excel" -i "$work/excel.csv" --dialect excel <<'JSON'
+[{"id":"1","name":"a \"b\", c","note":"x\r\ny"},
+{"id":"2","name":"007","note":"plain"}]
+JSON
+
+printf 'id;name\r\n1;"a;b"\r\n2;"x ""y"""\r\n' > "$work/rfc4180.csv"
+Expect "--dialect rfc4180 -d semicolumn" -i "$work/rfc4180.csv" --dialect rfc4180 -d semicolumn <<'JSON'
+[{"id":"1","name":"a;b"},
+{"id":"2","name":"x \"y\""}]
+JSON
+
+printf 'id,name\n1,"a \\"b\\", c"\n2,x\\,y\n' > "$work/unix.csv"
+Expect "--dialect unix" -i "$work/unix.csv" --dialect unix <<'JSON'
+[{"id":"1","name":"a \"b\", c"},
+{"id":"2","name":"x,y"}]
+JSON
+
+printf 'id,name\n1,"open\n' > "$work/open.csv"
+Expect "--dialect rfc4180 unterminated quote" -i "$work/open.csv" --dialect rfc4180 --bad-rows report <<'JSON'
+[]
+--
+Bad row at line 2: unterminated quoted field
+JSON
+
+Expect "--dialect unknown" -i "$work/unix.csv" --dialect nope <<'JSON'
+
+--
+Unknown dialect: nope
+JSON
+
+# --skip-lines and --comment-char: a preamble, comment and blank lines
+# around the header and the records, serial and in 4K -j chunks
+printf 'title line\nexported 2024\n# comment\nid,name\n\n# another\n1,a\n\n2,b\n#3,c\n' > "$work/comment.csv"
+for options in "" "-j 2 --read-block 4K"; do
+  Expect "--skip-lines and --comment-char${options:+ }$options" \
+    -i "$work/comment.csv" --skip-lines 2 --comment-char '#' $options <<'JSON'
+[{"id":"1","name":"a"},
+{"id":"2","name":"b"}]
+JSON
+done
+
+Expect "--skip-lines without --comment-char" -i "$work/comment.csv" --skip-lines 3 <<'JSON'
+[{"id":"1","name":"a"},
+{"id":"2","name":"b"},
+{"id":"#3","name":"c"}]
+JSON
+
+Expect "--comment-char of two characters" -i "$work/comment.csv" --comment-char ab <<'JSON'
+
+--
+Invalid comment character: ab
+JSON
+
+# --header-row, --header-rows and --header-join: a title line, two
+# header lines with empty cells repeating the cell to their left
+printf 'Report\n,2024,,2025,\nid,q1,q2,q1,q2\n1,10,20,30,40\n2,11,21,31,41\n' > "$work/header.csv"
+for options in "--header-row 2" "--skip-lines 1 -j 2"; do
+  Expect "--header-rows 2 $options" -i "$work/header.csv" --header-rows 2 $options <<'JSON'
+[{"id":"1","2024.q1":"10","2024.q2":"20","2025.q1":"30","2025.q2":"40"},
+{"id":"2","2024.q1":"11","2024.q2":"21","2025.q1":"31","2025.q2":"41"}]
+JSON
+done
+
+Expect "--header-join" -i "$work/header.csv" --header-row 2 --header-rows 2 --header-join _ <<'JSON'
+[{"id":"1","2024_q1":"10","2024_q2":"20","2025_q1":"30","2025_q2":"40"},
+{"id":"2","2024_q1":"11","2024_q2":"21","2025_q1":"31","2025_q2":"41"}]
+JSON
+
+Expect "--header-row 3" -i "$work/header.csv" --header-row 3 <<'JSON'
+[{"id":"1","q1":"10","q2":"20","q1":"30","q2":"40"},
+{"id":"2","q1":"11","q2":"21","q1":"31","q2":"41"}]
+JSON
+
+Expect "--header-rows 0" -i "$work/header.csv" --header-rows 0 <<'JSON'
+
+--
+Invalid header line: 0
+JSON
+
+# --canonical-schema: inputs with reordered, appended and missing
+# columns, with and without --column-default
+printf 'id,name\n1,a\n' > "$work/first.csv"
+printf 'name,id,city\nb,2,rome\n' > "$work/second.csv"
+printf 'id\n3\n' > "$work/third.csv"
+inputs="-i $work/first.csv -i $work/second.csv -i $work/third.csv"
+Expect "inputs with their own headers" $inputs <<'JSON'
+[{"id":"1","name":"a"},
+{"name":"b","id":"2","city":"rome"},
+{"id":"3"}]
+JSON
+
+Expect "--canonical-schema with --column-default" $inputs --canonical-schema \
+  --column-default city:unknown --column-default name:- <<'JSON'
+[{"id":"1","name":"a","city":"unknown"},
+{"id":"2","name":"b","city":"rome"},
+{"id":"3","name":"-","city":"unknown"}]
+JSON
+
+Expect "--canonical-schema --members ndjson" $inputs --canonical-schema --members ndjson <<JSON
+{"_file":"$work/first.csv","id":"1","name":"a","city":""}
+{"_file":"$work/second.csv","id":"2","name":"b","city":"rome"}
+{"_file":"$work/third.csv","id":"3","name":"","city":""}
+JSON
+
+Expect "--column-default without a value" $inputs --canonical-schema --column-default city <<'JSON'
+
+--
+Invalid column default: city
+JSON
+
+# zip, tar and tar.gz inputs: the csv members against the plain files,
+# deflated and stored, serial and with -j
+mkdir -p "$work/members/sub"
+printf 'id,name\n1,a\n2,b\n' > "$work/members/a.csv"
+printf 'id,city\n3,rome\n' > "$work/members/sub/b.csv"
+echo readme > "$work/members/readme.txt"
+awk 'BEGIN { print "id,name,amount"
+             for (row = 0; row < 100000; row ++)
+               printf "%d,name %d,%d.%02d\n", row, row * 7919 % 1000, row, row % 100 }' \
+  > "$work/members/large.csv"
+(cd "$work/members" &&
+ tar cf ../members.tar a.csv sub/b.csv readme.txt &&
+ tar czf ../members.tar.gz a.csv sub/b.csv readme.txt &&
+ tar czf ../large.tar.gz large.csv &&
+ ${PYTHON:-python3} -c 'import zipfile
+with zipfile.ZipFile ("../members.zip", "w") as archive:
+  archive.write ("a.csv", compress_type = zipfile.ZIP_DEFLATED)
+  archive.write ("sub/b.csv", compress_type = zipfile.ZIP_STORED)
+  archive.write ("readme.txt")
+with zipfile.ZipFile ("../large.zip", "w", zipfile.ZIP_DEFLATED) as archive:
+  archive.write ("large.csv")')
+./fastcsv2jsonxx -i "$work/members/a.csv" -i "$work/members/sub/b.csv" > "$work/plain.json"
+./fastcsv2jsonxx -i "$work/members/large.csv" > "$work/large.json"
+for archive in members.zip members.tar members.tar.gz; do
+  Expect "$archive members as json lines" -i "$work/$archive" <<'JSON'
+{"_file":"a.csv","id":"1","name":"a"}
+{"_file":"a.csv","id":"2","name":"b"}
+{"_file":"sub/b.csv","id":"3","city":"rome"}
+JSON
+  ./fastcsv2jsonxx -i "$work/$archive" --members array | cmp -s "$work/plain.json" -
+  Check $? "$archive members match the plain files"
+done
+for archive in large.zip large.tar.gz; do
+  for options in "" "-j 3 --read-block 4K"; do
+    ./fastcsv2jsonxx -i "$work/$archive" --members array $options | cmp -s "$work/large.json" -
+    Check $? "$archive member matches the plain file${options:+ }$options"
+  done
+done
+
+head -c 100 "$work/members.tar.gz" > "$work/truncated.tar.gz"
+Expect "truncated tar.gz" -i "$work/truncated.tar.gz" <<JSON
+
+--
+$work/truncated.tar.gz: truncated tar
+JSON
+
+# -j against the serial conversion, to stdout and to a mapped -o file,
+# with a bad row inside a chunk
+awk 'BEGIN { print "id,name,amount"
+             for (row = 0; row < 100000; row ++)
+               if (row == 54321)
+                 print "bad row"
+               else
+                 printf "%d,name %d,%d.%02d\n", row, row * 7919 % 1000, row, row % 100 }' \
+  > "$work/parallel.csv"
+./fastcsv2jsonxx -i "$work/parallel.csv" > "$work/serial.json"
+for options in "-j 2" "-j 4 --read-block 4K" "-j 3 --batch 1" "-j 3 --read-depth 1"; do
+  ./fastcsv2jsonxx -i "$work/parallel.csv" $options | cmp -s "$work/serial.json" -
+  Check $? "$options matches the serial output"
+  ./fastcsv2jsonxx -i "$work/parallel.csv" $options -o "$work/parallel.json" &&
+    cmp -s "$work/serial.json" "$work/parallel.json"
+  Check $? "$options -o matches the serial output"
+done
+
+./fastcsv2jsonxx -i "$work/parallel.csv" --bad-rows report 2> "$work/serial.error" > /dev/null
+./fastcsv2jsonxx -i "$work/parallel.csv" --bad-rows report -j 4 --read-block 4K 2> "$work/parallel.error" > /dev/null
+cmp -s "$work/serial.error" "$work/parallel.error" && grep -q "^Bad row at line 54323: " "$work/parallel.error"
+Check $? "-j reports a bad row at its input line"
+
+# --auto-tune: measurements over the first 16M windows of a 40M input
+# must not change the json, a short input is not measured
+awk 'BEGIN { print "id,name,amount"
+             for (row = 0; row < 1600000; row ++)
+               printf "%d,name %d,%d.%02d\n", row, row * 7919 % 1000, row, row % 100 }' \
+  > "$work/tune.csv"
+./fastcsv2jsonxx -i "$work/tune.csv" > "$work/tune.json"
+for options in "" "-j 3" "-j 3 -o $work/tuned.json"; do
+  ./fastcsv2jsonxx -i "$work/tune.csv" --auto-tune --stats $options > "$work/stdout.json" 2> "$work/stats"
+  grep -q "^auto-tune: read block [0-9]*K, workers [0-9]* of [0-9]*, [0-9]* measurements over [0-9]*M, best [0-9]* MB/s$" \
+    "$work/stats"
+  Check $? "--auto-tune measures${options:+ }$options"
+  case $options in
+    *-o*) cmp -s "$work/tune.json" "$work/tuned.json" ;;
+    *) cmp -s "$work/tune.json" "$work/stdout.json" ;;
+  esac
+  Check $? "--auto-tune output matches the serial output${options:+ }$options"
+done
+
+./fastcsv2jsonxx -i "$work/header.csv" --auto-tune --stats 2>&1 > /dev/null |
+  grep -q "^auto-tune: read block [0-9]*K, workers [0-9]* of [0-9]*, input too short to measure$"
+Check $? "--auto-tune of a short input"
+
+# --batch: batches of every size around the bad rows give the json and
+# the reports of a line at a time, after the -r and -e filters
+printf 'id,name\n1,"a;b"\n2\n3,c,d\n4,d\n5,e\n' > "$work/batch.csv"
+for batch in 1 2 3 1024; do
+  Expect "--batch $batch" -i "$work/batch.csv" --batch $batch -e dquote -r semicolumn --bad-rows report <<'JSON'
+[{"id":"1","name":"a b"},
+{"id":"4","name":"d"},
+{"id":"5","name":"e"}]
+--
+Bad row at line 3: invalid field count
+Bad row at line 4: invalid field count
+JSON
+done
+
+Expect "--batch with --bad-rows abort" -i "$work/batch.csv" --batch 1024 -e dquote --bad-rows abort <<'JSON'
+[{"id":"1","name":"a;b"}]
+--
+Bad row at line 3: invalid field count
+JSON
+
+Expect "--batch 0" -i "$work/batch.csv" --batch 0 <<'JSON'
+
+--
+Invalid batch size: 0
+JSON
+
+# -j output buffers: 4K read blocks give 4 workers a pool of 20 buffers,
+# recycled for json needing hundreds of them, stalls or not
+for members in array ndjson; do
+  ./fastcsv2jsonxx -i "$work/tune.csv" --members $members > "$work/pool.json"
+  ./fastcsv2jsonxx -i "$work/tune.csv" --members $members -j 4 --read-block 4K --stats \
+    2> "$work/stats" | cmp -s "$work/pool.json" -
+  Check $? "pooled buffers give the serial output, --members $members"
+  allocated=$(sed -n 's/^output buffers: \([0-9]*\) allocated of 20, stalls: [0-9]*$/\1/p' "$work/stats")
+  [ -n "$allocated" ] && [ "$allocated" -lt $(($(wc -c < "$work/pool.json") / 262144)) ]
+  Check $? "output buffers are recycled, --members $members"
+done
+
+# --pin: cpu lists on the first cpu allowed, compact and scatter give the
+# serial json, malformed lists are refused
+cpu=$(sed -n 's/^Cpus_allowed_list:[[:space:]]*\([0-9]*\).*/\1/p' /proc/self/status)
+for pin in "$cpu" "$cpu,$cpu-$cpu" compact scatter; do
+  ./fastcsv2jsonxx -i "$work/parallel.csv" -j 2 --pin "$pin" --stats 2> "$work/stats" |
+    cmp -s "$work/serial.json" -
+  Check $? "--pin $pin matches the serial output"
+done
+./fastcsv2jsonxx -i "$work/parallel.csv" -j 2 --pin "$cpu" --stats 2>&1 > /dev/null |
+  grep -q "^pinning: list, workers on cpus $cpu,$cpu, reader on cpu $cpu, writer on cpu $cpu"
+Check $? "--pin $cpu places every thread on cpu $cpu"
+
+for pin in x 3-1 -1 0- 1,,2 ,0 0, 0-99999; do
+  Expect "--pin $pin refused" -i "$work/batch.csv" -j 2 --pin "$pin" <<JSON
+
+--
+Invalid pinning: $pin
+JSON
+done
+
+[ $failures = 0 ]
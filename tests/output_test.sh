@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# fastcsv2json++:
+# test of the mapped -o file output of -j, run by make check-output.
+# The file must match stdout, a file size limit must end in an error
+#
+# Copyright © 2024 Lucas Tsatiris. All rights reserved.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+work=$(mktemp -d)
+failures=0
+trap 'rm -rf "$work"' EXIT
+
+# report a check
+Check ()
+{
+  if [ "$1" = 0 ]; then
+    echo "ok: $2"
+  else
+    echo "FAIL: $2"
+    failures=$((failures + 1))
+  fi
+}
+
+awk 'BEGIN { print "id,name,amount,note"
+             for (row = 0; row < 100000; row ++)
+               printf "%d,name %d,%d.%02d,note %d\n", row, row * 7919 % 1000, row, row % 100, row }' \
+  > "$work/in.csv"
+
+for options in "-j 3 --read-block 4K" "-j 3" "-j 3 --batch 1" "-j 3 --members ndjson"; do
+  ./fastcsv2jsonxx -i "$work/in.csv" $options > "$work/stdout.json"
+  ./fastcsv2jsonxx -i "$work/in.csv" $options -o "$work/file.json"
+  Check $? "mapped output $options"
+  cmp -s "$work/stdout.json" "$work/file.json"
+  Check $? "mapped output matches stdout $options"
+done
+
+# a file size limit fails the reservation: the output is written until
+# the limit, then the conversion ends with an error and no signal
+(trap '' XFSZ; ulimit -f 256
+ ./fastcsv2jsonxx -i "$work/in.csv" -j 3 -o "$work/limited.json" 2> "$work/error")
+[ $? = 1 ] && grep -q "Cannot write output file" "$work/error"
+Check $? "file size limit ends in an error"
+
+[ $failures = 0 ]
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# fastcsv2json++:
+# test of -o shm:/name with fastcsv2json_shmcat, run by make check-shm.
+# A small ring wraps many times, the json must match the -o file output
+#
+# Copyright © 2024 Lucas Tsatiris. All rights reserved.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+work=$(mktemp -d)
+ring=/fc2j_test_$$
+failures=0
+trap 'rm -rf "$work"; rm -f /dev/shm$ring' EXIT
+
+# report a check
+Check ()
+{
+  if [ "$1" = 0 ]; then
+    echo "ok: $2"
+  else
+    echo "FAIL: $2"
+    failures=$((failures + 1))
+  fi
+}
+
+awk 'BEGIN { print "id,name,amount,note"
+             for (row = 0; row < 60000; row ++)
+               printf "%d,name %d,%d.%02d,note %d\n", row, row * 7919 % 1000, row, row % 100, row }' \
+  > "$work/in.csv"
+
+for options in "" "-j 4" "-j 4 --members ndjson"; do
+  ./fastcsv2jsonxx -i "$work/in.csv" $options -o "$work/file.json"
+  ./fastcsv2jsonxx -i "$work/in.csv" $options -o shm:$ring --shm-size 16K &
+  producer=$!
+  timeout 60 ./fastcsv2json_shmcat $ring > "$work/shm.json"
+  consumer=$?
+  wait $producer
+  Check $((consumer + $?)) "producer and consumer${options:+ }$options"
+  cmp -s "$work/file.json" "$work/shm.json"
+  Check $? "ring output matches the file output${options:+ }$options"
+done
+
+# a ring left open by a killed producer is stale: the consumer waits for
+# the next producer, the producer replaces the ring
+./fastcsv2jsonxx -i "$work/in.csv" -o "$work/file.json"
+./fastcsv2jsonxx -i "$work/in.csv" -o shm:$ring --shm-size 16K &
+producer=$!
+sleep 1
+kill -9 $producer
+wait $producer 2> /dev/null
+timeout 60 ./fastcsv2json_shmcat $ring > "$work/shm.json" &
+consumer=$!
+sleep 1
+./fastcsv2jsonxx -i "$work/in.csv" -o shm:$ring --shm-size 16K
+wait $consumer
+Check $? "consumer skips a stale ring"
+cmp -s "$work/file.json" "$work/shm.json"
+Check $? "output of the next producer"
+
+# a producer killed while the consumer reads ends the consumer with an error
+mkfifo "$work/fifo"
+./fastcsv2jsonxx -o shm:$ring --shm-size 16K < "$work/fifo" &
+producer=$!
+exec 3> "$work/fifo"
+head -n 100 "$work/in.csv" >&3
+timeout 60 ./fastcsv2json_shmcat $ring > "$work/shm.json" 2> "$work/error" &
+consumer=$!
+sleep 1
+kill -9 $producer
+wait $consumer
+status=$?
+exec 3>&-
+[ $status != 0 ] && grep -q "producer exited" "$work/error"
+Check $? "consumer notices the producer exit"
+
+[ $failures = 0 ]
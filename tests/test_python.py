@@ -0,0 +1,125 @@
+#
+# fastcsv2json++:
+# pytest of the python module, run by make check-python
+#
+# Copyright © 2024 Lucas Tsatiris. All rights reserved.
+#
+
+import os
+import subprocess
+import sys
+import threading
+
+import pytest
+
+sys.path.insert (0, os.path.join (os.path.dirname (os.path.abspath (__file__)), ".."))
+
+import fastcsv2jsonxx
+
+CSV = b"id,name\n1,one\n2,two\n"
+JSON = b'[{"id":"1","name":"one"},\n{"id":"2","name":"two"}]'
+
+
+def test_convert_bytes ():
+    assert bytes (fastcsv2jsonxx.convert (CSV)) == JSON
+
+
+@pytest.mark.parametrize ("wrap", [bytearray, memoryview])
+def test_convert_buffers (wrap):
+    assert bytes (fastcsv2jsonxx.convert (wrap (CSV))) == JSON
+
+
+def test_convert_options ():
+    json = fastcsv2jsonxx.convert (CSV.replace (b",", b"|"), ["-d", "pipe"])
+    assert bytes (json) == JSON
+
+
+def test_output_is_a_read_only_buffer ():
+    json = fastcsv2jsonxx.convert (CSV)
+    view = memoryview (json)
+    assert view.readonly
+    assert len (json) == len (JSON)
+    assert view.tobytes () == JSON
+
+
+def test_convert_file (tmp_path):
+    path = tmp_path / "input.csv"
+    path.write_bytes (CSV)
+    assert bytes (fastcsv2jsonxx.convert_file (str (path))) == JSON
+
+
+def test_convert_empty_file (tmp_path):
+    path = tmp_path / "empty.csv"
+    path.write_bytes (b"")
+    assert bytes (fastcsv2jsonxx.convert_file (str (path))) == \
+        bytes (fastcsv2jsonxx.convert (b""))
+
+
+def test_convert_file_missing (tmp_path):
+    with pytest.raises (FileNotFoundError):
+        fastcsv2jsonxx.convert_file (str (tmp_path / "missing.csv"))
+
+
+def test_invalid_options ():
+    with pytest.raises (ValueError):
+        fastcsv2jsonxx.convert (CSV, ["--no-such-option"])
+    with pytest.raises (TypeError):
+        fastcsv2jsonxx.convert (CSV, [1])
+
+
+@pytest.mark.parametrize ("options", [["-j", "4"], ["-j", "4", "--read-block", "4K"],
+                                      ["--auto-tune"]])
+def test_parallel_matches_serial (tmp_path, options):
+    csv = b"id,name,amount\n" + \
+        b"".join (b"%d,name %d,%d.%02d\n" % (row, row * 7919 % 1000, row, row % 100)
+                  for row in range (50000))
+    path = tmp_path / "input.csv"
+    path.write_bytes (csv)
+    serial = bytes (fastcsv2jsonxx.convert (csv))
+    assert bytes (fastcsv2jsonxx.convert (csv, options)) == serial
+    assert bytes (fastcsv2jsonxx.convert_file (str (path), options)) == serial
+
+
+def test_parallel_errors ():
+    with pytest.raises (ValueError, match = "invalid field count"):
+        fastcsv2jsonxx.convert (b"a,b\n" + b"1,2\n" * 10000 + b"1\n",
+                                ["-j", "4", "--read-block", "4K", "--bad-rows", "abort"])
+
+
+def test_threads_convert_together ():
+    csv = b"a,b\n" + b"".join (b"%d,%d\n" % (row, row * 3) for row in range (100000))
+    expected = bytes (fastcsv2jsonxx.convert (csv))
+    results = [None] * 4
+
+    def convert (index):
+        results[index] = bytes (fastcsv2jsonxx.convert (csv))
+
+    threads = [threading.Thread (target = convert, args = (index,)) for index in range (4)]
+    for thread in threads:
+        thread.start ()
+    for thread in threads:
+        thread.join ()
+    assert results == [expected] * 4
+
+
+def test_out_of_memory_raises ():
+    # a conversion larger than the address space left raises MemoryError
+    # instead of aborting the interpreter
+    script = """
+import resource, sys
+sys.path.insert (0, sys.argv[1])
+import fastcsv2jsonxx
+csv = b"a,b\\n" + b"1234567890,1234567890\\n" * 4000000
+with open ("/proc/self/status") as status:
+    size = next (int (line.split ()[1]) for line in status if line.startswith ("VmSize"))
+resource.setrlimit (resource.RLIMIT_AS, ((size << 10) + (32 << 20),) * 2)
+try:
+    fastcsv2jsonxx.convert (csv)
+except MemoryError:
+    print ("MemoryError")
+"""
+    root = os.path.join (os.path.dirname (os.path.abspath (__file__)), "..")
+    result = subprocess.run ([sys.executable, "-c", script, root],
+                             capture_output = True, text = True)
+    assert result.returncode == 0, result.stderr
+    assert result.stdout.strip () == "MemoryError"